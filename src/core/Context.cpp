@@ -25,30 +25,68 @@
 #include "KernelInvocation.h"
 #include "Memory.h"
 #include "Program.h"
+#include "ThreadPool.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
+#include "plugins/AccessAnalyzer.h"
 #include "plugins/InstructionCounter.h"
 #include "plugins/InteractiveDebugger.h"
 #include "plugins/Logger.h"
 #include "plugins/MemCheck.h"
+#include "plugins/Profiler.h"
 #include "plugins/RaceDetector.h"
 #include "plugins/Uninitialized.h"
 
 using namespace oclgrind;
 using namespace std;
 
+// Size of the per-thread buffers used for batched memory access delivery
+#define ACCESS_BUFFER_SIZE 1024
+#define ACCESS_DATA_SIZE   (ACCESS_BUFFER_SIZE*16)
+
+struct AccessBuffer
+{
+  size_t numAccesses;
+  size_t dataSize;
+  Plugin::MemoryAccess accesses[ACCESS_BUFFER_SIZE];
+  uint8_t data[ACCESS_DATA_SIZE];
+};
+
+// Each thread allocates its buffers (one per address space) the first time
+// it buffers an access, and reuses them for every work-group it runs
+static THREAD_LOCAL AccessBuffer *accessBuffers = NULL;
+
 Context::Context()
 {
   m_globalMemory = new Memory(AddrSpaceGlobal, sizeof(size_t)==8 ? 16 : 8,
                               this);
-  m_kernelInvocation = NULL;
+  // Worker threads are only created once a kernel needs them
+  m_threadPool = new ThreadPool();
 
   loadPlugins();
 }
 
 Context::~Context()
 {
+  // Report how the worker threads were used, once they have stopped
+  m_threadPool->shutdown();
+  if (checkEnv("OCLGRIND_POOL_STATS"))
+  {
+    ThreadPool::Statistics statistics = m_threadPool->getStatistics();
+    streamsize precision = cout.precision();
+    cout << "Thread pool statistics:" << endl
+         << "  Threads created: " << statistics.numThreads << endl
+         << "  Launches served: "
+         << statistics.launches + statistics.inlineLaunches
+         << " (" << statistics.inlineLaunches << " inline)" << endl
+         << fixed << setprecision(3)
+         << "  Busy time:       " << statistics.busyTime << " s" << endl
+         << "  Idle time:       " << statistics.idleTime << " s" << endl;
+    cout.unsetf(ios::floatfield);
+    cout.precision(precision);
+  }
+  delete m_threadPool;
   delete m_globalMemory;
 
   unloadPlugins();
@@ -69,6 +107,11 @@ Memory* Context::getGlobalMemory() const
   return m_globalMemory;
 }
 
+ThreadPool* Context::getThreadPool() const
+{
+  return m_threadPool;
+}
+
 void Context::loadPlugins()
 {
   // Create core plugins
@@ -78,9 +121,16 @@ void Context::loadPlugins()
   if (checkEnv("OCLGRIND_INST_COUNTS"))
     m_plugins.push_back(make_pair(new InstructionCounter(this), true));
 
+  if (checkEnv("OCLGRIND_ACCESS_PATTERNS"))
+    m_plugins.push_back(make_pair(new AccessAnalyzer(this), true));
+
   if (checkEnv("OCLGRIND_DATA_RACES"))
     m_plugins.push_back(make_pair(new RaceDetector(this), true));
 
+  const char *profile = getenv("OCLGRIND_PROFILE");
+  if (profile)
+    m_plugins.push_back(make_pair(new Profiler(this, profile), true));
+
   if (checkEnv("OCLGRIND_UNINITIALIZED"))
     m_plugins.push_back(make_pair(new Uninitialized(this), true));
 
@@ -134,6 +184,8 @@ void Context::loadPlugins()
       m_pluginLibraries.push_back(library);
     }
   }
+
+  updateEventPlugins();
 }
 
 void Context::unloadPlugins()
@@ -169,16 +221,61 @@ void Context::unloadPlugins()
   }
 
   m_plugins.clear();
+  updateEventPlugins();
 }
 
 void Context::registerPlugin(Plugin *plugin)
 {
   m_plugins.push_back(make_pair(plugin, false));
+  updateEventPlugins();
 }
 
 void Context::unregisterPlugin(Plugin *plugin)
 {
   m_plugins.remove(make_pair(plugin, false));
+  updateEventPlugins();
+}
+
+void Context::updateEventPlugins()
+{
+  // Build lists of the plugins that handle each event, so that events that
+  // no plugin handles cost as little as possible
+  m_instructionPlugins.assign(llvm::Instruction::OtherOpsEnd,
+                              vector<Plugin*>());
+  for (unsigned event = 0; event < Plugin::NUM_EVENTS; event++)
+  {
+    m_eventPlugins[event].clear();
+    for (unsigned addrSpace = 0; addrSpace <= AddrSpaceLocal; addrSpace++)
+    {
+      m_memoryPlugins[event][addrSpace].clear();
+    }
+  }
+
+  for (auto itr = m_plugins.begin(); itr != m_plugins.end(); itr++)
+  {
+    Plugin *plugin = itr->first;
+    for (unsigned event = 0; event < Plugin::NUM_EVENTS; event++)
+    {
+      if (!plugin->handlesEvent((Plugin::EventType)event))
+        continue;
+
+      m_eventPlugins[event].push_back(plugin);
+      for (unsigned addrSpace = 0; addrSpace <= AddrSpaceLocal; addrSpace++)
+      {
+        if (plugin->handlesAddressSpace(addrSpace))
+          m_memoryPlugins[event][addrSpace].push_back(plugin);
+      }
+    }
+
+    if (plugin->handlesEvent(Plugin::INSTRUCTION_EXECUTED))
+    {
+      for (unsigned opcode = 0; opcode < m_instructionPlugins.size(); opcode++)
+      {
+        if (plugin->handlesOpcode(opcode))
+          m_instructionPlugins[opcode].push_back(plugin);
+      }
+    }
+  }
 }
 
 void Context::logError(const char* error) const
@@ -192,91 +289,231 @@ void Context::logError(const char* error) const
   msg.send();
 }
 
-#define NOTIFY(function, ...)                     \
-{                                                 \
-  PluginList::const_iterator pluginItr;           \
-  for (pluginItr = m_plugins.begin();             \
-       pluginItr != m_plugins.end(); pluginItr++) \
-  {                                               \
-    pluginItr->first->function(__VA_ARGS__);      \
-  }                                               \
+// Notify plugins that handle an event
+#define NOTIFY(event, function, ...)                      \
+{                                                         \
+  const vector<Plugin*>& plugins = m_eventPlugins[event]; \
+  for (auto plugin = plugins.begin();                     \
+       plugin != plugins.end(); plugin++)                 \
+  {                                                       \
+    (*plugin)->function(__VA_ARGS__);                     \
+  }                                                       \
+}
+
+// Notify plugins that handle an event for a memory's address space
+#define NOTIFY_MEMORY(event, function, memory, ...)       \
+{                                                         \
+  const vector<Plugin*>& plugins =                        \
+    m_memoryPlugins[event][memory->getAddressSpace()];    \
+  for (auto plugin = plugins.begin();                     \
+       plugin != plugins.end(); plugin++)                 \
+  {                                                       \
+    (*plugin)->function(memory, __VA_ARGS__);             \
+  }                                                       \
+}
+
+void Context::bufferMemoryAccess(const Memory *memory,
+                                 const WorkGroup *workGroup,
+                                 const WorkItem *workItem,
+                                 size_t address, size_t size,
+                                 bool store, bool atomic, AtomicOp op,
+                                 const uint8_t *storeData) const
+{
+  unsigned addrSpace = memory->getAddressSpace();
+  const vector<Plugin*>& plugins =
+    m_memoryPlugins[Plugin::MEMORY_ACCESSES][addrSpace];
+  if (plugins.empty())
+    return;
+
+  Plugin::MemoryAccess access;
+  access.memory      = memory;
+  access.workGroup   = workGroup;
+  access.workItem    = workItem;
+  access.instruction = workItem ? workItem->getCurrentInstruction() : NULL;
+  access.address     = address;
+  access.size        = size;
+  access.store       = store;
+  access.atomic      = atomic;
+  access.op          = op;
+  access.storeData   = storeData;
+
+  // Deliver accesses with too much data to buffer straight away
+  if (storeData && size > ACCESS_DATA_SIZE)
+  {
+    flushMemoryAccesses();
+    for (auto plugin = plugins.begin(); plugin != plugins.end(); plugin++)
+    {
+      (*plugin)->memoryAccesses(&access, 1);
+    }
+    return;
+  }
+
+  if (!accessBuffers)
+  {
+    accessBuffers = new AccessBuffer[AddrSpaceLocal+1];
+    for (unsigned i = 0; i <= AddrSpaceLocal; i++)
+    {
+      accessBuffers[i].numAccesses = 0;
+      accessBuffers[i].dataSize = 0;
+    }
+  }
+
+  AccessBuffer *buffer = accessBuffers + addrSpace;
+  if (buffer->numAccesses == ACCESS_BUFFER_SIZE ||
+      (storeData && buffer->dataSize + size > ACCESS_DATA_SIZE))
+  {
+    flushMemoryAccesses();
+  }
+
+  // Store data may not outlive the event, so take a copy
+  if (storeData)
+  {
+    access.storeData = buffer->data + buffer->dataSize;
+    memcpy(buffer->data + buffer->dataSize, storeData, size);
+    buffer->dataSize += size;
+  }
+
+  buffer->accesses[buffer->numAccesses++] = access;
+}
+
+void Context::flushMemoryAccesses() const
+{
+  if (!accessBuffers)
+    return;
+
+  for (unsigned addrSpace = 0; addrSpace <= AddrSpaceLocal; addrSpace++)
+  {
+    AccessBuffer *buffer = accessBuffers + addrSpace;
+    if (!buffer->numAccesses)
+      continue;
+
+    const vector<Plugin*>& plugins =
+      m_memoryPlugins[Plugin::MEMORY_ACCESSES][addrSpace];
+    for (auto plugin = plugins.begin(); plugin != plugins.end(); plugin++)
+    {
+      (*plugin)->memoryAccesses(buffer->accesses, buffer->numAccesses);
+    }
+
+    buffer->numAccesses = 0;
+    buffer->dataSize = 0;
+  }
+}
+
+bool Context::hasMemoryPlugins(Plugin::EventType event,
+                               const Memory *memory) const
+{
+  unsigned addrSpace = memory->getAddressSpace();
+  return !m_memoryPlugins[event][addrSpace].empty() ||
+         !m_memoryPlugins[Plugin::MEMORY_ACCESSES][addrSpace].empty();
 }
 
 void Context::notifyInstructionExecuted(const WorkItem *workItem,
                                         const llvm::Instruction *instruction,
                                         const TypedValue& result) const
 {
-  NOTIFY(instructionExecuted, workItem, instruction, result);
+  unsigned opcode = instruction->getOpcode();
+  if (!hasInstructionPlugins(opcode))
+    return;
+
+  const vector<Plugin*>& plugins = m_instructionPlugins[opcode];
+  for (auto plugin = plugins.begin(); plugin != plugins.end(); plugin++)
+  {
+    (*plugin)->instructionExecuted(workItem, instruction, result);
+  }
 }
 
 void Context::notifyKernelBegin(const KernelInvocation *kernelInvocation) const
 {
-  assert(m_kernelInvocation == NULL);
-  m_kernelInvocation = kernelInvocation;
-
-  NOTIFY(kernelBegin, kernelInvocation);
+  NOTIFY(Plugin::KERNEL_BEGIN, kernelBegin, kernelInvocation);
 }
 
 void Context::notifyKernelEnd(const KernelInvocation *kernelInvocation) const
 {
-  NOTIFY(kernelEnd, kernelInvocation);
-
-  assert(m_kernelInvocation == kernelInvocation);
-  m_kernelInvocation = NULL;
+  NOTIFY(Plugin::KERNEL_END, kernelEnd, kernelInvocation);
 }
 
 void Context::notifyMemoryAllocated(const Memory *memory, size_t address,
                                     size_t size, cl_mem_flags flags,
                                     const uint8_t *initData) const
 {
-  NOTIFY(memoryAllocated, memory, address, size, flags, initData);
+  NOTIFY_MEMORY(Plugin::MEMORY_ALLOCATED, memoryAllocated, memory,
+                address, size, flags, initData);
 }
 
 void Context::notifyMemoryAtomicLoad(const Memory *memory, AtomicOp op,
                                      size_t address, size_t size) const
 {
-  if (m_kernelInvocation && m_kernelInvocation->getCurrentWorkItem())
+  if (!hasMemoryPlugins(Plugin::MEMORY_ATOMIC_LOAD, memory))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation && kernelInvocation->getCurrentWorkItem())
   {
-    NOTIFY(memoryAtomicLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
-           op, address, size);
+    const WorkItem *workItem = kernelInvocation->getCurrentWorkItem();
+    bufferMemoryAccess(memory, workItem->getWorkGroup(), workItem,
+                       address, size, false, true, op, NULL);
+    NOTIFY_MEMORY(Plugin::MEMORY_ATOMIC_LOAD, memoryAtomicLoad, memory,
+                  workItem, op, address, size);
   }
 }
 
 void Context::notifyMemoryAtomicStore(const Memory *memory, AtomicOp op,
                                       size_t address, size_t size) const
 {
-  if (m_kernelInvocation && m_kernelInvocation->getCurrentWorkItem())
+  if (!hasMemoryPlugins(Plugin::MEMORY_ATOMIC_STORE, memory))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation && kernelInvocation->getCurrentWorkItem())
   {
-    NOTIFY(memoryAtomicStore, memory, m_kernelInvocation->getCurrentWorkItem(),
-           op, address, size);
+    // The value stored isn't known until the operation has been applied,
+    // so atomic stores don't carry store data
+    const WorkItem *workItem = kernelInvocation->getCurrentWorkItem();
+    bufferMemoryAccess(memory, workItem->getWorkGroup(), workItem,
+                       address, size, true, true, op, NULL);
+    NOTIFY_MEMORY(Plugin::MEMORY_ATOMIC_STORE, memoryAtomicStore, memory,
+                  workItem, op, address, size);
   }
 }
 
 void Context::notifyMemoryDeallocated(const Memory *memory,
                                       size_t address) const
 {
-  NOTIFY(memoryDeallocated, memory, address);
+  NOTIFY_MEMORY(Plugin::MEMORY_DEALLOCATED, memoryDeallocated, memory,
+                address);
 }
 
 void Context::notifyMemoryLoad(const Memory *memory, size_t address,
                                size_t size) const
 {
-  if (m_kernelInvocation)
+  if (!hasMemoryPlugins(Plugin::MEMORY_LOAD, memory) &&
+      !hasMemoryPlugins(Plugin::HOST_MEMORY_LOAD, memory))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation)
   {
-    if (m_kernelInvocation->getCurrentWorkItem())
+    if (kernelInvocation->getCurrentWorkItem())
     {
-      NOTIFY(memoryLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
-             address, size);
+      const WorkItem *workItem = kernelInvocation->getCurrentWorkItem();
+      bufferMemoryAccess(memory, workItem->getWorkGroup(), workItem,
+                         address, size, false, false, AtomicAdd, NULL);
+      NOTIFY_MEMORY(Plugin::MEMORY_LOAD, memoryLoad, memory,
+                    workItem, address, size);
     }
-    else if (m_kernelInvocation->getCurrentWorkGroup())
+    else if (kernelInvocation->getCurrentWorkGroup())
     {
-      NOTIFY(memoryLoad, memory, m_kernelInvocation->getCurrentWorkGroup(),
-             address, size);
+      const WorkGroup *workGroup = kernelInvocation->getCurrentWorkGroup();
+      bufferMemoryAccess(memory, workGroup, NULL,
+                         address, size, false, false, AtomicAdd, NULL);
+      NOTIFY_MEMORY(Plugin::MEMORY_LOAD, memoryLoad, memory,
+                    workGroup, address, size);
     }
   }
   else
   {
-    NOTIFY(hostMemoryLoad, memory, address, size);
+    NOTIFY_MEMORY(Plugin::HOST_MEMORY_LOAD, hostMemoryLoad, memory,
+                  address, size);
   }
 }
 
@@ -284,66 +521,81 @@ void Context::notifyMemoryMap(const Memory *memory, size_t address,
                               size_t offset, size_t size,
                               cl_mem_flags flags) const
 {
-  NOTIFY(memoryMap, memory, address, offset, size, flags);
+  NOTIFY_MEMORY(Plugin::MEMORY_MAP, memoryMap, memory,
+                address, offset, size, flags);
 }
 
 void Context::notifyMemoryStore(const Memory *memory, size_t address,
                                 size_t size, const uint8_t *storeData) const
 {
-  if (m_kernelInvocation)
+  if (!hasMemoryPlugins(Plugin::MEMORY_STORE, memory) &&
+      !hasMemoryPlugins(Plugin::HOST_MEMORY_STORE, memory))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation)
   {
-    if (m_kernelInvocation->getCurrentWorkItem())
+    if (kernelInvocation->getCurrentWorkItem())
     {
-      NOTIFY(memoryStore, memory, m_kernelInvocation->getCurrentWorkItem(),
-             address, size, storeData);
+      const WorkItem *workItem = kernelInvocation->getCurrentWorkItem();
+      bufferMemoryAccess(memory, workItem->getWorkGroup(), workItem,
+                         address, size, true, false, AtomicAdd, storeData);
+      NOTIFY_MEMORY(Plugin::MEMORY_STORE, memoryStore, memory,
+                    workItem, address, size, storeData);
     }
-    else if (m_kernelInvocation->getCurrentWorkGroup())
+    else if (kernelInvocation->getCurrentWorkGroup())
     {
-      NOTIFY(memoryStore, memory, m_kernelInvocation->getCurrentWorkGroup(),
-             address, size, storeData);
+      const WorkGroup *workGroup = kernelInvocation->getCurrentWorkGroup();
+      bufferMemoryAccess(memory, workGroup, NULL,
+                         address, size, true, false, AtomicAdd, storeData);
+      NOTIFY_MEMORY(Plugin::MEMORY_STORE, memoryStore, memory,
+                    workGroup, address, size, storeData);
     }
   }
   else
   {
-    NOTIFY(hostMemoryStore, memory, address, size, storeData);
+    NOTIFY_MEMORY(Plugin::HOST_MEMORY_STORE, hostMemoryStore, memory,
+                  address, size, storeData);
   }
 }
 
 void Context::notifyMessage(MessageType type, const char *message) const
 {
-  NOTIFY(log, type, message);
+  NOTIFY(Plugin::LOG, log, type, message);
 }
 
 void Context::notifyMemoryUnmap(const Memory *memory, size_t address,
                                 const void *ptr) const
 {
-  NOTIFY(memoryUnmap, memory, address, ptr);
+  NOTIFY_MEMORY(Plugin::MEMORY_UNMAP, memoryUnmap, memory, address, ptr);
 }
 
 void Context::notifyWorkGroupBarrier(const WorkGroup *workGroup,
                                      uint32_t flags) const
 {
-  NOTIFY(workGroupBarrier, workGroup, flags);
+  flushMemoryAccesses();
+  NOTIFY(Plugin::WORK_GROUP_BARRIER, workGroupBarrier, workGroup, flags);
 }
 
 void Context::notifyWorkGroupBegin(const WorkGroup *workGroup) const
 {
-  NOTIFY(workGroupBegin, workGroup);
+  NOTIFY(Plugin::WORK_GROUP_BEGIN, workGroupBegin, workGroup);
 }
 
 void Context::notifyWorkGroupComplete(const WorkGroup *workGroup) const
 {
-  NOTIFY(workGroupComplete, workGroup);
+  flushMemoryAccesses();
+  NOTIFY(Plugin::WORK_GROUP_COMPLETE, workGroupComplete, workGroup);
 }
 
 void Context::notifyWorkItemBegin(const WorkItem *workItem) const
 {
-  NOTIFY(workItemBegin, workItem);
+  NOTIFY(Plugin::WORK_ITEM_BEGIN, workItemBegin, workItem);
 }
 
 void Context::notifyWorkItemComplete(const WorkItem *workItem) const
 {
-  NOTIFY(workItemComplete, workItem);
+  NOTIFY(Plugin::WORK_ITEM_COMPLETE, workItemComplete, workItem);
 }
 
 #undef NOTIFY
@@ -353,7 +605,7 @@ Context::Message::Message(MessageType type, const Context *context)
 {
   m_type             = type;
   m_context          = context;
-  m_kernelInvocation = context->m_kernelInvocation;
+  m_kernelInvocation = KernelInvocation::getCurrent();
 }
 
 Context::Message& Context::Message::operator<<(const special& id)
@@ -7,12 +7,14 @@
 // source code.
 
 #include "common.h"
+#include "Plugin.h"
 
 namespace oclgrind
 {
   class KernelInvocation;
   class Memory;
   class Plugin;
+  class ThreadPool;
   class WorkGroup;
   class WorkItem;
 
@@ -25,7 +27,11 @@ namespace oclgrind
     Context();
     virtual ~Context();
 
+    // Deliver memory accesses buffered by the calling thread to plugins
+    void flushMemoryAccesses() const;
     Memory* getGlobalMemory() const;
+    ThreadPool* getThreadPool() const;
+    bool hasInstructionPlugins(unsigned opcode) const;
     bool isThreadSafe() const;
     void logError(const char* error) const;
 
@@ -65,14 +71,30 @@ namespace oclgrind
     void unregisterPlugin(Plugin *plugin);
 
   private:
-    mutable const KernelInvocation *m_kernelInvocation;
     Memory *m_globalMemory;
+    ThreadPool *m_threadPool;
 
     PluginList m_plugins;
     std::list<void*> m_pluginLibraries;
     void loadPlugins();
     void unloadPlugins();
 
+    // Plugins that handle each event, by opcode or address space as well
+    // for instruction and memory events
+    std::vector<Plugin*> m_eventPlugins[Plugin::NUM_EVENTS];
+    std::vector<Plugin*> m_memoryPlugins[Plugin::NUM_EVENTS][AddrSpaceLocal+1];
+    std::vector< std::vector<Plugin*> > m_instructionPlugins;
+    void updateEventPlugins();
+
+    void bufferMemoryAccess(const Memory *memory,
+                            const WorkGroup *workGroup,
+                            const WorkItem *workItem,
+                            size_t address, size_t size,
+                            bool store, bool atomic, AtomicOp op,
+                            const uint8_t *storeData) const;
+    bool hasMemoryPlugins(Plugin::EventType event,
+                          const Memory *memory) const;
+
   public:
     class Message
     {
@@ -111,6 +133,12 @@ namespace oclgrind
     };
   };
 
+  inline bool Context::hasInstructionPlugins(unsigned opcode) const
+  {
+    return opcode < m_instructionPlugins.size() &&
+           !m_instructionPlugins[opcode].empty();
+  }
+
   template<typename T>
   Context::Message& Context::Message::operator<<(const T& t)
   {
@@ -0,0 +1,715 @@
+// JITCompiler.cpp (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+#include <mutex>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "JITCompiler.h"
+#include "WorkItem.h"
+
+using namespace oclgrind;
+using namespace std;
+
+// Name of the native function that loads the kernel arguments and calls
+// the kernel
+#define KERNEL_ENTRY "oclgrind_kernel"
+
+static once_flag initialized;
+
+static bool isSupportedType(const llvm::Type *type)
+{
+  // Types that can be exchanged with the interpreter's value store
+  if (type->isVectorTy())
+    type = type->getVectorElementType();
+
+  return type->isIntegerTy(1)  || type->isIntegerTy(8)  ||
+         type->isIntegerTy(16) || type->isIntegerTy(32) ||
+         type->isIntegerTy(64) || type->isFloatTy()     ||
+         type->isDoubleTy()    || type->isPointerTy();
+}
+
+static bool usesGlobal(const llvm::Constant *constant)
+{
+  if (llvm::isa<llvm::GlobalVariable>(constant))
+    return true;
+
+  for (auto O = constant->op_begin(); O != constant->op_end(); O++)
+  {
+    if (usesGlobal(llvm::cast<llvm::Constant>(O->get())))
+      return true;
+  }
+  return false;
+}
+
+JITCompiler::JITCompiler(const InterpreterCache *cache,
+                         const Callbacks& callbacks)
+  : m_cache(cache), m_callbacks(callbacks)
+{
+  call_once(initialized, [](){
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+  });
+
+  m_engine = NULL;
+  m_kernel = NULL;
+  m_module = NULL;
+}
+
+JITCompiler::~JITCompiler()
+{
+  // The execution engine takes ownership of the module once created
+  delete m_engine;
+  delete m_module;
+}
+
+bool JITCompiler::compile(const vector<llvm::Function*>& functions)
+{
+  // Lower a copy of the module, as the interpreter uses the original
+  const llvm::Module *original = functions.front()->getParent();
+  llvm::ValueToValueMapTy cloned;
+#if LLVM_VERSION > 36
+  m_module = llvm::CloneModule(original, cloned).release();
+#else
+  m_module = llvm::CloneModule(original, cloned);
+#endif
+  llvm::StripDebugInfo(*m_module);
+
+  // Record the interpreter's value ID and offset for each copied value
+  for (auto G = original->global_begin(); G != original->global_end(); G++)
+  {
+    if (m_cache->hasValue(&*G))
+      m_ids[cloned[&*G]] = m_cache->getValueID(&*G);
+  }
+  set<llvm::Function*> compiled;
+  for (auto F = functions.begin(); F != functions.end(); F++)
+  {
+    for (auto A = (*F)->arg_begin(); A != (*F)->arg_end(); A++)
+    {
+      m_ids[cloned[&*A]] = m_cache->getValueID(&*A);
+    }
+    for (auto B = (*F)->begin(); B != (*F)->end(); B++)
+    {
+      for (auto I = B->begin(); I != B->end(); I++)
+      {
+        // Debug intrinsics have been stripped from the copy
+        llvm::Value *clone = cloned.lookup(&*I);
+        if (!clone)
+          continue;
+        m_ids[clone] = m_cache->getValueID(&*I);
+        m_offsets[clone] = m_cache->getInstructionOffset(&*I);
+      }
+    }
+    compiled.insert(llvm::cast<llvm::Function>(cloned[*F]));
+  }
+
+  // Only the kernel and the functions that it calls are compiled
+  for (auto F = m_module->begin(); F != m_module->end(); F++)
+  {
+    if (!F->isDeclaration() && !compiled.count(&*F))
+      F->deleteBody();
+  }
+
+  // Give each function parameters for the work-item and its value table
+  llvm::LLVMContext& context = m_module->getContext();
+  vector<llvm::Type*> entryParams;
+  entryParams.push_back(llvm::Type::getInt8PtrTy(context));
+  entryParams.push_back(entryParams[0]->getPointerTo());
+  map<llvm::Function*, llvm::Function*> native;
+  for (auto F = functions.begin(); F != functions.end(); F++)
+  {
+    llvm::Function *function = llvm::cast<llvm::Function>(cloned[*F]);
+    llvm::FunctionType *type = function->getFunctionType();
+    if (type->isVarArg())
+      return false;
+
+    vector<llvm::Type*> params(entryParams);
+    params.insert(params.end(), type->param_begin(), type->param_end());
+    llvm::Function *nativeFunction = llvm::Function::Create(
+      llvm::FunctionType::get(type->getReturnType(), params, false),
+      llvm::GlobalValue::InternalLinkage, function->getName() + ".native",
+      m_module);
+    nativeFunction->getBasicBlockList().splice(
+      nativeFunction->begin(), function->getBasicBlockList());
+
+    auto A = nativeFunction->arg_begin();
+    A++;
+    A++;
+    for (auto O = function->arg_begin(); O != function->arg_end(); O++, A++)
+    {
+      // Calls copy byval arguments to private memory in the interpreter
+      if (F != functions.begin() && O->hasByValAttr())
+        return false;
+
+      O->replaceAllUsesWith(&*A);
+      m_ids[&*A] = m_ids[&*O];
+      m_ids.erase(&*O);
+      if (F == functions.begin())
+        m_kernelArgs.insert(&*A);
+    }
+    native[function] = nativeFunction;
+  }
+  llvm::Function *kernel =
+    native[llvm::cast<llvm::Function>(cloned[functions.front()])];
+
+  // Call the native version of each function, telling the interpreter
+  // about the call so that it can report the call stack and free allocas
+  for (auto N = native.begin(); N != native.end(); N++)
+  {
+    while (!N->first->use_empty())
+    {
+      llvm::CallInst *call =
+        llvm::dyn_cast<llvm::CallInst>(N->first->user_back());
+      if (!call || call->getCalledValue() != N->first)
+        return false;
+
+      auto A = call->getParent()->getParent()->arg_begin();
+      vector<llvm::Value*> args;
+      args.push_back(&*A++);
+      args.push_back(&*A);
+      for (unsigned i = 0; i < call->getNumArgOperands(); i++)
+      {
+        args.push_back(call->getArgOperand(i));
+      }
+
+      llvm::CallInst *nativeCall =
+        llvm::CallInst::Create(N->second, args, "", call);
+      call->replaceAllUsesWith(nativeCall);
+      m_ids[nativeCall] = m_ids.at(call);
+      m_offsets[nativeCall] = m_offsets.at(call);
+      erase(call);
+
+      createCallback((void*)m_callbacks.call, args[0],
+                     m_offsets.at(nativeCall), nativeCall);
+      createCallback((void*)m_callbacks.ret, args[0],
+                     NO_OFFSET, nativeCall->getNextNode());
+      m_opcodes.insert(llvm::Instruction::Call);
+    }
+    N->first->eraseFromParent();
+  }
+
+  for (auto N = native.begin(); N != native.end(); N++)
+  {
+    if (!lowerFunction(N->second))
+      return false;
+  }
+
+  // Create an entry point that loads the kernel's arguments
+  llvm::Function *entry = llvm::Function::Create(
+    llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+                            entryParams, false),
+    llvm::GlobalValue::ExternalLinkage, KERNEL_ENTRY, m_module);
+  llvm::Instruction *ret = llvm::ReturnInst::Create(
+    context, llvm::BasicBlock::Create(context, "entry", entry));
+  auto A = entry->arg_begin();
+  vector<llvm::Value*> args;
+  args.push_back(&*A++);
+  args.push_back(&*A);
+  A = kernel->arg_begin();
+  A++;
+  A++;
+  for (; A != kernel->arg_end(); A++)
+  {
+    llvm::Value *arg = loadValue(args[1], &*A, A->getType(), ret);
+    if (!arg)
+      return false;
+    args.push_back(arg);
+  }
+  llvm::CallInst::Create(kernel, args, "", ret);
+
+  // Native code reads global variable addresses from the value table, so
+  // the variables themselves are no longer needed
+  for (auto G = m_module->global_begin(); G != m_module->global_end();)
+  {
+    llvm::GlobalVariable *global = &*G++;
+    global->removeDeadConstantUsers();
+    if (global->use_empty())
+      global->eraseFromParent();
+  }
+
+  m_ids.clear();
+  m_offsets.clear();
+  m_kernelArgs.clear();
+
+  m_module->setTargetTriple(llvm::sys::getProcessTriple());
+  if (llvm::verifyModule(*m_module))
+  {
+    cerr << "Oclgrind: Failed to compile kernel to native code" << endl;
+    return false;
+  }
+
+  string error;
+  m_engine = llvm::EngineBuilder(unique_ptr<llvm::Module>(m_module))
+    .setErrorStr(&error)
+    .setEngineKind(llvm::EngineKind::JIT)
+    .create();
+  m_module = NULL;
+
+  if (!m_engine)
+  {
+    cerr << "Oclgrind: Failed to create JIT compiler: " << error << endl;
+    return false;
+  }
+
+  m_engine->finalizeObject();
+  m_kernel = (KernelFunction)m_engine->getFunctionAddress(KERNEL_ENTRY);
+  return m_kernel != NULL;
+}
+
+void JITCompiler::createCallback(void *function, llvm::Value *workItem,
+                                 unsigned offset, llvm::Instruction *before)
+{
+  llvm::IRBuilder<> builder(before);
+
+  vector<llvm::Value*> args;
+  args.push_back(workItem);
+  if (offset != NO_OFFSET)
+    args.push_back(builder.getInt32(offset));
+
+  vector<llvm::Type*> params;
+  for (auto A = args.begin(); A != args.end(); A++)
+  {
+    params.push_back((*A)->getType());
+  }
+
+  // Call the function at its address in this process
+  llvm::Type *type =
+    llvm::FunctionType::get(builder.getVoidTy(), params, false);
+  llvm::Value *callee = builder.CreateIntToPtr(
+    llvm::ConstantInt::get(builder.getIntNTy(sizeof(void*)*8),
+                           (uintptr_t)function),
+    type->getPointerTo());
+  builder.CreateCall(callee, args);
+}
+
+void JITCompiler::erase(llvm::Instruction *instruction)
+{
+  // Addresses of erased instructions may be reused by new ones
+  m_ids.erase(instruction);
+  m_offsets.erase(instruction);
+  instruction->eraseFromParent();
+}
+
+bool JITCompiler::escape(llvm::Instruction *instruction,
+                         llvm::Value *workItem, llvm::Value *values)
+{
+  // Pass operands computed by native code to the interpreter
+  vector<llvm::Value*> operands(instruction->op_begin(),
+                                instruction->op_end());
+
+  // Plugins that check memory accesses (e.g. MemCheck) also read the
+  // indices of the GEP that produced the address
+  llvm::Value *pointer = NULL;
+  if (auto load = llvm::dyn_cast<llvm::LoadInst>(instruction))
+    pointer = load->getPointerOperand();
+  else if (auto store = llvm::dyn_cast<llvm::StoreInst>(instruction))
+    pointer = store->getPointerOperand();
+  if (auto gep = llvm::dyn_cast_or_null<llvm::GetElementPtrInst>(pointer))
+    operands.insert(operands.end(), gep->idx_begin(), gep->idx_end());
+
+  for (auto O = operands.begin(); O != operands.end(); O++)
+  {
+    llvm::Value *operand = *O;
+    if (!llvm::isa<llvm::Instruction>(operand) &&
+        !llvm::isa<llvm::Argument>(operand))
+      continue;
+
+    // The interpreter's copy of each kernel argument never changes
+    if (m_kernelArgs.count(operand))
+      continue;
+
+    if (!storeValue(values, operand, instruction))
+      return false;
+  }
+
+  createCallback((void*)m_callbacks.execute, workItem,
+                 m_offsets.at(instruction), instruction);
+
+  // The interpreter reports unreachable instructions as errors, so the
+  // callback doesn't return
+  if (llvm::isa<llvm::UnreachableInst>(instruction))
+    return true;
+
+  // Read the result back from the interpreter
+  if (!instruction->getType()->isVoidTy())
+  {
+    llvm::Value *result =
+      loadValue(values, instruction, instruction->getType(), instruction);
+    if (!result)
+      return false;
+    instruction->replaceAllUsesWith(result);
+  }
+
+  erase(instruction);
+  return true;
+}
+
+JITCompiler::KernelFunction JITCompiler::getKernel() const
+{
+  return m_kernel;
+}
+
+const set<unsigned>& JITCompiler::getNativeOpcodes() const
+{
+  return m_opcodes;
+}
+
+llvm::Value* JITCompiler::getSlot(llvm::Value *values,
+                                  const llvm::Value *value, llvm::Type *type,
+                                  llvm::Instruction *before)
+{
+  auto id = m_ids.find(value);
+  if (id == m_ids.end())
+    return NULL;
+
+  llvm::IRBuilder<> builder(before);
+  llvm::Value *pointer =
+    builder.CreateLoad(builder.CreateConstGEP1_32(values, id->second));
+  return builder.CreateBitCast(pointer, type->getPointerTo());
+}
+
+bool JITCompiler::isNative(const llvm::Instruction *instruction) const
+{
+  switch (instruction->getOpcode())
+  {
+  case llvm::Instruction::Add:
+  case llvm::Instruction::And:
+  case llvm::Instruction::AShr:
+  case llvm::Instruction::Br:
+  case llvm::Instruction::ExtractElement:
+  case llvm::Instruction::ExtractValue:
+  case llvm::Instruction::FAdd:
+  case llvm::Instruction::FCmp:
+  case llvm::Instruction::FDiv:
+  case llvm::Instruction::FMul:
+  case llvm::Instruction::FPExt:
+  case llvm::Instruction::FPToSI:
+  case llvm::Instruction::FPToUI:
+  case llvm::Instruction::FPTrunc:
+  case llvm::Instruction::FRem:
+  case llvm::Instruction::FSub:
+  case llvm::Instruction::ICmp:
+  case llvm::Instruction::InsertElement:
+  case llvm::Instruction::InsertValue:
+  case llvm::Instruction::IntToPtr:
+  case llvm::Instruction::LShr:
+  case llvm::Instruction::Mul:
+  case llvm::Instruction::Or:
+  case llvm::Instruction::PHI:
+  case llvm::Instruction::PtrToInt:
+  case llvm::Instruction::Ret:
+  case llvm::Instruction::Select:
+  case llvm::Instruction::SExt:
+  case llvm::Instruction::Shl:
+  case llvm::Instruction::ShuffleVector:
+  case llvm::Instruction::SIToFP:
+  case llvm::Instruction::Sub:
+  case llvm::Instruction::Switch:
+  case llvm::Instruction::Trunc:
+  case llvm::Instruction::UIToFP:
+  case llvm::Instruction::Xor:
+  case llvm::Instruction::ZExt:
+    return true;
+  case llvm::Instruction::BitCast:
+  {
+    // The interpreter checks casts between address spaces
+    const llvm::Type *type = instruction->getType();
+    const llvm::Type *srcType = instruction->getOperand(0)->getType();
+    return !type->isPointerTy() ||
+           type->getPointerAddressSpace() ==
+             srcType->getPointerAddressSpace();
+  }
+  case llvm::Instruction::Call:
+  {
+    // Builtin functions are implemented by the interpreter
+    const llvm::Function *callee =
+      ((const llvm::CallInst*)instruction)->getCalledFunction();
+    return callee && !callee->isDeclaration();
+  }
+  case llvm::Instruction::GetElementPtr:
+    return !instruction->getType()->isVectorTy();
+  default:
+    // Memory accesses, allocas and integer division (which traps on zero
+    // in native code) are left to the interpreter
+    return false;
+  }
+}
+
+llvm::Value* JITCompiler::loadValue(llvm::Value *values,
+                                    const llvm::Value *value,
+                                    llvm::Type *type,
+                                    llvm::Instruction *before)
+{
+  if (!isSupportedType(type))
+    return NULL;
+
+  // The interpreter stores a byte for each boolean
+  llvm::IRBuilder<> builder(before);
+  llvm::Type *storedType = type;
+  if (type->getScalarType()->isIntegerTy(1))
+  {
+    storedType = builder.getInt8Ty();
+    if (type->isVectorTy())
+      storedType =
+        llvm::VectorType::get(storedType, type->getVectorNumElements());
+  }
+
+  llvm::Value *slot = getSlot(values, value, storedType, before);
+  if (!slot)
+    return NULL;
+
+  llvm::LoadInst *load = builder.CreateLoad(slot);
+  load->setAlignment(1);
+  return builder.CreateTrunc(load, type);
+}
+
+llvm::Value* JITCompiler::lowerConstant(llvm::Constant *constant,
+                                        llvm::Instruction *before,
+                                        llvm::Value *values)
+{
+  // Global variables only have addresses in the interpreter's memory
+  if (llvm::isa<llvm::GlobalVariable>(constant))
+    return loadValue(values, constant, constant->getType(), before);
+
+  if (!usesGlobal(constant))
+    return constant;
+
+  // Expressions that use global addresses have to be evaluated at runtime
+  llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(constant);
+  if (!expr)
+    return NULL;
+
+  vector<llvm::Value*> operands;
+  for (unsigned i = 0; i < expr->getNumOperands(); i++)
+  {
+    llvm::Value *operand = lowerConstant(expr->getOperand(i), before, values);
+    if (!operand)
+      return NULL;
+    operands.push_back(operand);
+  }
+
+  llvm::Instruction *instruction = expr->getAsInstruction();
+  for (unsigned i = 0; i < operands.size(); i++)
+  {
+    instruction->setOperand(i, operands[i]);
+  }
+  instruction->insertBefore(before);
+  return instruction;
+}
+
+bool JITCompiler::lowerFunction(llvm::Function *function)
+{
+  auto A = function->arg_begin();
+  llvm::Value *workItem = &*A++;
+  llvm::Value *values = &*A;
+
+  // Lower instructions that the interpreter executes to callbacks
+  // Instructions without an offset were created by the compiler
+  vector<llvm::Instruction*> instructions;
+  for (auto B = function->begin(); B != function->end(); B++)
+  {
+    for (auto I = B->begin(); I != B->end(); I++)
+    {
+      if (m_offsets.count(&*I))
+        instructions.push_back(&*I);
+    }
+  }
+  for (auto I = instructions.begin(); I != instructions.end(); I++)
+  {
+    if (!isNative(*I))
+    {
+      if (!escape(*I, workItem, values))
+        return false;
+      continue;
+    }
+
+    // Half precision arithmetic would need runtime library support
+    if ((*I)->getType()->getScalarType()->isHalfTy())
+      return false;
+    for (auto O = (*I)->op_begin(); O != (*I)->op_end(); O++)
+    {
+      if (O->get()->getType()->getScalarType()->isHalfTy())
+        return false;
+    }
+
+    m_opcodes.insert((*I)->getOpcode());
+  }
+
+  instructions.clear();
+  for (auto B = function->begin(); B != function->end(); B++)
+  {
+    for (auto I = B->begin(); I != B->end(); I++)
+    {
+      instructions.push_back(&*I);
+    }
+  }
+  for (auto I = instructions.begin(); I != instructions.end(); I++)
+  {
+    llvm::Instruction *instruction = *I;
+    for (unsigned i = 0; i < instruction->getNumOperands(); i++)
+    {
+      llvm::Constant *constant =
+        llvm::dyn_cast<llvm::Constant>(instruction->getOperand(i));
+      if (!constant || llvm::isa<llvm::Function>(constant))
+        continue;
+
+      // The interpreter treats undefined values as zero
+      if (llvm::isa<llvm::UndefValue>(constant))
+      {
+        instruction->setOperand(
+          i, llvm::Constant::getNullValue(constant->getType()));
+        continue;
+      }
+
+      if (!usesGlobal(constant))
+        continue;
+
+      // Values used by PHI nodes are computed in the incoming block
+      llvm::Instruction *before = instruction;
+      if (llvm::PHINode *phi = llvm::dyn_cast<llvm::PHINode>(instruction))
+        before = phi->getIncomingBlock(i)->getTerminator();
+
+      llvm::Value *value = lowerConstant(constant, before, values);
+      if (!value)
+        return false;
+      instruction->setOperand(i, value);
+    }
+  }
+
+  instructions.clear();
+  for (auto B = function->begin(); B != function->end(); B++)
+  {
+    for (auto I = B->begin(); I != B->end(); I++)
+    {
+      instructions.push_back(&*I);
+    }
+  }
+  for (auto I = instructions.begin(); I != instructions.end(); I++)
+  {
+    switch ((*I)->getOpcode())
+    {
+    case llvm::Instruction::GetElementPtr:
+      lowerGEP(*I);
+      break;
+    case llvm::Instruction::AShr:
+    case llvm::Instruction::LShr:
+    case llvm::Instruction::Shl:
+      lowerShift(*I);
+      break;
+    }
+  }
+
+  return true;
+}
+
+void JITCompiler::lowerGEP(llvm::Instruction *instruction)
+{
+  // Compute addresses with the interpreter's type sizes, which do not
+  // depend on the host's data layout
+  llvm::GetElementPtrInst *gep =
+    llvm::cast<llvm::GetElementPtrInst>(instruction);
+  llvm::IRBuilder<> builder(gep);
+  llvm::Type *intType = builder.getIntNTy(sizeof(size_t)*8);
+  llvm::Value *address =
+    builder.CreatePtrToInt(gep->getPointerOperand(), intType);
+  llvm::Type *type = gep->getPointerOperandType();
+  for (auto I = gep->idx_begin(); I != gep->idx_end(); I++)
+  {
+    if (llvm::StructType *structType = llvm::dyn_cast<llvm::StructType>(type))
+    {
+      unsigned index = llvm::cast<llvm::ConstantInt>(I->get())->getZExtValue();
+      address = builder.CreateAdd(
+        address,
+        llvm::ConstantInt::get(intType,
+                               getStructMemberOffset(structType, index)));
+      type = structType->getElementType(index);
+      continue;
+    }
+
+    type = type->getSequentialElementType();
+    address = builder.CreateAdd(
+      address,
+      builder.CreateMul(builder.CreateSExtOrTrunc(I->get(), intType),
+                        llvm::ConstantInt::get(intType, getTypeSize(type))));
+  }
+
+  gep->replaceAllUsesWith(builder.CreateIntToPtr(address, gep->getType()));
+  erase(gep);
+}
+
+void JITCompiler::lowerShift(llvm::Instruction *shift)
+{
+  // Mask the shift amount in the same way as the interpreter, as native
+  // shifts by the width of the type or more have no defined result
+  // Scalars narrower than 32 bits are shifted as 32-bit values
+  llvm::IRBuilder<> builder(shift);
+  llvm::Type *type = shift->getType();
+  llvm::Value *value = shift->getOperand(0);
+  llvm::Value *amount = shift->getOperand(1);
+  if (!type->isVectorTy() && type->getPrimitiveSizeInBits() < 32)
+  {
+    if (shift->getOpcode() == llvm::Instruction::AShr)
+      value = builder.CreateSExt(value, builder.getInt32Ty());
+    else
+      value = builder.CreateZExt(value, builder.getInt32Ty());
+    amount = builder.CreateZExt(amount, builder.getInt32Ty());
+  }
+
+  unsigned bits = value->getType()->getScalarSizeInBits();
+  amount = builder.CreateAnd(
+    amount, llvm::ConstantInt::get(value->getType(), bits - 1));
+
+  llvm::Value *result = builder.CreateBinOp(
+    (llvm::Instruction::BinaryOps)shift->getOpcode(), value, amount);
+  shift->replaceAllUsesWith(builder.CreateTrunc(result, type));
+  erase(shift);
+}
+
+bool JITCompiler::storeValue(llvm::Value *values, llvm::Value *value,
+                             llvm::Instruction *before)
+{
+  llvm::Type *type = value->getType();
+  if (!isSupportedType(type))
+    return false;
+
+  // The interpreter stores a byte for each boolean, with vector elements
+  // set to all ones for true
+  llvm::IRBuilder<> builder(before);
+  llvm::Value *stored = value;
+  if (type->getScalarType()->isIntegerTy(1))
+  {
+    llvm::Type *byteType = builder.getInt8Ty();
+    if (type->isVectorTy())
+    {
+      byteType = llvm::VectorType::get(byteType, type->getVectorNumElements());
+      stored = builder.CreateSExt(value, byteType);
+    }
+    else
+    {
+      stored = builder.CreateZExt(value, byteType);
+    }
+  }
+
+  llvm::Value *slot = getSlot(values, value, stored->getType(), before);
+  if (!slot)
+    return false;
+
+  builder.CreateStore(stored, slot)->setAlignment(1);
+  return true;
+}
@@ -0,0 +1,87 @@
+// JITCompiler.h (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+
+namespace llvm
+{
+  class ExecutionEngine;
+  class Function;
+  class Module;
+}
+
+namespace oclgrind
+{
+  class InterpreterCache;
+  class WorkItem;
+
+  // Compiles a kernel and the functions that it calls to native code
+  // Instructions that the interpreter needs to see are lowered to calls back
+  // into it: loads, stores, allocas, builtin function calls (including
+  // barriers and atomics) and integer division. The interpreter executes
+  // them with its usual checks and plugin notifications, reading operands
+  // from and writing results to the work-item's value store.
+  class JITCompiler
+  {
+  public:
+    // Native entry point for a kernel, which reads the kernel arguments and
+    // global variable addresses from a table of pointers to the work-item's
+    // storage for each value ID
+    typedef void (*KernelFunction)(WorkItem *workItem, unsigned char **values);
+
+    // Functions called by native code
+    // execute runs the instruction at an offset in the interpreter, and
+    // call and ret track calls to other native functions, so that the
+    // work-item's call stack and private allocations stay up to date
+    struct Callbacks
+    {
+      void (*execute)(WorkItem *workItem, unsigned offset);
+      void (*call)(WorkItem *workItem, unsigned offset);
+      void (*ret)(WorkItem *workItem);
+    };
+
+    JITCompiler(const InterpreterCache *cache, const Callbacks& callbacks);
+    virtual ~JITCompiler();
+
+    bool compile(const std::vector<llvm::Function*>& functions);
+    KernelFunction getKernel() const;
+    const std::set<unsigned>& getNativeOpcodes() const;
+
+  private:
+    const InterpreterCache *m_cache;
+    Callbacks m_callbacks;
+    llvm::ExecutionEngine *m_engine;
+    KernelFunction m_kernel;
+    std::set<unsigned> m_opcodes;
+
+    // Module being lowered, with the interpreter's value ID for each value
+    // and instruction offset for each instruction
+    llvm::Module *m_module;
+    std::unordered_map<const llvm::Value*, unsigned> m_ids;
+    std::unordered_map<const llvm::Value*, unsigned> m_offsets;
+    std::set<const llvm::Value*> m_kernelArgs;
+
+    void createCallback(void *function, llvm::Value *workItem,
+                        unsigned offset, llvm::Instruction *before);
+    void erase(llvm::Instruction *instruction);
+    bool escape(llvm::Instruction *instruction,
+                llvm::Value *workItem, llvm::Value *values);
+    llvm::Value* getSlot(llvm::Value *values, const llvm::Value *value,
+                         llvm::Type *type, llvm::Instruction *before);
+    bool isNative(const llvm::Instruction *instruction) const;
+    llvm::Value* loadValue(llvm::Value *values, const llvm::Value *value,
+                           llvm::Type *type, llvm::Instruction *before);
+    llvm::Value* lowerConstant(llvm::Constant *constant,
+                               llvm::Instruction *before, llvm::Value *values);
+    bool lowerFunction(llvm::Function *function);
+    void lowerGEP(llvm::Instruction *gep);
+    void lowerShift(llvm::Instruction *shift);
+    bool storeValue(llvm::Value *values, llvm::Value *value,
+                    llvm::Instruction *before);
+  };
+}
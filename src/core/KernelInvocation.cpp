@@ -8,14 +8,18 @@
 
 #include "common.h"
 
-#include <atomic>
+#include <algorithm>
+#include <mutex>
 #include <sstream>
 #include <thread>
 
 #include "Context.h"
+#include "JITCompiler.h"
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
+#include "Program.h"
+#include "ThreadPool.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
@@ -24,11 +28,26 @@ using namespace std;
 
 struct
 {
+  const KernelInvocation *kernelInvocation;
   WorkGroup *workGroup;
   WorkItem  *workItem;
+  unsigned worker;
 } static THREAD_LOCAL workerState;
 
-static atomic<unsigned> nextGroupIndex;
+// Plugins that are not thread-safe assume one kernel runs at a time
+static mutex invocationMutex;
+
+// Maximum number of work-items executed together in lockstep
+#define LOCKSTEP_WIDTH 64
+
+// Width and height of a tile of work-groups in tiled order
+#define WORKGROUP_TILE_SIZE 4
+
+struct KernelInvocation::WorkerQueue
+{
+  mutex lock;
+  size_t begin, end;
+};
 
 KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
                                    unsigned int workDim,
@@ -46,6 +65,9 @@ KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
   m_numGroups.y = m_globalSize.y/m_localSize.y;
   m_numGroups.z = m_globalSize.z/m_localSize.z;
 
+  m_cache =
+    m_kernel->getProgram()->getInterpreterCache(m_kernel->getFunction());
+
   // Check for user overriding number of threads
   m_numWorkers = 0;
   const char *numThreads = getenv("OCLGRIND_NUM_THREADS");
@@ -65,33 +87,89 @@ KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
   if (!m_numWorkers || !m_context->isThreadSafe())
     m_numWorkers = 1;
 
+  // Lockstep execution is not compatible with single-stepping work-items
+  m_lockstep = checkEnv("OCLGRIND_LOCKSTEP") &&
+               !checkEnv("OCLGRIND_INTERACTIVE");
+
+  // Run the kernel's native code if it was compiled, unless a plugin needs
+  // to see instructions that native code executes
+  const JITCompiler *jit = m_cache->getJIT();
+  m_native = jit != NULL;
+  if (jit)
+  {
+    const set<unsigned>& opcodes = jit->getNativeOpcodes();
+    for (auto O = opcodes.begin(); O != opcodes.end(); O++)
+    {
+      if (m_context->hasInstructionPlugins(*O))
+        m_native = false;
+    }
+  }
+
+  // Native code runs each work-item to a barrier in turn
+  if (m_native)
+    m_lockstep = false;
+
+  // Check for work-group ordering environment variable
+  m_groupOrder = ROW_MAJOR;
+  const char *order = getenv("OCLGRIND_GROUP_ORDER");
+  if (order)
+  {
+    if (!strcmp(order, "morton"))
+      m_groupOrder = MORTON;
+    else if (!strcmp(order, "tiled"))
+      m_groupOrder = TILED;
+    else if (strcmp(order, "row-major"))
+      cerr << "Oclgrind: Invalid value for OCLGRIND_GROUP_ORDER" << endl;
+  }
+
   // Check for quick-mode environment variable
-  if (checkEnv("OCLGRIND_QUICK"))
+  // Only the first and last work-groups are run in quick-mode
+  m_quick = checkEnv("OCLGRIND_QUICK");
+  if (m_quick)
   {
-    // Only run first and last work-groups in quick-mode
-    Size3 firstGroup(0, 0, 0);
-    Size3 lastGroup(m_numGroups.x-1, m_numGroups.y-1, m_numGroups.z-1);
-    m_workGroups.push_back(firstGroup);
-    if (lastGroup != firstGroup)
-      m_workGroups.push_back(lastGroup);
+    m_numPositions = m_numGroups == Size3(1, 1, 1) ? 1 : 2;
   }
-  else
+  else if (m_groupOrder == MORTON)
   {
-    for (size_t k = 0; k < m_numGroups.z; k++)
+    // Positions interleave the bits of each dimension, so pad the number of
+    // work-groups in each dimension to a power of two
+    m_numPositions = 1;
+    for (unsigned d = 0; d < 3; d++)
     {
-      for (size_t j = 0; j < m_numGroups.y; j++)
-      {
-        for (size_t i = 0; i < m_numGroups.x; i++)
-        {
-          m_workGroups.push_back(Size3(i, j, k));
-        }
-      }
+      size_t padded = 1;
+      while (padded < m_numGroups[d])
+        padded <<= 1;
+      m_numPositions *= padded;
     }
   }
+  else if (m_groupOrder == TILED)
+  {
+    // Pad the number of work-groups to a whole number of tiles
+    m_tileSize = Size3(min((size_t)WORKGROUP_TILE_SIZE, m_numGroups.x),
+                       min((size_t)WORKGROUP_TILE_SIZE, m_numGroups.y), 1);
+    size_t tilesX = (m_numGroups.x + m_tileSize.x - 1)/m_tileSize.x;
+    size_t tilesY = (m_numGroups.y + m_tileSize.y - 1)/m_tileSize.y;
+    m_numPositions =
+      tilesX*m_tileSize.x * tilesY*m_tileSize.y * m_numGroups.z;
+  }
+  else
+  {
+    m_numPositions = m_numGroups.x*m_numGroups.y*m_numGroups.z;
+  }
+
+  // Give each worker an equal share of neighbouring work-groups to start with
+  m_workerQueues = new WorkerQueue[m_numWorkers];
+  for (unsigned i = 0; i < m_numWorkers; i++)
+  {
+    m_workerQueues[i].begin = m_numPositions*i/m_numWorkers;
+    m_workerQueues[i].end   = m_numPositions*(i+1)/m_numWorkers;
+  }
 }
 
 KernelInvocation::~KernelInvocation()
 {
+  delete[] m_workerQueues;
+
   // Destroy any remaining work-groups
   while (!m_runningGroups.empty())
   {
@@ -100,6 +178,11 @@ KernelInvocation::~KernelInvocation()
   }
 }
 
+const KernelInvocation* KernelInvocation::getCurrent()
+{
+  return workerState.kernelInvocation;
+}
+
 const Context* KernelInvocation::getContext() const
 {
   return m_context;
@@ -115,6 +198,64 @@ const WorkItem* KernelInvocation::getCurrentWorkItem() const
   return workerState.workItem;
 }
 
+unsigned KernelInvocation::getCurrentWorker() const
+{
+  return workerState.worker;
+}
+
+bool KernelInvocation::getGroupAtPosition(size_t position, Size3& group) const
+{
+  if (m_quick)
+  {
+    group = position ? Size3(m_numGroups.x-1, m_numGroups.y-1, m_numGroups.z-1)
+                     : Size3(0, 0, 0);
+    return true;
+  }
+
+  switch (m_groupOrder)
+  {
+  case MORTON:
+  {
+    // Deal out the bits of the position to each dimension in turn, skipping
+    // dimensions that have run out of bits
+    group = Size3(0, 0, 0);
+    for (unsigned bit = 0; position; bit++)
+    {
+      for (unsigned d = 0; d < 3; d++)
+      {
+        if (((size_t)1 << bit) < m_numGroups[d])
+        {
+          group[d] |= (position & 1) << bit;
+          position >>= 1;
+        }
+      }
+    }
+    break;
+  }
+  case TILED:
+  {
+    // Tiles are visited in row-major order, as are groups within each tile
+    size_t tileArea = m_tileSize.x*m_tileSize.y;
+    size_t tilesX = (m_numGroups.x + m_tileSize.x - 1)/m_tileSize.x;
+    size_t tilesY = (m_numGroups.y + m_tileSize.y - 1)/m_tileSize.y;
+    size_t tile   = position / tileArea;
+    size_t offset = position % tileArea;
+    group.x = (tile % tilesX)*m_tileSize.x + offset % m_tileSize.x;
+    group.y = (tile / tilesX % tilesY)*m_tileSize.y + offset / m_tileSize.x;
+    group.z = tile / (tilesX*tilesY);
+    break;
+  }
+  default:
+    group = Size3(position, m_numGroups);
+    break;
+  }
+
+  // Positions in the padding do not correspond to a work-group
+  return group.x < m_numGroups.x &&
+         group.y < m_numGroups.y &&
+         group.z < m_numGroups.z;
+}
+
 Size3 KernelInvocation::getGlobalOffset() const
 {
   return m_globalOffset;
@@ -125,6 +266,11 @@ Size3 KernelInvocation::getGlobalSize() const
   return m_globalSize;
 }
 
+const InterpreterCache* KernelInvocation::getInterpreterCache() const
+{
+  return m_cache;
+}
+
 const Kernel* KernelInvocation::getKernel() const
 {
   return m_kernel;
@@ -140,17 +286,91 @@ Size3 KernelInvocation::getNumGroups() const
   return m_numGroups;
 }
 
+unsigned KernelInvocation::getNumWorkers() const
+{
+  return m_numWorkers;
+}
+
 size_t KernelInvocation::getWorkDim() const
 {
   return m_workDim;
 }
 
+bool KernelInvocation::isLockstep() const
+{
+  return m_lockstep;
+}
+
+bool KernelInvocation::isNative() const
+{
+  return m_native;
+}
+
+bool KernelInvocation::nextWorkGroup(unsigned worker, Size3& group)
+{
+  WorkerQueue& queue = m_workerQueues[worker];
+  while (true)
+  {
+    // Take the next position from this worker's own range
+    size_t position;
+    bool found = false;
+    {
+      lock_guard<mutex> lock(queue.lock);
+      if (queue.begin < queue.end)
+      {
+        position = queue.begin++;
+        found = true;
+      }
+    }
+
+    // Otherwise, steal the second half of another worker's range
+    for (unsigned i = 1; !found && i < m_numWorkers; i++)
+    {
+      WorkerQueue& victim = m_workerQueues[(worker + i) % m_numWorkers];
+      size_t begin, end;
+      {
+        lock_guard<mutex> lock(victim.lock);
+        if (victim.begin == victim.end)
+          continue;
+
+        end = victim.end;
+        begin = end - (end - victim.begin + 1)/2;
+        victim.end = begin;
+      }
+
+      lock_guard<mutex> lock(queue.lock);
+      position = begin;
+      queue.begin = begin + 1;
+      queue.end = end;
+      found = true;
+    }
+
+    if (!found)
+      return false;
+
+    if (!getGroupAtPosition(position, group))
+      continue;
+
+    // Skip work-groups that were started early by the interactive debugger
+    if (!m_startedGroups.empty() &&
+        m_startedGroups.count(group.x + (group.y +
+                              group.z*m_numGroups.y)*m_numGroups.x))
+      continue;
+
+    return true;
+  }
+}
+
 void KernelInvocation::run(const Context *context, Kernel *kernel,
                            unsigned int workDim,
                            Size3 globalOffset,
                            Size3 globalSize,
                            Size3 localSize)
 {
+  unique_lock<mutex> lock(invocationMutex, defer_lock);
+  if (!context->isThreadSafe())
+    lock.lock();
+
   try
   {
     // Allocate and initialise constant memory
@@ -175,9 +395,11 @@ void KernelInvocation::run(const Context *context, Kernel *kernel,
                                               localSize);
 
   // Run kernel
+  workerState.kernelInvocation = ki;
   context->notifyKernelBegin(ki);
   ki->run();
   context->notifyKernelEnd(ki);
+  workerState.kernelInvocation = NULL;
 
   delete ki;
 
@@ -187,25 +409,121 @@ void KernelInvocation::run(const Context *context, Kernel *kernel,
 
 void KernelInvocation::run()
 {
-  nextGroupIndex = 0;
+  // Run workers on the context's thread pool
+  // A single worker runs directly on the calling thread
+  m_context->getThreadPool()->run(m_numWorkers, [this](unsigned worker){
+    runWorker(worker);
+  });
+}
 
-  // Create worker threads
-  // TODO: Run in main thread if only 1 worker
-  vector<thread> threads;
-  for (unsigned i = 0; i < m_numWorkers; i++)
-  {
-    threads.push_back(thread(&KernelInvocation::runWorker, this));
-  }
+static bool isStopped(const WorkItem *workItem)
+{
+  return workItem->getState() != WorkItem::READY;
+}
 
-  // Wait for workers to complete
-  for (unsigned i = 0; i < m_numWorkers; i++)
+void KernelInvocation::runLockstep()
+{
+  WorkGroup *workGroup = workerState.workGroup;
+
+  while (true)
   {
-    threads[i].join();
+    vector<WorkItem*> ready = workGroup->getReadyWorkItems();
+    if (ready.empty())
+    {
+      // All work-items have either finished or are waiting at a barrier
+      if (!workGroup->hasBarrier())
+        break;
+
+      workGroup->clearBarrier();
+      continue;
+    }
+
+    // Batch together work-items at the same position as the first one
+    vector<WorkItem*> batch;
+    unsigned offset = ready.front()->getCurrentOffset();
+    for (auto itr = ready.begin();
+         itr != ready.end() && batch.size() < LOCKSTEP_WIDTH; itr++)
+    {
+      if ((*itr)->getCurrentOffset() == offset)
+        batch.push_back(*itr);
+    }
+
+    // Execute each instruction for the whole batch, until every work-item
+    // in the batch has finished or reached a barrier
+    while (!batch.empty())
+    {
+      const InterpreterCache::Instruction& instruction =
+        m_cache->getInstruction(batch.front()->getCurrentOffset());
+
+      // Type-specialized arithmetic is applied across the lanes of the
+      // whole batch at once, and cannot cause it to diverge
+      if (instruction.handler == InterpreterCache::HandlerTyped &&
+          instruction.batch)
+      {
+        workerState.workItem = batch.front();
+        WorkItem::executeBatch(instruction, batch.data(), batch.size());
+        continue;
+      }
+
+      for (auto itr = batch.begin(); itr != batch.end(); itr++)
+      {
+        workerState.workItem = *itr;
+        (*itr)->step();
+      }
+
+      // Remove work-items that are no longer active from the batch
+      batch.erase(remove_if(batch.begin(), batch.end(), isStopped),
+                  batch.end());
+      if (batch.empty())
+        break;
+
+      // Any transfer of control can cause the batch to diverge, including
+      // returns from functions that were called from different call sites
+      bool diverged = false;
+      unsigned next = batch.front()->getCurrentOffset();
+      for (auto itr = batch.begin(); itr != batch.end(); itr++)
+      {
+        if ((*itr)->getCurrentOffset() != next)
+        {
+          diverged = true;
+          break;
+        }
+      }
+      if (!diverged)
+        continue;
+
+      // Without a post-dominator to reconverge at (e.g. after a return),
+      // the remaining work-items are regrouped into new batches
+      unsigned stop = instruction.reconverge;
+      if (stop == NO_OFFSET)
+        break;
+
+      // Run each work-item on its own until it reaches the post-dominator of
+      // the branch, where the batch reconverges
+      for (auto itr = batch.begin(); itr != batch.end(); itr++)
+      {
+        workerState.workItem = *itr;
+        while ((*itr)->getState() == WorkItem::READY &&
+               (*itr)->getCurrentOffset() != stop)
+        {
+          (*itr)->run(stop);
+        }
+      }
+      batch.erase(remove_if(batch.begin(), batch.end(), isStopped),
+                  batch.end());
+    }
   }
+
+  workerState.workItem = NULL;
 }
 
-void KernelInvocation::runWorker()
+void KernelInvocation::runWorker(unsigned worker)
 {
+  // Pool threads may run workers for several invocations in turn
+  const KernelInvocation *previous = workerState.kernelInvocation;
+  unsigned previousWorker = workerState.worker;
+  workerState.kernelInvocation = this;
+  workerState.worker = worker;
   workerState.workGroup = NULL;
   workerState.workItem = NULL;
   try
@@ -222,37 +540,44 @@ void KernelInvocation::runWorker()
       else
       {
         // Take next work-group from pending pool
-        unsigned index = nextGroupIndex++;
-        if (index >= m_workGroups.size())
+        Size3 group;
+        if (!nextWorkGroup(worker, group))
           // No more work to do
           break;
 
-        workerState.workGroup = new WorkGroup(this, m_workGroups[index]);
+        workerState.workGroup = new WorkGroup(this, m_cache, group);
         m_context->notifyWorkGroupBegin(workerState.workGroup);
       }
 
       // Execute work-group
-      workerState.workItem = workerState.workGroup->getNextWorkItem();
-      while (workerState.workItem)
+      if (m_lockstep)
+      {
+        runLockstep();
+      }
+      else
       {
-        // Run work-item until complete or at barrier
-        while (workerState.workItem->getState() == WorkItem::READY)
-        {
-          workerState.workItem->step();
-        }
-
-        // Move to next work-item
         workerState.workItem = workerState.workGroup->getNextWorkItem();
-        if (workerState.workItem)
-          continue;
-
-        // No more work-items in READY state
-        // Check if there are work-items at a barrier
-        if (workerState.workGroup->hasBarrier())
+        while (workerState.workItem)
         {
-          // Resume execution
-          workerState.workGroup->clearBarrier();
+          // Run work-item until complete or at barrier
+          while (workerState.workItem->getState() == WorkItem::READY)
+          {
+            workerState.workItem->run();
+          }
+
+          // Move to next work-item
           workerState.workItem = workerState.workGroup->getNextWorkItem();
+          if (workerState.workItem)
+            continue;
+
+          // No more work-items in READY state
+          // Check if there are work-items at a barrier
+          if (workerState.workGroup->hasBarrier())
+          {
+            // Resume execution
+            workerState.workGroup->clearBarrier();
+            workerState.workItem = workerState.workGroup->getNextWorkItem();
+          }
         }
       }
 
@@ -270,9 +595,15 @@ void KernelInvocation::runWorker()
          << endl << err.what();
     m_context->logError(info.str().c_str());
 
+    // Don't leave buffered accesses that refer to the work-group behind
+    m_context->flushMemoryAccesses();
     if (workerState.workGroup)
       delete workerState.workGroup;
+    workerState.workGroup = NULL;
   }
+
+  workerState.kernelInvocation = previous;
+  workerState.worker = previousWorker;
 }
 
 bool KernelInvocation::switchWorkItem(const Size3 gid)
@@ -310,24 +641,24 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
   // Check if work-group is in pending pool
   if (!found)
   {
-    std::vector<Size3>::iterator pItr;
-    for (pItr = m_workGroups.begin()+nextGroupIndex;
-         pItr != m_workGroups.end(); pItr++)
+    size_t index = group.x + (group.y + group.z*m_numGroups.y)*m_numGroups.x;
+    const WorkerQueue& queue = m_workerQueues[0];
+    for (size_t position = queue.begin; position < queue.end; position++)
     {
-     if (group == *pItr)
-     {
-       workerState.workGroup = new WorkGroup(this, group);
-       m_context->notifyWorkGroupBegin(workerState.workGroup);
-       found = true;
-
-       // Re-order list of groups accordingly
-       // Safe since this is not in a multi-threaded context
-       m_workGroups.erase(pItr);
-       m_workGroups.insert(m_workGroups.begin()+nextGroupIndex, group);
-       nextGroupIndex++;
-
-       break;
-     }
+      Size3 pending;
+      if (!getGroupAtPosition(position, pending) || pending != group ||
+          m_startedGroups.count(index))
+        continue;
+
+      workerState.workGroup = new WorkGroup(this, m_cache, group);
+      m_context->notifyWorkGroupBegin(workerState.workGroup);
+      found = true;
+
+      // Make sure the worker doesn't start the group again later
+      // Safe since this is not in a multi-threaded context
+      m_startedGroups.insert(index);
+
+      break;
     }
   }
 
@@ -341,6 +672,10 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
     m_runningGroups.push_back(previousWorkGroup);
   }
 
+  // Stop the current work-item so that the worker picks up the new one
+  if (workerState.workItem)
+    workerState.workItem->yield();
+
   // Get work-item
   Size3 lid(gid.x%m_localSize.x, gid.y%m_localSize.y, gid.z%m_localSize.z);
   workerState.workItem = workerState.workGroup->getWorkItem(lid);
@@ -6,11 +6,14 @@
 // license terms please see the LICENSE file distributed with this
 // source code.
 
+#pragma once
+
 #include "common.h"
 
 namespace oclgrind
 {
   class Context;
+  class InterpreterCache;
   class Kernel;
   class WorkGroup;
   class WorkItem;
@@ -24,15 +27,23 @@ namespace oclgrind
                     Size3 globalSize,
                     Size3 localSize);
 
+    // Returns the kernel invocation being executed by the calling thread
+    static const KernelInvocation* getCurrent();
+
     const Context* getContext() const;
     const WorkGroup* getCurrentWorkGroup() const;
     const WorkItem* getCurrentWorkItem() const;
+    unsigned getCurrentWorker() const;
     Size3 getGlobalOffset() const;
     Size3 getGlobalSize() const;
     Size3 getLocalSize() const;
+    const InterpreterCache* getInterpreterCache() const;
     const Kernel* getKernel() const;
     Size3 getNumGroups() const;
+    unsigned getNumWorkers() const;
     size_t getWorkDim() const;
+    bool isLockstep() const;
+    bool isNative() const;
     bool switchWorkItem(const Size3 gid);
 
   private:
@@ -47,6 +58,7 @@ namespace oclgrind
     // Kernel launch parameters
     const Context *m_context;
     const Kernel  *m_kernel;
+    const InterpreterCache *m_cache;
     size_t m_workDim;
     Size3  m_globalOffset;
     Size3  m_globalSize;
@@ -54,11 +66,28 @@ namespace oclgrind
     Size3  m_numGroups;
 
     // Current execution state
-    std::vector<Size3>    m_workGroups;
     std::list<WorkGroup*> m_runningGroups;
 
+    // Work-group scheduling
+    // Work-groups are numbered by their position in the traversal order,
+    // and each worker owns a range of positions that idle workers can steal
+    // from. Positions are only mapped to work-group IDs when they are run.
+    enum GroupOrder {ROW_MAJOR, MORTON, TILED};
+    struct WorkerQueue;
+    GroupOrder m_groupOrder;
+    size_t m_numPositions;
+    Size3 m_tileSize;
+    WorkerQueue *m_workerQueues;
+    std::set<size_t> m_startedGroups;
+    bool getGroupAtPosition(size_t position, Size3& group) const;
+    bool nextWorkGroup(unsigned worker, Size3& group);
+
     // Worker threads
-    void runWorker();
+    void runLockstep();
+    void runWorker(unsigned worker);
     unsigned m_numWorkers;
+    bool m_lockstep;
+    bool m_native;
+    bool m_quick;
   };
 }
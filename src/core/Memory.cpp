@@ -12,6 +12,13 @@
 #include <cstring>
 #include <mutex>
 
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "Context.h"
 #include "Memory.h"
 #include "WorkGroup.h"
@@ -21,21 +28,189 @@ using namespace oclgrind;
 using namespace std;
 
 // Multiple mutexes to mitigate risk of unnecessary synchronisation in atomics
+// that can't use native atomic instructions
 #define NUM_ATOMIC_MUTEXES 64 // Must be power of two
 mutex atomicMutex[NUM_ATOMIC_MUTEXES];
 #define ATOMIC_MUTEX(offset) \
   atomicMutex[(((offset)>>2) & (NUM_ATOMIC_MUTEXES-1))]
 
+template<typename T>
+static T applyAtomic(AtomicOp op, T old, T value)
+{
+  switch (op)
+  {
+  case AtomicAdd:
+    return old + value;
+  case AtomicAnd:
+    return old & value;
+  case AtomicCmpXchg:
+    FATAL_ERROR("AtomicCmpXchg in generic atomic handler");
+  case AtomicDec:
+    return old - 1;
+  case AtomicInc:
+    return old + 1;
+  case AtomicMax:
+    return old > value ? old : value;
+  case AtomicMin:
+    return old < value ? old : value;
+  case AtomicOr:
+    return old | value;
+  case AtomicSub:
+    return old - value;
+  case AtomicXchg:
+    return value;
+  case AtomicXor:
+    return old ^ value;
+  }
+  return old;
+}
+
+#if defined(__GNUC__)
+#define HAVE_ATOMIC_BUILTINS 1
+
+// Aligned global memory atomics use the host's atomic instructions, as long
+// as they don't need a library call
+template<typename T>
+static bool isNativeAtomic(T *ptr)
+{
+  return !((uintptr_t)ptr & (sizeof(T)-1)) &&
+         __atomic_always_lock_free(sizeof(T), 0);
+}
+
+template<typename T>
+static T nativeAtomic(AtomicOp op, T *ptr, T value)
+{
+  switch (op)
+  {
+  case AtomicAdd:
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicAnd:
+    return __atomic_fetch_and(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicDec:
+    return __atomic_fetch_sub(ptr, 1, __ATOMIC_SEQ_CST);
+  case AtomicInc:
+    return __atomic_fetch_add(ptr, 1, __ATOMIC_SEQ_CST);
+  case AtomicOr:
+    return __atomic_fetch_or(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicSub:
+    return __atomic_fetch_sub(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicXchg:
+    return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicXor:
+    return __atomic_fetch_xor(ptr, value, __ATOMIC_SEQ_CST);
+  default:
+    break;
+  }
+
+  // No native min/max, so retry until no other update intervenes
+  T old = __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+  while (true)
+  {
+    T result = applyAtomic(op, old, value);
+    if (result == old ||
+        __atomic_compare_exchange_n(ptr, &old, result, true,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      return old;
+  }
+}
+#else
+#define HAVE_ATOMIC_BUILTINS 0
+#endif
+
+// Global memory buffers can be created by the host while commands execute
+mutex allocationMutex;
+
+// Large global memory buffers are mapped directly from the OS, so that their
+// pages are only allocated and zeroed when they are first touched
+#define MAP_THRESHOLD    (64*1024)
+#define HUGE_PAGE_SIZE   (2*1024*1024)
+#define BUFFER_ALIGNMENT 64
+
+#if !defined(_WIN32) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Protects the swap directory, which is cleared if buffers can't be created
+// there
+static mutex swapMutex;
+
+// Each worker caches recent buffer translations, so that repeated accesses
+// to the same buffer avoid looking it up and checking that it exists
+#define TLB_SIZE 64 // Must be power of two
+struct TLBEntry
+{
+  size_t memory;
+  size_t index;
+  unsigned generation;
+  const Memory::Buffer *buffer;
+};
+static THREAD_LOCAL TLBEntry tlb[TLB_SIZE];
+static std::atomic<size_t> nextMemoryID(1);
+
+// Number of bits per byte for each registered shadow, or zero if unused
+static unsigned shadowBits[Memory::MAX_SHADOWS];
+static mutex shadowMutex;
+
+// Record size for each record shadow, which is kept after the shadow is
+// unregistered, as buffers may still have records of that size
+static size_t recordSizes[Memory::MAX_SHADOWS];
+static bool recordRegistered[Memory::MAX_SHADOWS];
+
+#define SHADOW_PAGE_SIZE ((size_t)1 << PAGE_BITS)
+#define ALL_BITS         (~(uint64_t)0)
+
+// Get a mask covering a range of elements in a word of shadow bits
+static uint64_t getShadowMask(size_t first, size_t num, unsigned bitsPerByte)
+{
+  size_t width = num * bitsPerByte;
+  uint64_t mask = (width == 64) ? ALL_BITS : (((uint64_t)1 << width) - 1);
+  return mask << (first * bitsPerByte);
+}
+
+static void initShadows(Memory::Buffer *buffer)
+{
+  for (unsigned i = 0; i < Memory::MAX_SHADOWS; i++)
+  {
+    buffer->shadows[i].store(NULL, memory_order_relaxed);
+    buffer->recordShadows[i].store(NULL, memory_order_relaxed);
+  }
+}
+
+static void releaseShadows(Memory::Buffer *buffer)
+{
+  for (unsigned i = 0; i < Memory::MAX_SHADOWS; i++)
+  {
+    delete buffer->shadows[i].load(memory_order_relaxed);
+    delete buffer->recordShadows[i].load(memory_order_relaxed);
+  }
+}
+
 Memory::Memory(unsigned addrSpace, unsigned bufferBits, const Context *context)
 {
   m_context = context;
   m_addressSpace = addrSpace;
+  m_id = nextMemoryID++;
+  m_generation = 0;
 
   m_numBitsBuffer = bufferBits;
   m_numBitsAddress = ((sizeof(size_t)<<3) - m_numBitsBuffer);
   m_maxNumBuffers = ((size_t)1 << m_numBitsBuffer) - 1; // 0 reserved for NULL
   m_maxBufferSize = ((size_t)1 << m_numBitsAddress);
 
+  // Reserve every buffer slot up front for global memory, so that creating
+  // a buffer never moves the slots that other threads are reading
+  if (m_addressSpace == AddrSpaceGlobal)
+    m_memory.reserve(m_maxNumBuffers+1);
+
+  m_hugePages = false;
+  if (m_addressSpace == AddrSpaceGlobal)
+  {
+    m_hugePages = checkEnv("OCLGRIND_HUGE_PAGES");
+    const char *swapDir = getenv("OCLGRIND_SWAP_DIR");
+    if (swapDir)
+      m_swapDir = swapDir;
+  }
+
   clear();
 }
 
@@ -53,10 +228,23 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
     return 0;
   }
 
+  // Mapping and initializing large buffers can be slow, so do it before
+  // taking the allocation lock
+  unsigned char *data = allocateData(size, initData);
+  if (!data)
+  {
+    return 0;
+  }
+
+  unique_lock<mutex> lock(allocationMutex, defer_lock);
+  if (m_addressSpace == AddrSpaceGlobal)
+    lock.lock();
+
   // Find first unallocated buffer slot
   unsigned b = getNextBuffer();
   if (b >= m_maxNumBuffers)
   {
+    releaseData(data, size);
     return 0;
   }
 
@@ -64,7 +252,8 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
   Buffer *buffer = new Buffer;
   buffer->size   = size;
   buffer->flags  = flags;
-  buffer->data   = new unsigned char[size];
+  buffer->data   = data;
+  initShadows(buffer);
 
   if (b >= m_memory.size())
   {
@@ -77,12 +266,6 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
 
   m_totalAllocated += size;
 
-  // Initialize contents of buffer
-  if (initData)
-    memcpy(buffer->data, initData, size);
-  else
-    memset(buffer->data, 0, size);
-
   size_t address = ((size_t)b) << m_numBitsAddress;
 
   m_context->notifyMemoryAllocated(this, address, size, flags, initData);
@@ -90,101 +273,137 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
   return address;
 }
 
-uint32_t Memory::atomic(AtomicOp op, size_t address, uint32_t value)
+unsigned char* Memory::allocateData(size_t size, const uint8_t *initData)
 {
-  m_context->notifyMemoryAtomicLoad(this, op, address, 4);
-  m_context->notifyMemoryAtomicStore(this, op, address, 4);
-
-  // Bounds check
-  if (!isAddressValid(address, 4))
+  unsigned char *data;
+  if (m_addressSpace != AddrSpaceGlobal)
   {
-    return 0;
+    data = new unsigned char[size];
+  }
+#if !defined(_WIN32)
+  else if (size >= MAP_THRESHOLD)
+  {
+    data = mapData(size);
+    if (!data)
+      return NULL;
+
+    // Mapped pages are already zero
+    if (initData)
+      memcpy(data, initData, size);
+    return data;
+  }
+#endif
+  else
+  {
+    // Align global memory buffers for vector loads and stores
+#if defined(_WIN32)
+    data = (unsigned char*)_aligned_malloc(size ? size : 1, BUFFER_ALIGNMENT);
+#else
+    void *ptr;
+    if (posix_memalign(&ptr, BUFFER_ALIGNMENT, size ? size : 1))
+      ptr = NULL;
+    data = (unsigned char*)ptr;
+#endif
+    if (!data)
+      return NULL;
   }
 
-  // Get buffer
-  size_t offset = extractOffset(address);
-  Buffer *buffer = m_memory[extractBuffer(address)];
-  uint32_t *ptr = (uint32_t*)(buffer->data + offset);
+  if (initData)
+    memcpy(data, initData, size);
+  else
+    memset(data, 0, size);
+  return data;
+}
 
-  if (m_addressSpace == AddrSpaceGlobal)
-    ATOMIC_MUTEX(offset).lock();
+template<typename T>
+T Memory::atomic(AtomicOp op, size_t address, T value)
+{
+  m_context->notifyMemoryAtomicLoad(this, op, address, sizeof(T));
+  m_context->notifyMemoryAtomicStore(this, op, address, sizeof(T));
 
-  uint32_t old = *ptr;
-  switch(op)
+  // Bounds check
+  const Buffer *buffer = lookup(address);
+  size_t offset = extractOffset(address);
+  if (!buffer || offset+sizeof(T) > buffer->size)
   {
-  case AtomicAdd:
-    *ptr = old + value;
-    break;
-  case AtomicAnd:
-    *ptr = old & value;
-    break;
-  case AtomicCmpXchg:
-    FATAL_ERROR("AtomicCmpXchg in generic atomic handler");
-    break;
-  case AtomicDec:
-    *ptr = old - 1;
-    break;
-  case AtomicInc:
-    *ptr = old + 1;
-    break;
-  case AtomicMax:
-    *ptr = old > value ? old : value;
-    break;
-  case AtomicMin:
-    *ptr = old < value ? old : value;
-    break;
-  case AtomicOr:
-    *ptr = old | value;
-    break;
-  case AtomicSub:
-    *ptr = old - value;
-    break;
-  case AtomicXchg:
-    *ptr = value;
-    break;
-  case AtomicXor:
-    *ptr = old ^ value;
-    break;
+    return 0;
   }
 
+  T *ptr = (T*)(buffer->data + offset);
+
+#if HAVE_ATOMIC_BUILTINS
+  if (m_addressSpace == AddrSpaceGlobal && isNativeAtomic(ptr))
+    return nativeAtomic(op, ptr, value);
+#endif
+
+  unique_lock<mutex> lock(ATOMIC_MUTEX(offset), defer_lock);
   if (m_addressSpace == AddrSpaceGlobal)
-    ATOMIC_MUTEX(offset).unlock();
+    lock.lock();
+
+  // Pointer may be misaligned, so access it with memcpy
+  T old, result;
+  memcpy(&old, ptr, sizeof(T));
+  result = applyAtomic(op, old, value);
+  memcpy(ptr, &result, sizeof(T));
 
   return old;
 }
+template int32_t Memory::atomic(AtomicOp, size_t, int32_t);
+template uint32_t Memory::atomic(AtomicOp, size_t, uint32_t);
+template int64_t Memory::atomic(AtomicOp, size_t, int64_t);
+template uint64_t Memory::atomic(AtomicOp, size_t, uint64_t);
 
-uint32_t Memory::atomicCmpxchg(size_t address, uint32_t cmp, uint32_t value)
+template<typename T>
+T Memory::atomicCmpxchg(size_t address, T cmp, T value)
 {
-  m_context->notifyMemoryAtomicLoad(this, AtomicCmpXchg, address, 4);
+  m_context->notifyMemoryAtomicLoad(this, AtomicCmpXchg, address, sizeof(T));
 
   // Bounds check
-  if (!isAddressValid(address, 4))
+  const Buffer *buffer = lookup(address);
+  size_t offset = extractOffset(address);
+  if (!buffer || offset+sizeof(T) > buffer->size)
   {
     return 0;
   }
 
-  // Get buffer
-  size_t offset = extractOffset(address);
-  Buffer *buffer = m_memory[extractBuffer(address)];
-  uint32_t *ptr = (uint32_t*)(buffer->data + offset);
-
-  if (m_addressSpace == AddrSpaceGlobal)
-    ATOMIC_MUTEX(offset).lock();
+  T *ptr = (T*)(buffer->data + offset);
 
   // Perform cmpxchg
-  uint32_t old = *ptr;
-  if (old == cmp)
+  T old;
+  bool exchanged;
+#if HAVE_ATOMIC_BUILTINS
+  if (m_addressSpace == AddrSpaceGlobal && isNativeAtomic(ptr))
   {
-    *ptr = value;
-
-    m_context->notifyMemoryAtomicStore(this, AtomicCmpXchg, address, 4);
+    old = cmp;
+    exchanged = __atomic_compare_exchange_n(ptr, &old, value, false,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST);
+  }
+  else
+#endif
+  {
+    unique_lock<mutex> lock(ATOMIC_MUTEX(offset), defer_lock);
+    if (m_addressSpace == AddrSpaceGlobal)
+      lock.lock();
+
+    memcpy(&old, ptr, sizeof(T));
+    exchanged = (old == cmp);
+    if (exchanged)
+      memcpy(ptr, &value, sizeof(T));
   }
 
-  if (m_addressSpace == AddrSpaceGlobal)
-    ATOMIC_MUTEX(offset).unlock();
+  if (exchanged)
+  {
+    m_context->notifyMemoryAtomicStore(this, AtomicCmpXchg,
+                                       address, sizeof(T));
+  }
 
   return old;
 }
+template int32_t Memory::atomicCmpxchg(size_t, int32_t, int32_t);
+template uint32_t Memory::atomicCmpxchg(size_t, uint32_t, uint32_t);
+template int64_t Memory::atomicCmpxchg(size_t, int64_t, int64_t);
+template uint64_t Memory::atomicCmpxchg(size_t, uint64_t, uint64_t);
 
 void Memory::clear()
 {
@@ -195,8 +414,9 @@ void Memory::clear()
     {
       if (!((*itr)->flags & CL_MEM_USE_HOST_PTR))
       {
-        delete[] (*itr)->data;
+        releaseData((*itr)->data, (*itr)->size);
       }
+      releaseShadows(*itr);
       delete *itr;
 
       size_t address = (itr-m_memory.begin())<<m_numBitsAddress;
@@ -205,6 +425,7 @@ void Memory::clear()
   }
   m_memory.resize(1);
   m_memory[0] = NULL;
+  m_generation++;
   m_freeBuffers = queue<unsigned>();
   m_totalAllocated = 0;
 }
@@ -217,6 +438,10 @@ size_t Memory::createHostBuffer(size_t size, void *ptr, cl_mem_flags flags)
     return 0;
   }
 
+  unique_lock<mutex> lock(allocationMutex, defer_lock);
+  if (m_addressSpace == AddrSpaceGlobal)
+    lock.lock();
+
   // Find first unallocated buffer slot
   unsigned b = getNextBuffer();
   if (b >= m_maxNumBuffers)
@@ -229,6 +454,7 @@ size_t Memory::createHostBuffer(size_t size, void *ptr, cl_mem_flags flags)
   buffer->size   = size;
   buffer->flags  = flags;
   buffer->data   = (unsigned char*)ptr;
+  initShadows(buffer);
 
   if (b >= m_memory.size())
   {
@@ -282,19 +508,25 @@ bool Memory::copy(size_t dst, size_t src, size_t size)
 
 void Memory::deallocateBuffer(size_t address)
 {
+  unique_lock<mutex> lock(allocationMutex, defer_lock);
+  if (m_addressSpace == AddrSpaceGlobal)
+    lock.lock();
+
   unsigned buffer = extractBuffer(address);
   assert(buffer < m_memory.size() && m_memory[buffer]);
 
   if (!(m_memory[buffer]->flags & CL_MEM_USE_HOST_PTR))
   {
-    delete[] m_memory[buffer]->data;
+    releaseData(m_memory[buffer]->data, m_memory[buffer]->size);
   }
 
   m_totalAllocated -= m_memory[buffer]->size;
   m_freeBuffers.push(buffer);
 
+  releaseShadows(m_memory[buffer]);
   delete m_memory[buffer];
   m_memory[buffer] = NULL;
+  m_generation++;
 
   m_context->notifyMemoryDeallocated(this, address);
 }
@@ -370,15 +602,75 @@ unsigned Memory::getNextBuffer()
 
 void* Memory::getPointer(size_t address) const
 {
-  size_t buffer = extractBuffer(address);
-
   // Bounds check
-  if (!isAddressValid(address))
+  const Buffer *buffer = lookup(address);
+  size_t offset = extractOffset(address);
+  if (!buffer || offset >= buffer->size)
   {
     return NULL;
   }
 
-  return m_memory[buffer]->data + extractOffset(address);
+  return buffer->data + offset;
+}
+
+Memory::RecordShadow* Memory::getRecordShadow(unsigned shadow,
+                                              size_t address) const
+{
+  assert(shadow < MAX_SHADOWS);
+
+  Buffer *buffer = (Buffer*)lookup(address);
+  if (!buffer)
+    return NULL;
+
+  RecordShadow *result =
+    buffer->recordShadows[shadow].load(memory_order_acquire);
+  if (!result)
+  {
+    size_t recordSize;
+    {
+      lock_guard<mutex> lock(shadowMutex);
+      assert(recordRegistered[shadow] && "Shadow not registered");
+      recordSize = recordSizes[shadow];
+    }
+
+    // Several workers may try to create a global memory shadow at once
+    RecordShadow *created = new RecordShadow(buffer->size, recordSize);
+    if (buffer->recordShadows[shadow].compare_exchange_strong(result,
+                                                              created))
+      result = created;
+    else
+      delete created;
+  }
+  return result;
+}
+
+Memory::Shadow* Memory::getShadow(unsigned shadow, size_t address) const
+{
+  assert(shadow < MAX_SHADOWS);
+
+  Buffer *buffer = (Buffer*)lookup(address);
+  if (!buffer)
+    return NULL;
+
+  Shadow *result = buffer->shadows[shadow].load(memory_order_acquire);
+  if (!result)
+  {
+    unsigned bitsPerByte;
+    {
+      lock_guard<mutex> lock(shadowMutex);
+      bitsPerByte = shadowBits[shadow];
+    }
+    assert(bitsPerByte && "Shadow not registered");
+
+    // Several workers may try to create a global memory shadow at once
+    Shadow *created = new Shadow(buffer->size, bitsPerByte,
+                                 m_addressSpace == AddrSpaceGlobal);
+    if (buffer->shadows[shadow].compare_exchange_strong(result, created))
+      result = created;
+    else
+      delete created;
+  }
+  return result;
 }
 
 size_t Memory::getTotalAllocated() const
@@ -405,21 +697,39 @@ bool Memory::load(unsigned char *dest, size_t address, size_t size) const
   m_context->notifyMemoryLoad(this, address, size);
 
   // Bounds check
-  if (!isAddressValid(address, size))
+  const Buffer *src = lookup(address);
+  size_t offset = extractOffset(address);
+  if (!src || offset+size > src->size)
   {
     return false;
   }
 
-  // Get buffer
-  size_t offset = extractOffset(address);
-  Buffer *src = m_memory[extractBuffer(address)];
-
   // Load data
   memcpy(dest, src->data + offset, size);
 
   return true;
 }
 
+const Memory::Buffer* Memory::lookup(size_t address) const
+{
+  size_t index = extractBuffer(address);
+  unsigned generation = m_generation.load(memory_order_acquire);
+
+  TLBEntry& entry = tlb[(m_id*31 + index) & (TLB_SIZE-1)];
+  if (entry.memory != m_id || entry.index != index ||
+      entry.generation != generation)
+  {
+    if (index == 0 || index >= m_memory.size() || !m_memory[index])
+      return NULL;
+
+    entry.memory     = m_id;
+    entry.index      = index;
+    entry.generation = generation;
+    entry.buffer     = m_memory[index];
+  }
+  return entry.buffer;
+}
+
 void* Memory::mapBuffer(size_t address, size_t offset, size_t size)
 {
   size_t buffer = extractBuffer(address);
@@ -433,22 +743,434 @@ void* Memory::mapBuffer(size_t address, size_t offset, size_t size)
   return m_memory[buffer]->data + offset + extractOffset(address);
 }
 
+#if !defined(_WIN32)
+unsigned char* Memory::mapData(size_t size)
+{
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+
+  // Back buffers with unlinked files in the swap directory, if there is one,
+  // so that they can be larger than physical memory
+  int fd = -1;
+  string swapDir;
+  {
+    lock_guard<mutex> lock(swapMutex);
+    swapDir = m_swapDir;
+  }
+  if (!swapDir.empty())
+  {
+    string path = swapDir + "/oclgrind-XXXXXX";
+    vector<char> filename(path.begin(), path.end());
+    filename.push_back('\0');
+
+    fd = mkstemp(&filename[0]);
+    if (fd >= 0)
+    {
+      unlink(&filename[0]);
+      if (ftruncate(fd, size))
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+
+    if (fd >= 0)
+    {
+      flags = MAP_SHARED;
+    }
+    else
+    {
+      // Only report the failure once if several threads hit it
+      lock_guard<mutex> lock(swapMutex);
+      if (!m_swapDir.empty())
+      {
+        cerr << "Oclgrind: Unable to create buffer in swap directory '"
+             << swapDir << "', using memory instead" << endl;
+        m_swapDir.clear();
+      }
+    }
+  }
+
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+#ifdef MADV_HUGEPAGE
+  if (m_hugePages && fd < 0 && size >= HUGE_PAGE_SIZE)
+    madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+  return (unsigned char*)data;
+}
+#endif
+
+unsigned Memory::registerRecordShadow(size_t recordSize)
+{
+  assert(recordSize);
+
+  // Only reuse a slot for records of the same size
+  lock_guard<mutex> lock(shadowMutex);
+  for (unsigned i = 0; i < MAX_SHADOWS; i++)
+  {
+    if (!recordRegistered[i] && recordSizes[i] == recordSize)
+    {
+      recordRegistered[i] = true;
+      return i;
+    }
+  }
+  for (unsigned i = 0; i < MAX_SHADOWS; i++)
+  {
+    if (!recordSizes[i])
+    {
+      recordSizes[i] = recordSize;
+      recordRegistered[i] = true;
+      return i;
+    }
+  }
+  FATAL_ERROR("Too many shadow memory regions registered");
+}
+
+unsigned Memory::registerShadow(unsigned bitsPerByte)
+{
+  assert(bitsPerByte == 1 || bitsPerByte == 2 ||
+         bitsPerByte == 4 || bitsPerByte == 8);
+
+  lock_guard<mutex> lock(shadowMutex);
+  for (unsigned i = 0; i < MAX_SHADOWS; i++)
+  {
+    if (!shadowBits[i])
+    {
+      shadowBits[i] = bitsPerByte;
+      return i;
+    }
+  }
+  FATAL_ERROR("Too many shadow memory regions registered");
+}
+
+void Memory::releaseData(unsigned char *data, size_t size)
+{
+  if (m_addressSpace != AddrSpaceGlobal)
+  {
+    delete[] data;
+  }
+#if !defined(_WIN32)
+  else if (size >= MAP_THRESHOLD)
+  {
+    munmap(data, size);
+  }
+#endif
+  else
+  {
+#if defined(_WIN32)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+  }
+}
+
 bool Memory::store(const unsigned char *source, size_t address, size_t size)
 {
   m_context->notifyMemoryStore(this, address, size, source);
 
   // Bounds check
-  if (!isAddressValid(address, size))
+  const Buffer *dst = lookup(address);
+  size_t offset = extractOffset(address);
+  if (!dst || offset+size > dst->size)
   {
     return false;
   }
 
-  // Get buffer
-  size_t offset = extractOffset(address);
-  Buffer *dst = m_memory[extractBuffer(address)];
-
   // Store data
   memcpy(dst->data + offset, source, size);
 
   return true;
 }
+
+void Memory::unregisterRecordShadow(unsigned shadow)
+{
+  lock_guard<mutex> lock(shadowMutex);
+  recordRegistered[shadow] = false;
+}
+
+void Memory::unregisterShadow(unsigned shadow)
+{
+  lock_guard<mutex> lock(shadowMutex);
+  shadowBits[shadow] = 0;
+}
+
+Memory::RecordShadow::RecordShadow(size_t size, size_t recordSize)
+{
+  m_recordSize = recordSize;
+  m_numPages = (size + ((size_t)1 << PAGE_BITS) - 1) >> PAGE_BITS;
+  m_pages = new std::atomic<Page*>[m_numPages];
+  for (size_t i = 0; i < m_numPages; i++)
+  {
+    m_pages[i].store(NULL, memory_order_relaxed);
+  }
+}
+
+Memory::RecordShadow::~RecordShadow()
+{
+  for (size_t i = 0; i < m_numPages; i++)
+  {
+    Page *page = m_pages[i].load(memory_order_relaxed);
+    if (page)
+    {
+      delete[] page->records;
+      delete page;
+    }
+  }
+  delete[] m_pages;
+}
+
+void* Memory::RecordShadow::lockPage(size_t offset, uint64_t epoch,
+                                     unique_lock<mutex>& lock)
+{
+  size_t index = offset >> PAGE_BITS;
+  assert(index < m_numPages);
+  size_t pageSize = m_recordSize << PAGE_BITS;
+
+  Page *page = m_pages[index].load(memory_order_acquire);
+  if (!page)
+  {
+    // Several workers may touch a page for the first time at once
+    Page *created = new Page;
+    created->epoch = epoch;
+    created->records = new unsigned char[pageSize]();
+    if (m_pages[index].compare_exchange_strong(page, created))
+    {
+      page = created;
+    }
+    else
+    {
+      delete[] created->records;
+      delete created;
+    }
+  }
+
+  lock = unique_lock<mutex>(page->mutex);
+  if (page->epoch != epoch)
+  {
+    memset(page->records, 0, pageSize);
+    page->epoch = epoch;
+  }
+  return page->records;
+}
+
+Memory::Shadow::Shadow(size_t size, unsigned bitsPerByte, bool shared)
+{
+  m_size = size;
+  m_bitsPerByte = bitsPerByte;
+  m_shared = shared;
+
+  m_numPages = (size + SHADOW_PAGE_SIZE - 1) >> PAGE_BITS;
+  m_states = new std::atomic<int>[m_numPages];
+  m_bits = new uint64_t*[m_numPages];
+  for (size_t i = 0; i < m_numPages; i++)
+  {
+    m_states[i].store(0, memory_order_relaxed);
+    m_bits[i] = NULL;
+  }
+}
+
+Memory::Shadow::~Shadow()
+{
+  for (size_t i = 0; i < m_numPages; i++)
+  {
+    delete[] m_bits[i];
+  }
+  delete[] m_bits;
+  delete[] m_states;
+}
+
+bool Memory::Shadow::check(size_t offset, size_t size, uint8_t value,
+                           size_t& mismatch) const
+{
+  unsigned perWord = 64 / m_bitsPerByte;
+  uint64_t pattern = getPattern(value);
+
+  size_t end = offset + size;
+  while (offset < end)
+  {
+    size_t page = offset >> PAGE_BITS;
+    size_t pageBase = page << PAGE_BITS;
+    size_t pageEnd = min(end, pageBase + SHADOW_PAGE_SIZE);
+
+    // Summarized pages can be checked without locking
+    int state = m_states[page].load(memory_order_acquire);
+    if (state == PAGE_MIXED)
+    {
+      unique_lock<mutex> lock(m_mutex, defer_lock);
+      if (m_shared)
+        lock.lock();
+
+      // Page may have been summarized since its state was loaded
+      const uint64_t *bits = m_bits[page];
+      if (bits)
+      {
+        // Check a word of bits at a time
+        while (offset < pageEnd)
+        {
+          size_t index = offset - pageBase;
+          size_t first = index % perWord;
+          size_t num = min(perWord - first, pageEnd - offset);
+          uint64_t diff = (bits[index / perWord] ^ pattern) &
+                          getShadowMask(first, num, m_bitsPerByte);
+          if (diff)
+          {
+            size_t element = first;
+            while (!(diff & getShadowMask(element, 1, m_bitsPerByte)))
+              element++;
+            mismatch = offset + (element - first);
+            return false;
+          }
+          offset += num;
+        }
+        continue;
+      }
+      state = m_states[page].load(memory_order_relaxed);
+    }
+
+    if (state != value)
+    {
+      mismatch = offset;
+      return false;
+    }
+    offset = pageEnd;
+  }
+  return true;
+}
+
+void Memory::Shadow::fill(size_t offset, size_t size, uint8_t value)
+{
+  unsigned perWord = 64 / m_bitsPerByte;
+  size_t numWords = SHADOW_PAGE_SIZE / perWord;
+  uint64_t pattern = getPattern(value);
+
+  size_t end = offset + size;
+  while (offset < end)
+  {
+    size_t page = offset >> PAGE_BITS;
+    size_t pageBase = page << PAGE_BITS;
+    size_t pageLimit = min(m_size, pageBase + SHADOW_PAGE_SIZE);
+    size_t pageEnd = min(end, pageLimit);
+
+    if (m_states[page].load(memory_order_acquire) == value)
+    {
+      offset = pageEnd;
+      continue;
+    }
+
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if (m_shared)
+      lock.lock();
+
+    uint64_t *bits = m_bits[page];
+    int state = m_states[page].load(memory_order_relaxed);
+    if (state == value)
+    {
+      offset = pageEnd;
+      continue;
+    }
+
+    // Filling a whole page just changes its summary
+    if (offset == pageBase && pageEnd == pageLimit)
+    {
+      delete[] bits;
+      m_bits[page] = NULL;
+      m_states[page].store(value, memory_order_release);
+      offset = pageEnd;
+      continue;
+    }
+
+    if (!bits)
+    {
+      bits = m_bits[page] = new uint64_t[numWords];
+      std::fill(bits, bits + numWords, getPattern(state));
+      m_states[page].store(PAGE_MIXED, memory_order_release);
+    }
+
+    // Fill a word of bits at a time
+    while (offset < pageEnd)
+    {
+      size_t index = offset - pageBase;
+      size_t first = index % perWord;
+      size_t num = min(perWord - first, pageEnd - offset);
+      uint64_t mask = getShadowMask(first, num, m_bitsPerByte);
+      uint64_t& word = bits[index / perWord];
+      word = (word & ~mask) | (pattern & mask);
+      offset += num;
+    }
+
+    // Summarize the page once every byte in it has the same state
+    if (isUniform(bits, pageLimit - pageBase, value))
+    {
+      delete[] bits;
+      m_bits[page] = NULL;
+      m_states[page].store(value, memory_order_release);
+    }
+  }
+}
+
+uint8_t Memory::Shadow::get(size_t offset) const
+{
+  size_t page = offset >> PAGE_BITS;
+  int state = m_states[page].load(memory_order_acquire);
+  if (state != PAGE_MIXED)
+    return state;
+
+  unique_lock<mutex> lock(m_mutex, defer_lock);
+  if (m_shared)
+    lock.lock();
+
+  const uint64_t *bits = m_bits[page];
+  if (!bits)
+    return m_states[page].load(memory_order_relaxed);
+
+  unsigned perWord = 64 / m_bitsPerByte;
+  size_t index = offset - (page << PAGE_BITS);
+  uint64_t word = bits[index / perWord];
+  return (word >> ((index % perWord) * m_bitsPerByte)) &
+         ((1 << m_bitsPerByte) - 1);
+}
+
+uint64_t Memory::Shadow::getPattern(uint8_t value) const
+{
+  uint64_t pattern = 0;
+  for (unsigned i = 0; i < 64; i += m_bitsPerByte)
+  {
+    pattern |= (uint64_t)value << i;
+  }
+  return pattern;
+}
+
+bool Memory::Shadow::isUniform(const uint64_t *bits, size_t count,
+                               uint8_t value) const
+{
+  unsigned perWord = 64 / m_bitsPerByte;
+  uint64_t pattern = getPattern(value);
+  size_t numFull = count / perWord;
+  size_t rest = count % perWord;
+
+  // Check the first and last words before the rest, as they are the most
+  // likely to differ while a page is being filled
+  if (numFull && bits[0] != pattern)
+    return false;
+  if (rest &&
+      ((bits[numFull] ^ pattern) & getShadowMask(0, rest, m_bitsPerByte)))
+    return false;
+  if (numFull && bits[numFull-1] != pattern)
+    return false;
+
+  for (size_t i = 1; i + 1 < numFull; i++)
+  {
+    if (bits[i] != pattern)
+      return false;
+  }
+  return true;
+}
@@ -8,6 +8,9 @@
 
 #include "common.h"
 
+#include <atomic>
+#include <mutex>
+
 namespace oclgrind
 {
   class Context;
@@ -15,11 +18,79 @@ namespace oclgrind
   class Memory
   {
   public:
+    // Shadow memory holds a few bits of state for each byte of a buffer,
+    // for plugins that need to track properties of individual bytes
+    // State is kept in pages, which are summarized by a single value when
+    // every byte in them has the same state, and only have bits allocated
+    // once their bytes differ
+    class Shadow
+    {
+    public:
+      Shadow(size_t size, unsigned bitsPerByte, bool shared);
+      ~Shadow();
+
+      bool check(size_t offset, size_t size, uint8_t value,
+                 size_t& mismatch) const;
+      void fill(size_t offset, size_t size, uint8_t value);
+      uint8_t get(size_t offset) const;
+
+    private:
+      static const unsigned PAGE_BITS = 12;
+      static const int PAGE_MIXED = -1;
+
+      size_t m_size;
+      unsigned m_bitsPerByte;
+      size_t m_numPages;
+      std::atomic<int> *m_states;
+      uint64_t **m_bits;
+
+      // Shadows for global memory are updated by several workers at once
+      bool m_shared;
+      mutable std::mutex m_mutex;
+
+      bool isUniform(const uint64_t *bits, size_t count, uint8_t value) const;
+      uint64_t getPattern(uint8_t value) const;
+    };
+    static const unsigned MAX_SHADOWS = 8;
+
+    // Record shadows hold a fixed-size record for each byte of a buffer,
+    // for plugins that need more state than fits in a few bits
+    // Records are allocated a page at a time when a page is first used.
+    // Each page belongs to the epoch that last used it, and its records
+    // are zeroed when it is used in a different epoch, so that plugins can
+    // start afresh without clearing every buffer.
+    class RecordShadow
+    {
+    public:
+      static const unsigned PAGE_BITS = 12;
+
+      RecordShadow(size_t size, size_t recordSize);
+      ~RecordShadow();
+
+      // Lock the page containing offset, returning its first record
+      void* lockPage(size_t offset, uint64_t epoch,
+                     std::unique_lock<std::mutex>& lock);
+
+    private:
+      struct Page
+      {
+        uint64_t epoch;
+        std::mutex mutex;
+        unsigned char *records;
+      };
+
+      size_t m_recordSize;
+      size_t m_numPages;
+      std::atomic<Page*> *m_pages;
+    };
+
     struct Buffer
     {
       size_t size;
       cl_mem_flags flags;
       unsigned char *data;
+      std::atomic<Shadow*> shadows[MAX_SHADOWS];
+      std::atomic<RecordShadow*> recordShadows[MAX_SHADOWS];
     };
 
   public:
@@ -28,8 +99,8 @@ namespace oclgrind
 
     size_t allocateBuffer(size_t size, cl_mem_flags flags=0,
                           const uint8_t *initData = NULL);
-    uint32_t atomic(AtomicOp op, size_t address, uint32_t value = 0);
-    uint32_t atomicCmpxchg(size_t address, uint32_t cmp, uint32_t value);
+    template<typename T> T atomic(AtomicOp op, size_t address, T value = 0);
+    template<typename T> T atomicCmpxchg(size_t address, T cmp, T value);
     void clear();
     size_t createHostBuffer(size_t size, void *ptr, cl_mem_flags flags=0);
     bool copy(size_t dest, size_t src, size_t size);
@@ -49,6 +120,16 @@ namespace oclgrind
 
     size_t getMaxAllocSize();
 
+    // Shadows are registered by plugins, and are then created lazily for
+    // each buffer the first time they are requested
+    // Return NULL if the address isn't in a buffer
+    Shadow* getShadow(unsigned shadow, size_t address) const;
+    RecordShadow* getRecordShadow(unsigned shadow, size_t address) const;
+    static unsigned registerRecordShadow(size_t recordSize);
+    static unsigned registerShadow(unsigned bitsPerByte);
+    static void unregisterRecordShadow(unsigned shadow);
+    static void unregisterShadow(unsigned shadow);
+
   private:
     const Context *m_context;
     std::queue<unsigned> m_freeBuffers;
@@ -56,11 +137,23 @@ namespace oclgrind
     unsigned int m_addressSpace;
     size_t m_totalAllocated;
 
+    bool m_hugePages;
+    std::string m_swapDir;
+
+    // Each memory has a unique ID for caching buffer translations, and a
+    // generation that changes whenever a buffer is released
+    size_t m_id;
+    std::atomic<unsigned> m_generation;
+
     unsigned m_numBitsBuffer;
     unsigned m_numBitsAddress;
     size_t m_maxNumBuffers;
     size_t m_maxBufferSize;
 
+    unsigned char* allocateData(size_t size, const uint8_t *initData);
     unsigned getNextBuffer();
+    const Buffer* lookup(size_t address) const;
+    unsigned char* mapData(size_t size);
+    void releaseData(unsigned char *data, size_t size);
   };
 }
@@ -19,7 +19,59 @@ Plugin::~Plugin()
 {
 }
 
+bool Plugin::handlesAddressSpace(unsigned addrSpace) const
+{
+  return true;
+}
+
+bool Plugin::handlesEvent(EventType event) const
+{
+  // Batched memory access delivery must be requested explicitly
+  return event != MEMORY_ACCESSES;
+}
+
+bool Plugin::handlesOpcode(unsigned opcode) const
+{
+  return true;
+}
+
 bool Plugin::isThreadSafe() const
 {
   return true;
 }
+
+void Plugin::memoryAccesses(const MemoryAccess *accesses, size_t num)
+{
+  // Pass batched accesses to the individual event callbacks by default
+  for (size_t i = 0; i < num; i++)
+  {
+    const MemoryAccess& access = accesses[i];
+    if (access.atomic)
+    {
+      if (access.store)
+        memoryAtomicStore(access.memory, access.workItem, access.op,
+                          access.address, access.size);
+      else
+        memoryAtomicLoad(access.memory, access.workItem, access.op,
+                         access.address, access.size);
+    }
+    else if (access.workItem)
+    {
+      if (access.store)
+        memoryStore(access.memory, access.workItem,
+                    access.address, access.size, access.storeData);
+      else
+        memoryLoad(access.memory, access.workItem,
+                   access.address, access.size);
+    }
+    else
+    {
+      if (access.store)
+        memoryStore(access.memory, access.workGroup,
+                    access.address, access.size, access.storeData);
+      else
+        memoryLoad(access.memory, access.workGroup,
+                   access.address, access.size);
+    }
+  }
+}
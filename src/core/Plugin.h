@@ -21,6 +21,48 @@ namespace oclgrind
 
   class Plugin
   {
+  public:
+    // Events that plugins can be notified of
+    enum EventType
+    {
+      HOST_MEMORY_LOAD,
+      HOST_MEMORY_STORE,
+      INSTRUCTION_EXECUTED,
+      KERNEL_BEGIN,
+      KERNEL_END,
+      LOG,
+      MEMORY_ACCESSES,
+      MEMORY_ALLOCATED,
+      MEMORY_ATOMIC_LOAD,
+      MEMORY_ATOMIC_STORE,
+      MEMORY_DEALLOCATED,
+      MEMORY_LOAD,
+      MEMORY_MAP,
+      MEMORY_STORE,
+      MEMORY_UNMAP,
+      WORK_GROUP_BARRIER,
+      WORK_GROUP_BEGIN,
+      WORK_GROUP_COMPLETE,
+      WORK_ITEM_BEGIN,
+      WORK_ITEM_COMPLETE,
+      NUM_EVENTS
+    };
+
+    // A memory access made by a kernel, for batched delivery
+    struct MemoryAccess
+    {
+      const Memory *memory;
+      const WorkGroup *workGroup;
+      const WorkItem *workItem;     // NULL for work-group accesses
+      const llvm::Instruction *instruction;
+      size_t address;
+      size_t size;
+      bool store;
+      bool atomic;
+      AtomicOp op;                  // Only valid for atomic accesses
+      const uint8_t *storeData;     // NULL for loads
+    };
+
   public:
     Plugin(const Context *context);
     virtual ~Plugin();
@@ -36,6 +78,7 @@ namespace oclgrind
     virtual void kernelBegin(const KernelInvocation *kernelInvocation){}
     virtual void kernelEnd(const KernelInvocation *kernelInvocation){}
     virtual void log(MessageType type, const char *message){}
+    virtual void memoryAccesses(const MemoryAccess *accesses, size_t num);
     virtual void memoryAllocated(const Memory *memory, size_t address,
                                  size_t size, cl_mem_flags flags,
                                  const uint8_t *initData){}
@@ -66,6 +109,16 @@ namespace oclgrind
     virtual void workItemBegin(const WorkItem *workItem){}
     virtual void workItemComplete(const WorkItem *workItem){}
 
+    // Plugins are only notified of the events, instruction opcodes and
+    // address spaces that they handle
+    // These are queried once, when the plugin is registered
+    // Plugins that handle MEMORY_ACCESSES receive the loads and stores made
+    // by kernels in batches, delivered before each barrier and when each
+    // work-group completes, instead of as individual events
+    virtual bool handlesAddressSpace(unsigned addrSpace) const;
+    virtual bool handlesEvent(EventType event) const;
+    virtual bool handlesOpcode(unsigned opcode) const;
+
     virtual bool isThreadSafe() const;
 
   protected:
@@ -8,6 +8,7 @@
 
 #include "common.h"
 #include <fstream>
+#include <mutex>
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include <windows.h>
@@ -57,6 +58,8 @@ const char *EXTENSIONS[] =
   "cl_khr_global_int32_extended_atomics",
   "cl_khr_local_int32_base_atomics",
   "cl_khr_local_int32_extended_atomics",
+  "cl_khr_int64_base_atomics",
+  "cl_khr_int64_extended_atomics",
   "cl_khr_byte_addressable_store",
 };
 
@@ -571,10 +574,16 @@ Kernel* Program::createKernel(const string name)
   try
   {
     // Create cache if none already
-    InterpreterCacheMap::iterator itr = m_interpreterCache.find(function);
-    if (itr == m_interpreterCache.end())
+    if (!getInterpreterCache(function))
     {
-      m_interpreterCache[function] = new InterpreterCache(function);
+      lock_guard<mutex> build(m_interpreterCacheBuildMutex);
+      if (!getInterpreterCache(function))
+      {
+        InterpreterCache *cache = new InterpreterCache(function);
+
+        lock_guard<mutex> lock(m_interpreterCacheMutex);
+        m_interpreterCache[function] = cache;
+      }
     }
 
     return new Kernel(this, function, m_module.get());
@@ -646,7 +655,11 @@ unsigned long Program::generateUID() const
 const InterpreterCache* Program::getInterpreterCache(
   const llvm::Function *kernel) const
 {
-  return m_interpreterCache[kernel];
+  lock_guard<mutex> lock(m_interpreterCacheMutex);
+  InterpreterCacheMap::const_iterator itr = m_interpreterCache.find(kernel);
+  if (itr == m_interpreterCache.end())
+    return NULL;
+  return itr->second;
 }
 
 list<string> Program::getKernelNames() const
@@ -7,6 +7,7 @@
 // source code.
 
 #include "common.h"
+#include <mutex>
 
 namespace llvm
 {
@@ -77,7 +78,14 @@ namespace oclgrind
 
     typedef std::map<const llvm::Function*, InterpreterCache*>
       InterpreterCacheMap;
-    mutable InterpreterCacheMap m_interpreterCache;
+    InterpreterCacheMap m_interpreterCache;
     void clearInterpreterCache();
+
+    // Kernels can be created while other kernels from the program are
+    // running, so the cache map is only locked to look up or add entries.
+    // Building a cache modifies the module's LLVM context, so builds are
+    // serialised separately.
+    mutable std::mutex m_interpreterCacheMutex;
+    std::mutex m_interpreterCacheBuildMutex;
   };
 }
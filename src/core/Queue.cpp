@@ -7,9 +7,14 @@
 // source code.
 
 #include "common.h"
+#include <algorithm>
 #include <cassert>
 
+#include "llvm/IR/Argument.h"
+#include "llvm/IR/DerivedTypes.h"
+
 #include "Context.h"
+#include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
 #include "Queue.h"
@@ -17,13 +22,44 @@
 using namespace oclgrind;
 using namespace std;
 
-Queue::Queue(const Context *context)
-  : m_context(context)
+Queue::Queue(const Context *context, bool outOfOrder)
+  : m_context(context), m_outOfOrder(outOfOrder)
 {
+  m_shutdown = false;
+  m_idleExecutors = 0;
+
+  // Plugins that are not thread-safe must not see host API calls and
+  // simulation interleaved, so leave execution to the host thread
+  // Out-of-order queues run independent commands concurrently
+  m_maxExecutors = 0;
+  if (m_context->isThreadSafe())
+    m_maxExecutors = m_outOfOrder ? max(thread::hardware_concurrency(), 2U) : 1;
 }
 
 Queue::~Queue()
 {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_shutdown = true;
+
+    // Wake executors that are waiting for events that may never complete,
+    // such as user events that the application hasn't set
+    for (auto cmd = m_commands.begin(); cmd != m_commands.end(); cmd++)
+    {
+      for (auto event = (*cmd)->waitList.begin();
+                event != (*cmd)->waitList.end();
+                event++)
+      {
+        (*event)->wake();
+      }
+    }
+  }
+  m_condition.notify_all();
+
+  for (auto itr = m_executors.begin(); itr != m_executors.end(); itr++)
+  {
+    itr->join();
+  }
 }
 
 Event::Event()
@@ -33,14 +69,198 @@ Event::Event()
   startTime = endTime = 0;
 }
 
+void Event::addCallback(int type, function<void(int)> callback)
+{
+  int current;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    current = state;
+    if (current > type)
+    {
+      m_callbacks.push_back(make_pair(type, callback));
+      return;
+    }
+  }
+  callback(current);
+}
+
+void Event::setState(int value)
+{
+  list< pair<int,function<void(int)>> > due;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    state = value;
+    for (auto itr = m_callbacks.begin(); itr != m_callbacks.end();)
+    {
+      if (value <= itr->first)
+      {
+        due.push_back(*itr);
+        itr = m_callbacks.erase(itr);
+      }
+      else
+      {
+        itr++;
+      }
+    }
+  }
+  m_complete.notify_all();
+
+  // Callbacks may query or wait for the event, so run them without the lock
+  for (auto itr = due.begin(); itr != due.end(); itr++)
+  {
+    itr->second(value);
+  }
+}
+
+int Event::wait(const atomic<bool> *cancel)
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_complete.wait(lock, [this,cancel](){
+    return state == CL_COMPLETE || state < 0 || (cancel && *cancel);
+  });
+  return state;
+}
+
+void Event::wake()
+{
+  // Take the lock so that a waiter can't miss the notification between
+  // checking its condition and sleeping
+  {
+    lock_guard<mutex> lock(m_mutex);
+  }
+  m_complete.notify_all();
+}
+
+void Queue::addDependencies(Command *cmd)
+{
+  cmd->numDependencies = 0;
+
+  // In-order queues run each command after the one before it
+  if (!m_outOfOrder)
+  {
+    if (!m_commands.empty())
+    {
+      m_commands.back()->dependents.push_back(cmd);
+      cmd->numDependencies++;
+    }
+    return;
+  }
+
+  // Otherwise, only order commands that access the same buffers, or that
+  // are in the wait list
+  getMemoryAccesses(cmd);
+  for (auto itr = m_commands.begin(); itr != m_commands.end(); itr++)
+  {
+    Command *prev = *itr;
+    bool conflict = cmd->barrier || prev->barrier ||
+      find(cmd->waitList.begin(), cmd->waitList.end(), prev->event)
+        != cmd->waitList.end();
+    for (auto b = cmd->writes.begin(); !conflict && b != cmd->writes.end(); b++)
+    {
+      conflict = prev->reads.count(*b) || prev->writes.count(*b);
+    }
+    for (auto b = cmd->reads.begin(); !conflict && b != cmd->reads.end(); b++)
+    {
+      conflict = prev->writes.count(*b);
+    }
+
+    if (conflict)
+    {
+      prev->dependents.push_back(cmd);
+      cmd->numDependencies++;
+    }
+  }
+}
+
 Event* Queue::enqueue(Command *cmd)
 {
   Event *event = new Event();
   cmd->event = event;
-  m_queue.push(cmd);
+  {
+    lock_guard<mutex> lock(m_mutex);
+    addDependencies(cmd);
+    m_commands.push_back(cmd);
+    if (!cmd->numDependencies)
+    {
+      m_ready.push(cmd);
+      startExecutors();
+    }
+  }
+  m_condition.notify_all();
   return event;
 }
 
+void Queue::execute(Command *cmd)
+{
+  // Wait for all events in wait list to complete
+  // If the queue is destroyed first, the command can't run
+  for (auto itr = cmd->waitList.begin(); itr != cmd->waitList.end(); itr++)
+  {
+    int state = (*itr)->wait(&m_shutdown);
+    if (state < 0)
+    {
+      cmd->event->setState(state);
+      return;
+    }
+    else if (state != CL_COMPLETE)
+    {
+      cmd->event->setState(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST);
+      return;
+    }
+  }
+
+  cmd->event->startTime = now();
+  cmd->event->setState(CL_RUNNING);
+
+  // Dispatch command
+  switch (cmd->type)
+  {
+  case COPY:
+    executeCopyBuffer((CopyCommand*)cmd);
+    break;
+  case COPY_RECT:
+    executeCopyBufferRect((CopyRectCommand*)cmd);
+    break;
+  case EMPTY:
+    break;
+  case FILL_BUFFER:
+    executeFillBuffer((FillBufferCommand*)cmd);
+    break;
+  case FILL_IMAGE:
+    executeFillImage((FillImageCommand*)cmd);
+    break;
+  case READ:
+    executeReadBuffer((BufferCommand*)cmd);
+    break;
+  case READ_RECT:
+    executeReadBufferRect((BufferRectCommand*)cmd);
+    break;
+  case KERNEL:
+    executeKernel((KernelCommand*)cmd);
+    break;
+  case MAP:
+    executeMap((MapCommand*)cmd);
+    break;
+  case NATIVE_KERNEL:
+    executeNativeKernel((NativeKernelCommand*)cmd);
+    break;
+  case UNMAP:
+    executeUnmap((UnmapCommand*)cmd);
+    break;
+  case WRITE:
+    executeWriteBuffer((BufferCommand*)cmd);
+    break;
+  case WRITE_RECT:
+    executeWriteBufferRect((BufferRectCommand*)cmd);
+    break;
+  default:
+    assert(false && "Unhandled command type in queue.");
+  }
+
+  cmd->event->endTime = now();
+  cmd->event->setState(CL_COMPLETE);
+}
+
 void Queue::executeCopyBuffer(CopyCommand *cmd)
 {
   m_context->getGlobalMemory()->copy(cmd->dst, cmd->src, cmd->size);
@@ -126,6 +346,27 @@ void Queue::executeNativeKernel(NativeKernelCommand *cmd)
   cmd->func(cmd->args);
 }
 
+void Queue::executeNext(unique_lock<mutex>& lock)
+{
+  Command *cmd = m_ready.front();
+  m_ready.pop();
+  lock.unlock();
+  execute(cmd);
+  lock.lock();
+
+  // Release commands that were waiting for this one
+  for (auto itr = cmd->dependents.begin(); itr != cmd->dependents.end(); itr++)
+  {
+    if (--(*itr)->numDependencies == 0)
+      m_ready.push(*itr);
+  }
+
+  // Hand command back to the host to be released
+  m_commands.remove(cmd);
+  m_completed.push(cmd);
+  m_condition.notify_all();
+}
+
 void Queue::executeReadBuffer(BufferCommand *cmd)
 {
   m_context->getGlobalMemory()->load(cmd->ptr, cmd->address, cmd->size);
@@ -187,92 +428,179 @@ void Queue::executeWriteBufferRect(BufferRectCommand *cmd)
   }
 }
 
-bool Queue::isEmpty() const
+void Queue::finish()
 {
-  return m_queue.empty();
+  unique_lock<mutex> lock(m_mutex);
+  if (m_maxExecutors)
+  {
+    m_condition.wait(lock, [this](){ return m_commands.empty(); });
+  }
+  else
+  {
+    while (!m_commands.empty())
+      executeNext(lock);
+  }
 }
 
-Queue::Command* Queue::update()
+Queue::Command* Queue::getCompletedCommand()
 {
-  if (m_queue.empty())
+  lock_guard<mutex> lock(m_mutex);
+  if (m_completed.empty())
   {
     return NULL;
   }
 
-  // Get next command
-  Command *cmd = m_queue.front();
-
-  // Check if all events in wait list have completed
-  while (!cmd->waitList.empty())
-  {
-    if (cmd->waitList.front()->state == CL_COMPLETE)
-    {
-      cmd->waitList.pop_front();
-    }
-    else if (cmd->waitList.front()->state < 0)
-    {
-      cmd->event->state = cmd->waitList.front()->state;
-      m_queue.pop();
-      return cmd;
-    }
-    else
-    {
-      return NULL;
-    }
-  }
-
-  cmd->event->startTime = now();
-  cmd->event->state = CL_RUNNING;
+  Command *cmd = m_completed.front();
+  m_completed.pop();
+  return cmd;
+}
 
-  // Dispatch command
+void Queue::getMemoryAccesses(Command *cmd)
+{
+  // Record which global memory buffers the command reads and writes
+  // Sub-buffers share their parent's buffer, so they are ordered with it
+  Memory *memory = m_context->getGlobalMemory();
+  cmd->barrier = false;
   switch (cmd->type)
   {
   case COPY:
-    executeCopyBuffer((CopyCommand*)cmd);
+    cmd->reads.insert(memory->extractBuffer(((CopyCommand*)cmd)->src));
+    cmd->writes.insert(memory->extractBuffer(((CopyCommand*)cmd)->dst));
     break;
   case COPY_RECT:
-    executeCopyBufferRect((CopyRectCommand*)cmd);
-    break;
-  case EMPTY:
+    cmd->reads.insert(memory->extractBuffer(((CopyRectCommand*)cmd)->src));
+    cmd->writes.insert(memory->extractBuffer(((CopyRectCommand*)cmd)->dst));
     break;
   case FILL_BUFFER:
-    executeFillBuffer((FillBufferCommand*)cmd);
+    cmd->writes.insert(
+      memory->extractBuffer(((FillBufferCommand*)cmd)->address));
     break;
   case FILL_IMAGE:
-    executeFillImage((FillImageCommand*)cmd);
-    break;
-  case READ:
-    executeReadBuffer((BufferCommand*)cmd);
-    break;
-  case READ_RECT:
-    executeReadBufferRect((BufferRectCommand*)cmd);
+    cmd->writes.insert(memory->extractBuffer(((FillImageCommand*)cmd)->base));
     break;
   case KERNEL:
-    executeKernel((KernelCommand*)cmd);
+  {
+    Kernel *kernel = ((KernelCommand*)cmd)->kernel;
+    for (auto value = kernel->values_begin();
+         value != kernel->values_end(); value++)
+    {
+      const llvm::Argument *arg = llvm::dyn_cast<llvm::Argument>(value->first);
+      if (!arg)
+        continue;
+
+      const llvm::PointerType *type =
+        llvm::dyn_cast<llvm::PointerType>(arg->getType());
+      if (!type)
+        continue;
+      unsigned addrSpace = type->getAddressSpace();
+      if (addrSpace != AddrSpaceGlobal && addrSpace != AddrSpaceConstant)
+        continue;
+
+      // Image arguments point to an image descriptor
+      bool read = (addrSpace == AddrSpaceConstant);
+      size_t address = value->second.getPointer();
+      const llvm::StructType *structType =
+        llvm::dyn_cast<llvm::StructType>(type->getElementType());
+      if (structType && structType->hasName() &&
+          structType->getName().startswith("opencl.image"))
+      {
+        address = ((Image*)address)->address;
+        read = (kernel->getArgumentAccessQualifier(arg->getArgNo()) ==
+                CL_KERNEL_ARG_ACCESS_READ_ONLY);
+      }
+      if (!address)
+        continue;
+
+      const Memory::Buffer *buffer = memory->getBuffer(address);
+      if (buffer && (buffer->flags & CL_MEM_READ_ONLY))
+        read = true;
+
+      if (read)
+        cmd->reads.insert(memory->extractBuffer(address));
+      else
+        cmd->writes.insert(memory->extractBuffer(address));
+    }
     break;
+  }
   case MAP:
-    executeMap((MapCommand*)cmd);
+    // The host may access a mapped buffer until it is unmapped
+    cmd->writes.insert(memory->extractBuffer(((MapCommand*)cmd)->address));
     break;
-  case NATIVE_KERNEL:
-    executeNativeKernel((NativeKernelCommand*)cmd);
+  case READ:
+    cmd->reads.insert(memory->extractBuffer(((BufferCommand*)cmd)->address));
+    break;
+  case READ_RECT:
+    cmd->reads.insert(
+      memory->extractBuffer(((BufferRectCommand*)cmd)->address));
     break;
   case UNMAP:
-    executeUnmap((UnmapCommand*)cmd);
+    cmd->writes.insert(memory->extractBuffer(((UnmapCommand*)cmd)->address));
     break;
   case WRITE:
-    executeWriteBuffer((BufferCommand*)cmd);
+    cmd->writes.insert(memory->extractBuffer(((BufferCommand*)cmd)->address));
     break;
   case WRITE_RECT:
-    executeWriteBufferRect((BufferRectCommand*)cmd);
+    cmd->writes.insert(
+      memory->extractBuffer(((BufferRectCommand*)cmd)->address));
     break;
   default:
-    assert(false && "Unhandled command type in queue.");
+    // Markers, barriers and native kernels are ordered with everything
+    cmd->barrier = true;
+    break;
   }
+}
 
-  cmd->event->endTime = now();
-  cmd->event->state = CL_COMPLETE;
+bool Queue::isEmpty() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_commands.empty();
+}
 
-  // Remove command from queue and delete
-  m_queue.pop();
-  return cmd;
+void Queue::runExecutor()
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (true)
+  {
+    // Sleep until there are commands ready to execute
+    m_condition.wait(lock, [this](){ return m_shutdown || !m_ready.empty(); });
+    if (m_ready.empty())
+      break;
+
+    m_idleExecutors--;
+    executeNext(lock);
+    m_idleExecutors++;
+
+    // The command may have released several others
+    startExecutors();
+  }
+}
+
+void Queue::startExecutors()
+{
+  // Executors are created on demand, so that there are never more than
+  // there are independent commands ready to run at once
+  while (m_idleExecutors < m_ready.size() &&
+         m_executors.size() < m_maxExecutors)
+  {
+    m_executors.push_back(thread(&Queue::runExecutor, this));
+    m_idleExecutors++;
+  }
+}
+
+void Queue::wait(Event *event)
+{
+  unique_lock<mutex> lock(m_mutex);
+  if (m_maxExecutors)
+  {
+    lock.unlock();
+    event->wait();
+  }
+  else
+  {
+    while (event->state != CL_COMPLETE && event->state >= 0 &&
+           !m_ready.empty())
+    {
+      executeNext(lock);
+    }
+  }
 }
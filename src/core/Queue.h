@@ -9,6 +9,12 @@
 #pragma once
 #include "common.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 namespace oclgrind
 {
   class Context;
@@ -16,9 +22,31 @@ namespace oclgrind
 
   struct Event
   {
-    int state;
+    std::atomic<int> state;
     double queueTime, startTime, endTime;
     Event();
+
+    // Call a function with the event's state once the state reaches type
+    // (CL_SUBMITTED, CL_RUNNING or CL_COMPLETE) or the event terminates
+    // The function runs on the thread that updates the state, or straight
+    // away if the state has already been reached
+    void addCallback(int type, std::function<void(int)> callback);
+
+    // Update the state, run any callbacks that are now due and wake any
+    // threads waiting for completion
+    void setState(int value);
+
+    // Block until the event has completed or terminated, returning its
+    // final state
+    // If cancel is given, also return (with the current state) once it is
+    // set and wake() is called
+    int wait(const std::atomic<bool> *cancel = NULL);
+    void wake();
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_complete;
+    std::list< std::pair<int,std::function<void(int)>> > m_callbacks;
   };
 
   class Queue
@@ -37,6 +65,13 @@ namespace oclgrind
       }
     private:
       Event *event;
+
+      // Dependency graph
+      std::set<size_t> reads, writes;
+      bool barrier;
+      unsigned numDependencies;
+      std::list<Command*> dependents;
+
       friend class Queue;
     };
     struct BufferCommand : Command
@@ -179,7 +214,7 @@ namespace oclgrind
     };
 
   public:
-    Queue(const Context *context);
+    Queue(const Context *context, bool outOfOrder = false);
     virtual ~Queue();
 
     Event* enqueue(Command *command);
@@ -197,11 +232,32 @@ namespace oclgrind
     void executeWriteBuffer(BufferCommand *cmd);
     void executeWriteBufferRect(BufferRectCommand *cmd);
 
+    void finish();
+    Command* getCompletedCommand();
     bool isEmpty() const;
-    Command* update();
+    void wait(Event *event);
 
   private:
     const Context *m_context;
-    std::queue<Command*> m_queue;
+    bool m_outOfOrder;
+    std::list<Command*> m_commands;
+    std::queue<Command*> m_ready;
+    std::queue<Command*> m_completed;
+
+    // Commands are executed by dedicated threads when the context is
+    // thread-safe, otherwise by the host thread that waits for them
+    std::vector<std::thread> m_executors;
+    size_t m_maxExecutors;
+    size_t m_idleExecutors;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::atomic<bool> m_shutdown;
+
+    void addDependencies(Command *cmd);
+    void execute(Command *cmd);
+    void executeNext(std::unique_lock<std::mutex>& lock);
+    void getMemoryAccesses(Command *cmd);
+    void runExecutor();
+    void startExecutors();
   };
 }
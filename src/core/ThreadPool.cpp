@@ -0,0 +1,126 @@
+// ThreadPool.cpp (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+#include <chrono>
+
+#include "ThreadPool.h"
+
+using namespace oclgrind;
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double getSeconds(Clock::time_point begin, Clock::time_point end)
+{
+  return chrono::duration_cast<chrono::duration<double>>(end - begin).count();
+}
+
+ThreadPool::ThreadPool()
+{
+  m_shutdown = false;
+
+  m_statistics.numThreads     = 0;
+  m_statistics.launches       = 0;
+  m_statistics.inlineLaunches = 0;
+  m_statistics.busyTime       = 0.0;
+  m_statistics.idleTime       = 0.0;
+}
+
+ThreadPool::~ThreadPool()
+{
+  shutdown();
+}
+
+ThreadPool::Statistics ThreadPool::getStatistics() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_statistics;
+}
+
+void ThreadPool::run(unsigned numWorkers, const Task& task)
+{
+  // No need to involve any other threads for a single worker
+  if (numWorkers <= 1)
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_statistics.inlineLaunches++;
+    }
+    task(0);
+    return;
+  }
+
+  Launch launch = {&task, numWorkers - 1};
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    // Create any threads that don't exist yet
+    while (m_threads.size() < numWorkers - 1)
+    {
+      m_threads.push_back(thread(&ThreadPool::workerLoop, this));
+    }
+    m_statistics.numThreads = m_threads.size();
+    m_statistics.launches++;
+
+    for (unsigned i = 1; i < numWorkers; i++)
+    {
+      m_workers.push(make_pair(&launch, i));
+    }
+  }
+  m_wake.notify_all();
+
+  task(0);
+
+  // Wait for pool threads to finish the other workers
+  unique_lock<mutex> lock(m_mutex);
+  m_done.wait(lock, [&launch](){ return launch.pending == 0; });
+}
+
+void ThreadPool::shutdown()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_wake.notify_all();
+
+  for (auto itr = m_threads.begin(); itr != m_threads.end(); itr++)
+  {
+    itr->join();
+  }
+  m_threads.clear();
+}
+
+void ThreadPool::workerLoop()
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (true)
+  {
+    // Park until there is a worker to run
+    Clock::time_point parked = Clock::now();
+    m_wake.wait(lock, [this](){ return m_shutdown || !m_workers.empty(); });
+    Clock::time_point woken = Clock::now();
+    m_statistics.idleTime += getSeconds(parked, woken);
+
+    if (m_shutdown)
+      break;
+
+    Launch *launch = m_workers.front().first;
+    unsigned worker = m_workers.front().second;
+    m_workers.pop();
+
+    lock.unlock();
+    (*launch->task)(worker);
+    lock.lock();
+
+    m_statistics.busyTime += getSeconds(woken, Clock::now());
+    if (--launch->pending == 0)
+      m_done.notify_all();
+  }
+}
@@ -0,0 +1,67 @@
+// ThreadPool.h (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace oclgrind
+{
+  // Persistent worker threads used to run kernel invocations
+  // Threads are created the first time they are needed, and are parked
+  // between launches instead of being destroyed
+  class ThreadPool
+  {
+  public:
+    typedef std::function<void(unsigned)> Task;
+
+    struct Statistics
+    {
+      size_t numThreads;      // Threads created by the pool
+      size_t launches;        // Launches that used pool threads
+      size_t inlineLaunches;  // Launches run on the calling thread only
+      double busyTime;        // Seconds spent by pool threads running tasks
+      double idleTime;        // Seconds spent by pool threads parked
+    };
+
+    ThreadPool();
+    virtual ~ThreadPool();
+
+    Statistics getStatistics() const;
+
+    // Run task(0) ... task(numWorkers-1) and wait for them to complete
+    // Worker 0 runs on the calling thread
+    void run(unsigned numWorkers, const Task& task);
+
+    // Stop and join the pool threads, so that their statistics are final
+    // The pool can't be used afterwards
+    void shutdown();
+
+  private:
+    // Workers from concurrent launches share the pool threads
+    struct Launch
+    {
+      const Task *task;
+      unsigned pending;
+    };
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::vector<std::thread> m_threads;
+    std::queue< std::pair<Launch*,unsigned> > m_workers;
+    bool m_shutdown;
+
+    Statistics m_statistics;
+
+    void workerLoop();
+  };
+}
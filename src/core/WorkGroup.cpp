@@ -15,13 +15,15 @@
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
+#include "Program.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
 using namespace oclgrind;
 using namespace std;
 
-WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation, Size3 wgid)
+WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation,
+                     const InterpreterCache *cache, Size3 wgid)
  : m_context(kernelInvocation->getContext())
 {
   m_groupID = wgid;
@@ -48,6 +50,20 @@ WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation, Size3 wgid)
     }
   }
 
+  // Allocate storage for values that are uniform across the work-group
+  m_uniformFrame = new unsigned char[cache->getUniformFrameSize()];
+  m_uniformComputed.resize(cache->getUniformRegisters().size(), false);
+
+  // Allocate a register file for instruction results when executing
+  // work-items in lockstep, so that batches access them contiguously
+  m_registerFile = NULL;
+  if (kernelInvocation->isLockstep())
+  {
+    size_t numWorkItems = m_groupSize.x*m_groupSize.y*m_groupSize.z;
+    m_registerFile =
+      new unsigned char[cache->getRegisterFrameSize()*numWorkItems];
+  }
+
   // Initialise work-items
   for (size_t k = 0; k < m_groupSize.z; k++)
   {
@@ -55,7 +71,7 @@ WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation, Size3 wgid)
     {
       for (size_t i = 0; i < m_groupSize.x; i++)
       {
-        WorkItem *workItem = new WorkItem(kernelInvocation, this,
+        WorkItem *workItem = new WorkItem(kernelInvocation, this, cache,
                                           Size3(i, j, k));
         m_workItems.push_back(workItem);
         m_running.insert(workItem);
@@ -75,6 +91,8 @@ WorkGroup::~WorkGroup()
     delete m_workItems[i];
   }
 
+  delete[] m_registerFile;
+  delete[] m_uniformFrame;
   delete m_localMemory;
 }
 
@@ -313,6 +331,21 @@ WorkItem* WorkGroup::getNextWorkItem() const
   return *m_running.begin();
 }
 
+vector<WorkItem*> WorkGroup::getReadyWorkItems() const
+{
+  return vector<WorkItem*>(m_running.begin(), m_running.end());
+}
+
+unsigned char* WorkGroup::getRegisterFile() const
+{
+  return m_registerFile;
+}
+
+unsigned char* WorkGroup::getUniformFrame() const
+{
+  return m_uniformFrame;
+}
+
 WorkItem* WorkGroup::getWorkItem(Size3 localID) const
 {
   return m_workItems[localID.x +
@@ -324,6 +357,11 @@ bool WorkGroup::hasBarrier() const
   return m_barrier;
 }
 
+bool WorkGroup::isUniformComputed(unsigned index) const
+{
+  return m_uniformComputed[index];
+}
+
 void WorkGroup::notifyBarrier(WorkItem *workItem,
                               const llvm::Instruction *instruction,
                               uint64_t fence, list<size_t> events)
@@ -428,6 +466,11 @@ void WorkGroup::notifyFinished(WorkItem *workItem)
   }
 }
 
+void WorkGroup::setUniformComputed(unsigned index)
+{
+  m_uniformComputed[index] = true;
+}
+
 bool WorkGroup::WorkItemCmp::operator()(const WorkItem *lhs,
                                         const WorkItem *rhs) const
 {
@@ -14,6 +14,7 @@
 namespace oclgrind
 {
   class Context;
+  class InterpreterCache;
   class Memory;
   class Kernel;
   class KernelInvocation;
@@ -56,7 +57,8 @@ namespace oclgrind
     };
 
   public:
-    WorkGroup(const KernelInvocation *kernelInvocation, Size3 wgid);
+    WorkGroup(const KernelInvocation *kernelInvocation,
+              const InterpreterCache *cache, Size3 wgid);
     virtual ~WorkGroup();
 
     size_t async_copy(
@@ -78,12 +80,17 @@ namespace oclgrind
     Memory* getLocalMemory() const;
     size_t getLocalMemoryAddress(const llvm::Value *value) const;
     WorkItem *getNextWorkItem() const;
+    std::vector<WorkItem*> getReadyWorkItems() const;
+    unsigned char* getRegisterFile() const;
+    unsigned char* getUniformFrame() const;
     WorkItem *getWorkItem(Size3 localID) const;
     bool hasBarrier() const;
+    bool isUniformComputed(unsigned index) const;
     void notifyBarrier(WorkItem *workItem, const llvm::Instruction *instruction,
                        uint64_t fence,
                        std::list<size_t> events=std::list<size_t>());
     void notifyFinished(WorkItem *workItem);
+    void setUniformComputed(unsigned index);
 
   private:
     size_t m_groupIndex;
@@ -95,6 +102,11 @@ namespace oclgrind
     std::map<const llvm::Value*,size_t> m_localAddresses;
 
     std::vector<WorkItem*> m_workItems;
+    unsigned char *m_registerFile;
+
+    // Values computed once and shared by every work-item in the group
+    unsigned char *m_uniformFrame;
+    std::vector<bool> m_uniformComputed;
 
     Barrier *m_barrier;
     size_t m_nextEvent;
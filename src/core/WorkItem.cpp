@@ -9,6 +9,7 @@
 #include "common.h"
 
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instruction.h"
@@ -17,7 +18,18 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/InstIterator.h"
 
+#include <algorithm>
+#include <exception>
+#include <type_traits>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
 #include "Context.h"
+#include "JITCompiler.h"
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
@@ -28,22 +40,73 @@
 using namespace oclgrind;
 using namespace std;
 
+// Size of the stack that each work-item runs native code on
+// Only the pages that are used are committed
+#define NATIVE_STACK_SIZE (1024*1024)
+
 struct WorkItem::Position
 {
   bool hasBegun;
-  llvm::Function::const_iterator       prevBlock;
-  llvm::Function::const_iterator       currBlock;
-  llvm::Function::const_iterator       nextBlock;
-  llvm::BasicBlock::const_iterator     currInst;
-  std::stack<const llvm::Instruction*> callStack;
-  std::stack< std::list<size_t> >      allocations;
+  unsigned                        prevBlock;
+  unsigned                        currInst;
+  unsigned                        nextInst;
+  std::stack<unsigned>            callStack;
+  std::stack< std::list<size_t> > allocations;
+};
+
+struct WorkItem::NativeState
+{
+  JITCompiler::KernelFunction kernel;
+  std::vector<unsigned char*> values;
+  std::exception_ptr error;
+#ifndef _WIN32
+  ucontext_t caller;
+  ucontext_t fiber;
+  void *stack;
+#endif
 };
 
+#ifndef _WIN32
+// Stacks released by finished work-items, kept for reuse by the thread
+// Each stack links to the next one just above its guard page
+static THREAD_LOCAL void *freeNativeStacks = NULL;
+
+static void* allocateNativeStack()
+{
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  void *stack = freeNativeStacks;
+  if (stack)
+  {
+    freeNativeStacks = *(void**)((char*)stack + pageSize);
+    return stack;
+  }
+
+  stack = mmap(NULL, NATIVE_STACK_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (stack == MAP_FAILED)
+  {
+    FATAL_ERROR("Failed to allocate native stack");
+  }
+
+  // Catch stack overflows with a guard page
+  mprotect(stack, pageSize, PROT_NONE);
+  return stack;
+}
+
+static void releaseNativeStack(void *stack)
+{
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  *(void**)((char*)stack + pageSize) = freeNativeStacks;
+  freeNativeStacks = stack;
+}
+#endif
+
 WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
-                   WorkGroup *workGroup, Size3 lid)
+                   WorkGroup *workGroup, const InterpreterCache *cache,
+                   Size3 lid)
   : m_context(kernelInvocation->getContext()),
     m_kernelInvocation(kernelInvocation),
-    m_workGroup(workGroup)
+    m_workGroup(workGroup), m_cache(cache)
 {
   m_localID = lid;
 
@@ -62,12 +125,59 @@ WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
 
   const Kernel *kernel = kernelInvocation->getKernel();
 
-  // Load interpreter cache
-  m_cache = kernel->getProgram()->getInterpreterCache(kernel->getFunction());
-
   // Set initial number of values to store based on cache
   m_values.resize(m_cache->getNumValues());
 
+  // Load constant operands
+  const InterpreterCache::ConstantList& constants = m_cache->getConstants();
+  for (auto itr = constants.begin(); itr != constants.end(); itr++)
+  {
+    m_values[itr->first] = itr->second;
+  }
+
+  // Give every instruction result and function parameter a fixed location,
+  // either in this work-item's lane of the work-group register file or in a
+  // frame of its own, so that storage does not grow as the kernel runs
+  unsigned char *registerFile = workGroup->getRegisterFile();
+  size_t numLanes = 1;
+  size_t lane = 0;
+  m_frame = NULL;
+  if (registerFile)
+  {
+    Size3 groupSize = workGroup->getGroupSize();
+    numLanes = groupSize.x*groupSize.y*groupSize.z;
+    lane = lid.x + (lid.y + lid.z*groupSize.y)*groupSize.x;
+  }
+  else
+  {
+    m_frame = new unsigned char[m_cache->getRegisterFrameSize()];
+    registerFile = m_frame;
+  }
+
+  const vector<InterpreterCache::Register>& registers =
+    m_cache->getRegisters();
+  for (auto itr = registers.begin(); itr != registers.end(); itr++)
+  {
+    TypedValue& value = m_values[itr->id];
+    value.size = itr->size;
+    value.num  = itr->num;
+    value.data = registerFile + itr->offset*numLanes +
+                 lane*itr->size*itr->num;
+  }
+
+  // Refer to the work-group's copy of uniform instruction results
+  unsigned char *uniformFrame = workGroup->getUniformFrame();
+  const vector<InterpreterCache::Register>& uniformRegisters =
+    m_cache->getUniformRegisters();
+  for (auto itr = uniformRegisters.begin();
+       itr != uniformRegisters.end(); itr++)
+  {
+    TypedValue& value = m_values[itr->id];
+    value.size = itr->size;
+    value.num  = itr->num;
+    value.data = uniformFrame + itr->offset;
+  }
+
   m_privateMemory = new Memory(AddrSpacePrivate, sizeof(size_t)==8 ? 32 : 16,
                                m_context);
 
@@ -80,7 +190,7 @@ WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
     TypedValue v = {
       size.first,
       size.second,
-      m_pool.alloc(size.first*size.second)
+      NULL
     };
 
     const llvm::Type *type = value->first->getType();
@@ -88,16 +198,20 @@ WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
         type->getPointerAddressSpace() == AddrSpacePrivate)
     {
       size_t sz = value->second.size*value->second.num;
+      v.data = m_pool.alloc(v.size*v.num);
       v.setPointer(m_privateMemory->allocateBuffer(sz, 0, value->second.data));
     }
     else if (type->isPointerTy() &&
              type->getPointerAddressSpace() == AddrSpaceLocal)
     {
+      v.data = m_pool.alloc(v.size*v.num);
       v.setPointer(m_workGroup->getLocalMemoryAddress(value->first));
     }
     else
     {
-      memcpy(v.data, value->second.data, v.size*v.num);
+      // The kernel's copy of the argument is not modified while it runs,
+      // so every work-item can share it
+      v.data = value->second.data;
     }
 
     setValue(value->first, v);
@@ -105,18 +219,62 @@ WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
 
   // Initialize interpreter state
   m_state    = READY;
+  m_yield    = false;
   m_position = new Position;
   m_position->hasBegun = false;
-  m_position->prevBlock = NULL;
-  m_position->nextBlock = NULL;
-  m_position->currBlock = kernel->getFunction()->begin();
-  m_position->currInst = m_position->currBlock->begin();
+  m_position->prevBlock = NO_OFFSET;
+  m_position->currInst = 0;
+  m_position->nextInst = 0;
+  m_builtinArgs = NULL;
+
+  // Evaluate constant expressions
+  // These only depend on constants and global variable addresses, so they
+  // can be resolved once rather than each time they are used
+  const vector<InterpreterCache::Instruction>& constExprs =
+    m_cache->getConstantExpressions();
+  for (auto itr = constExprs.begin(); itr != constExprs.end(); itr++)
+  {
+    TypedValue result =
+    {
+      itr->size,
+      itr->num,
+      m_pool.alloc(itr->size*itr->num)
+    };
+    dispatch(*itr, result);
+    m_values[itr->result] = result;
+  }
+
+  // Native code finds each value through a table of pointers to its data
+  m_native = NULL;
+  if (kernelInvocation->isNative())
+  {
+    m_native = new NativeState;
+    m_native->kernel = m_cache->getJIT()->getKernel();
+    m_native->values.resize(m_values.size());
+    for (unsigned i = 0; i < m_values.size(); i++)
+    {
+      m_native->values[i] = m_values[i].data;
+    }
+#ifndef _WIN32
+    m_native->stack = NULL;
+#endif
+  }
 }
 
 WorkItem::~WorkItem()
 {
+  if (m_native)
+  {
+#ifndef _WIN32
+    if (m_native->stack)
+      releaseNativeStack(m_native->stack);
+#endif
+    delete m_native;
+  }
+
   delete m_privateMemory;
   delete m_position;
+  delete[] m_frame;
 }
 
 void WorkItem::clearBarrier()
@@ -127,216 +285,170 @@ void WorkItem::clearBarrier()
   }
 }
 
-void WorkItem::dispatch(const llvm::Instruction *instruction,
-                        TypedValue& result)
-{
-  switch (instruction->getOpcode())
-  {
-  case llvm::Instruction::Add:
-    add(instruction, result);
-    break;
-  case llvm::Instruction::Alloca:
-    alloc(instruction, result);
-    break;
-  case llvm::Instruction::And:
-    bwand(instruction, result);
-    break;
-  case llvm::Instruction::AShr:
-    ashr(instruction, result);
-    break;
-  case llvm::Instruction::BitCast:
-    bitcast(instruction, result);
-    break;
-  case llvm::Instruction::Br:
-    br(instruction, result);
-    break;
-  case llvm::Instruction::Call:
-    call(instruction, result);
-    break;
-  case llvm::Instruction::ExtractElement:
-    extractelem(instruction, result);
-    break;
-  case llvm::Instruction::ExtractValue:
-    extractval(instruction, result);
-    break;
-  case llvm::Instruction::FAdd:
-    fadd(instruction, result);
-    break;
-  case llvm::Instruction::FCmp:
-    fcmp(instruction, result);
-    break;
-  case llvm::Instruction::FDiv:
-    fdiv(instruction, result);
-    break;
-  case llvm::Instruction::FMul:
-    fmul(instruction, result);
-    break;
-  case llvm::Instruction::FPExt:
-    fpext(instruction, result);
-    break;
-  case llvm::Instruction::FPToSI:
-    fptosi(instruction, result);
-    break;
-  case llvm::Instruction::FPToUI:
-    fptoui(instruction, result);
-    break;
-  case llvm::Instruction::FPTrunc:
-    fptrunc(instruction, result);
-    break;
-  case llvm::Instruction::FRem:
-    frem(instruction, result);
-    break;
-  case llvm::Instruction::FSub:
-    fsub(instruction, result);
-    break;
-  case llvm::Instruction::GetElementPtr:
-    gep(instruction, result);
-    break;
-  case llvm::Instruction::ICmp:
-    icmp(instruction, result);
-    break;
-  case llvm::Instruction::InsertElement:
-    insertelem(instruction, result);
-    break;
-  case llvm::Instruction::InsertValue:
-    insertval(instruction, result);
-    break;
-  case llvm::Instruction::IntToPtr:
-    inttoptr(instruction, result);
-    break;
-  case llvm::Instruction::Load:
-    load(instruction, result);
-    break;
-  case llvm::Instruction::LShr:
-    lshr(instruction, result);
-    break;
-  case llvm::Instruction::Mul:
-    mul(instruction, result);
-    break;
-  case llvm::Instruction::Or:
-    bwor(instruction, result);
-    break;
-  case llvm::Instruction::PHI:
-    phi(instruction, result);
-    break;
-  case llvm::Instruction::PtrToInt:
-    ptrtoint(instruction, result);
-    break;
-  case llvm::Instruction::Ret:
-    ret(instruction, result);
-    break;
-  case llvm::Instruction::SDiv:
-    sdiv(instruction, result);
-    break;
-  case llvm::Instruction::Select:
-    select(instruction, result);
-    break;
-  case llvm::Instruction::SExt:
-    sext(instruction, result);
-    break;
-  case llvm::Instruction::Shl:
-    shl(instruction, result);
-    break;
-  case llvm::Instruction::ShuffleVector:
-    shuffle(instruction, result);
-    break;
-  case llvm::Instruction::SIToFP:
-    sitofp(instruction, result);
-    break;
-  case llvm::Instruction::SRem:
-    srem(instruction, result);
-    break;
-  case llvm::Instruction::Store:
-    store(instruction, result);
-    break;
-  case llvm::Instruction::Sub:
-    sub(instruction, result);
-    break;
-  case llvm::Instruction::Switch:
-    swtch(instruction, result);
-    break;
-  case llvm::Instruction::Trunc:
-    itrunc(instruction, result);
-    break;
-  case llvm::Instruction::UDiv:
-    udiv(instruction, result);
-    break;
-  case llvm::Instruction::UIToFP:
-    uitofp(instruction, result);
-    break;
-  case llvm::Instruction::URem:
-    urem(instruction, result);
-    break;
-  case llvm::Instruction::Unreachable:
-    FATAL_ERROR("Encountered unreachable instruction");
-  case llvm::Instruction::Xor:
-    bwxor(instruction, result);
-    break;
-  case llvm::Instruction::ZExt:
-    zext(instruction, result);
-    break;
-  default:
-    FATAL_ERROR("Unsupported instruction: %s", instruction->getOpcodeName());
-  }
-}
-
-void WorkItem::execute(const llvm::Instruction *instruction)
+void WorkItem::beginInstruction(
+  const InterpreterCache::Instruction& instruction, TypedValue& result)
 {
-  // Prepare private variable for instruction result
-  pair<unsigned,unsigned> resultSize = getValueSize(instruction);
+  // Branches, calls and returns redirect nextInst
+  m_position->nextInst = m_position->currInst + 1;
 
   // Prepare result
-  TypedValue result = {
-    resultSize.first,
-    resultSize.second,
-    NULL
-  };
+  result.size = instruction.size;
+  result.num  = instruction.num;
+  result.data = NULL;
   if (result.size)
   {
-    result.data = m_pool.alloc(result.size*result.num);
+    // Results are written in place, except for PHI results, which are not
+    // visible until the whole group of PHIs completes
+    if (instruction.opcode != llvm::Instruction::PHI)
+      result.data = m_values[instruction.result].data;
+    else
+      result.data = m_scratch.alloc(result.size*result.num);
   }
 
-  if (instruction->getOpcode() != llvm::Instruction::PHI &&
-      m_phiTemps.size() > 0)
+  if (instruction.opcode != llvm::Instruction::PHI && !m_phiTemps.empty())
   {
-    TypedValueMap::iterator itr;
-    for (itr = m_phiTemps.begin(); itr != m_phiTemps.end(); itr++)
+    for (auto itr = m_phiTemps.begin(); itr != m_phiTemps.end(); itr++)
     {
-      setValue(itr->first, itr->second);
+      storeResult(itr->first, itr->second);
     }
     m_phiTemps.clear();
+    m_scratch.reset();
   }
+}
 
-  // Execute instruction
-  dispatch(instruction, result);
+void WorkItem::dispatch(const InterpreterCache::Instruction& instruction,
+                        TypedValue& result)
+{
+  switch (instruction.handler)
+  {
+#define INSTRUCTION(opcode, name)           \
+  case InterpreterCache::Handler##opcode:   \
+    name(instruction, result);              \
+    break;
+  INSTRUCTION_LIST(INSTRUCTION)
+  INSTRUCTION(Typed, typed)
+  INSTRUCTION(Uniform, uniform)
+#undef INSTRUCTION
+  default:
+    unsupported(instruction, result);
+  }
+}
 
+void WorkItem::endInstruction(
+  const InterpreterCache::Instruction& instruction, TypedValue& result)
+{
   // Store result
   if (result.size)
   {
-    if (instruction->getOpcode() != llvm::Instruction::PHI)
+    if (instruction.opcode != llvm::Instruction::PHI)
     {
-      setValue(instruction, result);
+      storeResult(instruction.result, result);
     }
     else
     {
-      m_phiTemps[instruction] = result;
+      m_phiTemps.push_back(make_pair(instruction.result, result));
+    }
+  }
+
+  if (m_context->hasInstructionPlugins(instruction.opcode))
+    m_context->notifyInstructionExecuted(this, instruction.instruction, result);
+}
+
+void WorkItem::execute(const InterpreterCache::Instruction& instruction)
+{
+  TypedValue result;
+  beginInstruction(instruction, result);
+  dispatch(instruction, result);
+  endInstruction(instruction, result);
+}
+
+void WorkItem::executeBatch(const InterpreterCache::Instruction& instruction,
+                            WorkItem *const *workItems, size_t num)
+{
+  assert(instruction.batch);
+
+  // Begin the instruction for every work-item, which also completes any
+  // PHI nodes that precede it
+  TypedValue result;
+  for (size_t i = 0; i < num; i++)
+  {
+    WorkItem *workItem = workItems[i];
+    if (!workItem->m_position->hasBegun)
+    {
+      workItem->m_position->hasBegun = true;
+      workItem->m_context->notifyWorkItemBegin(workItem);
+    }
+    workItem->beginInstruction(instruction, result);
+  }
+
+  // Shared operands are the same value for every lane
+  const WorkItem *first = workItems[0];
+  TypedValue opA = first->getOperand(instruction, 0);
+  TypedValue opB = first->getOperand(instruction, 1);
+  size_t strideA = (instruction.varying & 1) ? opA.size*opA.num : 0;
+  size_t strideB = (instruction.varying & 2) ? opB.size*opB.num : 0;
+  size_t stride  = instruction.size*instruction.num;
+
+  // Apply the batch handler to each run of work-items that occupy adjacent
+  // lanes of the register file
+  for (size_t i = 0; i < num;)
+  {
+    const WorkItem *workItem = workItems[i];
+    unsigned char *data = workItem->m_values[instruction.result].data;
+    size_t n = 1;
+    while (i + n < num &&
+           workItems[i+n]->m_values[instruction.result].data == data+n*stride)
+    {
+      n++;
     }
+
+    instruction.batch(workItem->getOperand(instruction, 0).data, strideA,
+                      workItem->getOperand(instruction, 1).data, strideB,
+                      data, n);
+    i += n;
   }
 
-  m_context->notifyInstructionExecuted(this, instruction, result);
+  // Results are already in place, so this only notifies plugins
+  for (size_t i = 0; i < num; i++)
+  {
+    WorkItem *workItem = workItems[i];
+    result.size = instruction.size;
+    result.num  = instruction.num;
+    result.data = workItem->m_values[instruction.result].data;
+    workItem->endInstruction(instruction, result);
+    workItem->m_position->currInst = workItem->m_position->nextInst;
+  }
 }
 
-const stack<const llvm::Instruction*>& WorkItem::getCallStack() const
+stack<const llvm::Instruction*> WorkItem::getCallStack() const
 {
-  return m_position->callStack;
+  // Rebuild call stack from instruction offsets
+  vector<unsigned> offsets;
+  for (stack<unsigned> calls = m_position->callStack;
+       !calls.empty(); calls.pop())
+  {
+    offsets.push_back(calls.top());
+  }
+
+  stack<const llvm::Instruction*> callStack;
+  for (auto itr = offsets.rbegin(); itr != offsets.rend(); itr++)
+  {
+    callStack.push(m_cache->getInstruction(*itr).instruction);
+  }
+  return callStack;
 }
 
 const llvm::BasicBlock* WorkItem::getCurrentBlock() const
 {
-  return m_position->currBlock;
+  return getCurrentInstruction()->getParent();
 }
 
 const llvm::Instruction* WorkItem::getCurrentInstruction() const
+{
+  return m_cache->getInstruction(m_position->currInst).instruction;
+}
+
+unsigned WorkItem::getCurrentOffset() const
 {
   return m_position->currInst;
 }
@@ -374,79 +486,20 @@ Memory* WorkItem::getMemory(unsigned int addrSpace) const
 
 TypedValue WorkItem::getOperand(const llvm::Value *operand) const
 {
-  unsigned valID = operand->getValueID();
-  if (valID == llvm::Value::ArgumentVal ||
-      valID == llvm::Value::GlobalVariableVal ||
-      valID >= llvm::Value::InstructionVal)
-  {
-    return getValue(operand);
-  }
-  //else if (valID == llvm::Value::BasicBlockVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::FunctionVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::GlobalAliasVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::BlockAddressVal)
-  //{
-  //}
-  else if (valID == llvm::Value::ConstantExprVal)
-  {
-    pair<unsigned,unsigned> size = getValueSize(operand);
-    TypedValue result;
-    result.size = size.first;
-    result.num  = size.second;
-    result.data = m_pool.alloc(getTypeSize(operand->getType()));
-
-    // Use of const_cast here is ugly, but ConstExpr instructions
-    // shouldn't actually modify WorkItem state anyway
-    const_cast<WorkItem*>(this)->dispatch(
-      m_cache->getConstantExpr(operand), result);
-    return result;
-  }
-  else if (valID == llvm::Value::UndefValueVal            ||
-           valID == llvm::Value::ConstantAggregateZeroVal ||
-           valID == llvm::Value::ConstantDataArrayVal     ||
-           valID == llvm::Value::ConstantDataVectorVal    ||
-           valID == llvm::Value::ConstantIntVal           ||
-           valID == llvm::Value::ConstantFPVal            ||
-           valID == llvm::Value::ConstantArrayVal         ||
-           valID == llvm::Value::ConstantStructVal        ||
-           valID == llvm::Value::ConstantVectorVal        ||
-           valID == llvm::Value::ConstantPointerNullVal)
-  {
-    return m_cache->getConstant(operand);
-  }
-  //else if (valID == llvm::Value::MDNodeVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::MDStringVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::InlineAsmVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::PseudoSourceValueVal)
-  //{
-  //}
-  //else if (valID == llvm::Value::FixedStackPseudoSourceValueVal)
-  //{
-  //}
-  else
-  {
-    FATAL_ERROR("Unhandled operand type: %d", valID);
-  }
-
-  // Unreachable
-  assert(false);
+  // Constants and constant expressions are resolved when the work-item is
+  // created, so all operands live in the value store
+  return getValue(operand);
 }
 
 const llvm::BasicBlock* WorkItem::getPreviousBlock() const
 {
-  return m_position->prevBlock;
+  if (m_position->prevBlock == NO_OFFSET)
+  {
+    return NULL;
+  }
+  const llvm::Instruction *terminator =
+    m_cache->getInstruction(m_position->prevBlock).instruction;
+  return terminator->getParent();
 }
 
 Memory* WorkItem::getPrivateMemory() const
@@ -482,7 +535,7 @@ const llvm::Value* WorkItem::getVariable(std::string name) const
     return itr->second;
 
   // Check global variables
-  string globalName = m_position->currBlock->getParent()->getName();
+  string globalName = getCurrentBlock()->getParent()->getName();
   globalName += ".";
   globalName += name;
   const llvm::Module *module =
@@ -508,6 +561,70 @@ bool WorkItem::hasValue(const llvm::Value *key) const
   return m_cache->hasValue(key);
 }
 
+#ifndef _WIN32
+void WorkItem::nativeCall(WorkItem *workItem, unsigned offset)
+{
+  // Native calls are tracked so that errors can report the call stack, and
+  // so that allocas are released when the callee returns
+  workItem->m_position->callStack.push(offset);
+  workItem->m_position->allocations.push(list<size_t>());
+}
+
+void WorkItem::nativeExecute(WorkItem *workItem, unsigned offset)
+{
+  NativeState *native = workItem->m_native;
+  try
+  {
+    workItem->m_position->currInst = offset;
+    workItem->execute(workItem->m_cache->getInstruction(offset));
+  }
+  catch (...)
+  {
+    // Exceptions can't unwind through native code, so abandon it and
+    // rethrow the exception once back on the work-group's stack
+    native->error = current_exception();
+  }
+
+  // Suspend the work-item at barriers until the work-group resumes it
+  if (native->error || workItem->m_state == BARRIER)
+    swapcontext(&native->fiber, &native->caller);
+}
+
+void WorkItem::nativeReturn(WorkItem *workItem)
+{
+  Position *position = workItem->m_position;
+  list<size_t>& allocs = position->allocations.top();
+  for (auto itr = allocs.begin(); itr != allocs.end(); itr++)
+  {
+    workItem->m_privateMemory->deallocateBuffer(*itr);
+  }
+  position->allocations.pop();
+  position->callStack.pop();
+}
+
+void WorkItem::nativeStart(unsigned high, unsigned low)
+{
+  // The work-item pointer is split in two, as context entry points only
+  // take int arguments
+  WorkItem *workItem = (WorkItem*)(uintptr_t)(((uint64_t)high << 32) | low);
+  NativeState *native = workItem->m_native;
+  native->kernel(workItem, native->values.data());
+
+  try
+  {
+    workItem->m_state = FINISHED;
+    workItem->m_workGroup->notifyFinished(workItem);
+  }
+  catch (...)
+  {
+    native->error = current_exception();
+  }
+
+  // The stack is released when the work-item is destroyed
+  swapcontext(&native->fiber, &native->caller);
+}
+#endif
+
 bool WorkItem::printValue(const llvm::Value *value) const
 {
   if (!hasValue(value))
@@ -556,51 +673,184 @@ void WorkItem::setValue(const llvm::Value *key, TypedValue value)
   m_values[m_cache->getValueID(key)] = value;
 }
 
-WorkItem::State WorkItem::step()
+void WorkItem::storeResult(unsigned id, const TypedValue& value)
+{
+  // Value locations are fixed, so copy the data into place
+  TypedValue& slot = m_values[id];
+  if (slot.data != value.data)
+    memcpy(slot.data, value.data, slot.size*slot.num);
+}
+
+// Use direct-threaded dispatch when the compiler supports labels-as-values
+#if defined(__GNUC__) && !defined(OCLGRIND_NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH 1
+#endif
+
+WorkItem::State WorkItem::run(unsigned stop)
 {
   assert(m_state == READY);
 
+#ifndef _WIN32
+  if (m_native)
+    return runNative();
+#endif
+
   if (!m_position->hasBegun)
   {
     m_position->hasBegun = true;
     m_context->notifyWorkItemBegin(this);
   }
 
-  // Execute the next instruction
-  execute(m_position->currInst);
+  const InterpreterCache::Instruction *instruction =
+    &m_cache->getInstruction(m_position->currInst);
+  TypedValue result;
+  beginInstruction(*instruction, result);
+
+  // Each handler completes its instruction and dispatches the next one
+  // directly, until the work-item hits a barrier, finishes, reaches the
+  // instruction at offset stop, or is asked to yield (e.g. by the
+  // interactive debugger switching work-items)
+#define ADVANCE()                                               \
+  if (m_state != READY || m_yield ||                            \
+      m_position->nextInst == stop)                             \
+    goto done;                                                  \
+  m_position->currInst = m_position->nextInst;                  \
+  instruction = &m_cache->getInstruction(m_position->currInst); \
+  beginInstruction(*instruction, result);                       \
+  DISPATCH();
+#define NEXT_INSTRUCTION()              \
+  endInstruction(*instruction, result); \
+  ADVANCE();
+
+#ifdef THREADED_DISPATCH
+  static const void *targets[] =
+  {
+#define INSTRUCTION(opcode, name) &&do_##name,
+    INSTRUCTION_LIST(INSTRUCTION)
+#undef INSTRUCTION
+    &&do_unsupported,
+    &&do_typed,
+    &&do_uniform,
+  };
+#define DISPATCH() goto *targets[instruction->handler]
+#define TARGET(opcode, name) do_##name:
 
-  // Check if we've reached the end of the block
-  if (++m_position->currInst == m_position->currBlock->end() ||
-      m_position->nextBlock)
+  DISPATCH();
+#else
+#define DISPATCH() continue
+#define TARGET(opcode, name) case InterpreterCache::Handler##opcode:
+
+  while (true)
   {
-    if (m_position->nextBlock)
+    switch (instruction->handler)
     {
-      // Move to next basic block
-      m_position->prevBlock = m_position->currBlock;
-      m_position->currBlock = m_position->nextBlock;
-      m_position->nextBlock = NULL;
-      m_position->currInst  = m_position->currBlock->begin();
+#endif
+
+#define INSTRUCTION(opcode, name) \
+  TARGET(opcode, name)            \
+  {                               \
+    name(*instruction, result);   \
+    NEXT_INSTRUCTION();           \
+  }
+  INSTRUCTION_LIST(INSTRUCTION)
+  INSTRUCTION(Unsupported, unsupported)
+  INSTRUCTION(Typed, typed)
+  INSTRUCTION(Uniform, uniform)
+#undef INSTRUCTION
+
+#ifndef THREADED_DISPATCH
     }
   }
+#endif
+
+#undef TARGET
+#undef DISPATCH
+#undef NEXT_INSTRUCTION
+#undef ADVANCE
+
+done:
+  m_yield = false;
+  if (m_state == FINISHED)
+    m_context->notifyWorkItemComplete(this);
+  else
+    m_position->currInst = m_position->nextInst;
+
+  return m_state;
+}
+
+#ifndef _WIN32
+WorkItem::State WorkItem::runNative()
+{
+  if (!m_position->hasBegun)
+  {
+    m_position->hasBegun = true;
+    m_context->notifyWorkItemBegin(this);
+
+    m_native->stack = allocateNativeStack();
+    getcontext(&m_native->fiber);
+    m_native->fiber.uc_stack.ss_sp   = m_native->stack;
+    m_native->fiber.uc_stack.ss_size = NATIVE_STACK_SIZE;
+    m_native->fiber.uc_link          = NULL;
+    uint64_t self = (uintptr_t)this;
+    makecontext(&m_native->fiber, (void(*)())nativeStart, 2,
+                (unsigned)(self >> 32), (unsigned)self);
+  }
+
+  // Run until the work-item finishes or reaches a barrier
+  swapcontext(&m_native->caller, &m_native->fiber);
+  if (m_native->error)
+  {
+    exception_ptr error = m_native->error;
+    m_native->error = nullptr;
+    rethrow_exception(error);
+  }
+
+  if (m_state == FINISHED)
+    m_context->notifyWorkItemComplete(this);
+
+  return m_state;
+}
+#endif
+
+WorkItem::State WorkItem::step()
+{
+  assert(m_state == READY);
+
+  if (!m_position->hasBegun)
+  {
+    m_position->hasBegun = true;
+    m_context->notifyWorkItemBegin(this);
+  }
+
+  // Execute the next instruction
+  execute(m_cache->getInstruction(m_position->currInst));
 
   if (m_state == FINISHED)
     m_context->notifyWorkItemComplete(this);
+  else
+    m_position->currInst = m_position->nextInst;
 
   return m_state;
 }
 
+void WorkItem::yield()
+{
+  m_yield = true;
+}
+
 
 ///////////////////////////////
 //// Instruction execution ////
 ///////////////////////////////
 
 #define INSTRUCTION(name) \
-  void WorkItem::name(const llvm::Instruction *instruction, TypedValue& result)
+  void WorkItem::name(const InterpreterCache::Instruction& instruction, \
+                      TypedValue& result)
 
 INSTRUCTION(add)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) + opB.getUInt(i), i);
@@ -609,7 +859,8 @@ INSTRUCTION(add)
 
 INSTRUCTION(alloc)
 {
-  const llvm::AllocaInst *allocInst = ((const llvm::AllocaInst*)instruction);
+  const llvm::AllocaInst *allocInst =
+    ((const llvm::AllocaInst*)instruction.instruction);
   const llvm::Type *type = allocInst->getAllocatedType();
 
   // Perform allocation
@@ -628,8 +879,8 @@ INSTRUCTION(alloc)
 
 INSTRUCTION(ashr)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -641,13 +892,14 @@ INSTRUCTION(ashr)
 
 INSTRUCTION(bitcast)
 {
-  const llvm::Value *op = instruction->getOperand(0);
+  const llvm::Instruction *castInst = instruction.instruction;
+  const llvm::Value *op = castInst->getOperand(0);
 
   // Check for address space casts
-  if (instruction->getType()->isPointerTy())
+  if (castInst->getType()->isPointerTy())
   {
     unsigned srcAddrSpace = op->getType()->getPointerAddressSpace();
-    unsigned dstAddrSpace = instruction->getType()->getPointerAddressSpace();
+    unsigned dstAddrSpace = castInst->getType()->getPointerAddressSpace();
     if (srcAddrSpace != dstAddrSpace)
     {
       FATAL_ERROR("Invalid pointer cast from %s to %s address spaces",
@@ -656,31 +908,30 @@ INSTRUCTION(bitcast)
     }
   }
 
-  TypedValue operand = getOperand(op);
+  TypedValue operand = getOperand(instruction, 0);
   memcpy(result.data, operand.data, result.size*result.num);
 }
 
 INSTRUCTION(br)
 {
-  if (instruction->getNumOperands() == 1)
+  m_position->prevBlock = m_position->currInst;
+  if (instruction.numTargets == 1)
   {
     // Unconditional branch
-    m_position->nextBlock = (const llvm::BasicBlock*)instruction->getOperand(0);
+    m_position->nextInst = instruction.targets[0];
   }
   else
   {
     // Conditional branch
-    bool pred = getOperand(instruction->getOperand(0)).getUInt();
-    const llvm::Value *iftrue = instruction->getOperand(2);
-    const llvm::Value *iffalse = instruction->getOperand(1);
-    m_position->nextBlock = (const llvm::BasicBlock*)(pred ? iftrue : iffalse);
+    bool pred = getOperand(instruction, 0).getUInt();
+    m_position->nextInst = instruction.targets[pred ? 0 : 1];
   }
 }
 
 INSTRUCTION(bwand)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) & opB.getUInt(i), i);
@@ -689,8 +940,8 @@ INSTRUCTION(bwand)
 
 INSTRUCTION(bwor)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) | opB.getUInt(i), i);
@@ -699,8 +950,8 @@ INSTRUCTION(bwor)
 
 INSTRUCTION(bwxor)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) ^ opB.getUInt(i), i);
@@ -709,7 +960,8 @@ INSTRUCTION(bwxor)
 
 INSTRUCTION(call)
 {
-  const llvm::CallInst *callInst = (const llvm::CallInst*)instruction;
+  const llvm::CallInst *callInst =
+    (const llvm::CallInst*)instruction.instruction;
   const llvm::Function *function = callInst->getCalledFunction();
 
   // Check for indirect function calls
@@ -722,19 +974,19 @@ INSTRUCTION(call)
   }
 
   // Check if function has definition
-  if (!function->isDeclaration())
+  if (instruction.numTargets)
   {
     m_position->callStack.push(m_position->currInst);
     m_position->allocations.push(list<size_t>());
-    m_position->nextBlock = function->begin();
+    m_position->nextInst = instruction.targets[0];
 
     // Set function arguments
-    llvm::Function::const_arg_iterator argItr;
-    for (argItr = function->arg_begin();
-         argItr != function->arg_end(); argItr++)
+    unsigned numArgs = instruction.numOperands / 2;
+    llvm::Function::const_arg_iterator argItr = function->arg_begin();
+    for (unsigned i = 0; i < numArgs; i++, argItr++)
     {
-      const llvm::Value *arg = callInst->getArgOperand(argItr->getArgNo());
-      TypedValue value = getOperand(arg);
+      TypedValue value = getOperand(instruction, i);
+      TypedValue& param = m_values[instruction.operands[numArgs + i]];
 
       if (argItr->hasByValAttr())
       {
@@ -745,18 +997,11 @@ INSTRUCTION(call)
         m_position->allocations.top().push_back(ptr);
 
         // Pass new allocation to function
-        TypedValue address =
-        {
-          sizeof(size_t),
-          1,
-          m_pool.alloc(sizeof(size_t))
-        };
-        address.setPointer(ptr);
-        setValue(argItr, address);
+        param.setPointer(ptr);
       }
       else
       {
-        setValue(argItr, m_pool.clone(value));
+        memcpy(param.data, value.data, param.size*param.num);
       }
     }
 
@@ -764,25 +1009,25 @@ INSTRUCTION(call)
   }
 
   // Call builtin function
-  InterpreterCache::Builtin builtin = m_cache->getBuiltin(function);
-  builtin.function.func(this, callInst,
-                        builtin.name, builtin.overload,
-                        result, builtin.function.op);
+  // Temporary buffers used by the previous builtin are no longer needed
+  m_scratch.reset();
+  m_builtinArgs = instruction.operands;
+  const Builtin *builtin = instruction.builtin;
+  builtin->function.func(this, callInst, *builtin,
+                         result, builtin->function.op);
 }
 
 INSTRUCTION(extractelem)
 {
-  const llvm::ExtractElementInst *extract =
-    (const llvm::ExtractElementInst*)instruction;
-  unsigned index     = getOperand(extract->getIndexOperand()).getUInt();
-  TypedValue operand = getOperand(extract->getVectorOperand());
+  unsigned index     = getOperand(instruction, 1).getUInt();
+  TypedValue operand = getOperand(instruction, 0);
   memcpy(result.data, operand.data + result.size*index, result.size);
 }
 
 INSTRUCTION(extractval)
 {
   const llvm::ExtractValueInst *extract =
-    (const llvm::ExtractValueInst*)instruction;
+    (const llvm::ExtractValueInst*)instruction.instruction;
   const llvm::Value *agg = extract->getAggregateOperand();
   llvm::ArrayRef<unsigned int> indices = extract->getIndices();
 
@@ -809,13 +1054,14 @@ INSTRUCTION(extractval)
   }
 
   // Copy target value to result
-  memcpy(result.data, getOperand(agg).data + offset, getTypeSize(type));
+  memcpy(result.data, getOperand(instruction, 0).data + offset,
+         getTypeSize(type));
 }
 
 INSTRUCTION(fadd)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) + opB.getFloat(i), i);
@@ -824,11 +1070,12 @@ INSTRUCTION(fadd)
 
 INSTRUCTION(fcmp)
 {
-  const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction;
+  const llvm::CmpInst *cmpInst =
+    (const llvm::CmpInst*)instruction.instruction;
   llvm::CmpInst::Predicate pred = cmpInst->getPredicate();
 
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
 
   uint64_t t = result.num > 1 ? -1 : 1;
   for (unsigned i = 0; i < result.num; i++)
@@ -888,8 +1135,8 @@ INSTRUCTION(fcmp)
 
 INSTRUCTION(fdiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) / opB.getFloat(i), i);
@@ -898,8 +1145,8 @@ INSTRUCTION(fdiv)
 
 INSTRUCTION(fmul)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) * opB.getFloat(i), i);
@@ -908,7 +1155,7 @@ INSTRUCTION(fmul)
 
 INSTRUCTION(fpext)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getFloat(i), i);
@@ -917,7 +1164,7 @@ INSTRUCTION(fpext)
 
 INSTRUCTION(fptosi)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setSInt((int64_t)op.getFloat(i), i);
@@ -926,7 +1173,7 @@ INSTRUCTION(fptosi)
 
 INSTRUCTION(fptoui)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt((uint64_t)op.getFloat(i), i);
@@ -935,8 +1182,8 @@ INSTRUCTION(fptoui)
 
 INSTRUCTION(frem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(fmod(opA.getFloat(i), opB.getFloat(i)), i);
@@ -945,7 +1192,7 @@ INSTRUCTION(frem)
 
 INSTRUCTION(fptrunc)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getFloat(i), i);
@@ -954,8 +1201,8 @@ INSTRUCTION(fptrunc)
 
 INSTRUCTION(fsub)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) - opB.getFloat(i), i);
@@ -965,18 +1212,16 @@ INSTRUCTION(fsub)
 INSTRUCTION(gep)
 {
   const llvm::GetElementPtrInst *gepInst =
-    (const llvm::GetElementPtrInst*)instruction;
+    (const llvm::GetElementPtrInst*)instruction.instruction;
 
   // Get base address
-  const llvm::Value *base = gepInst->getPointerOperand();
-  size_t address = getOperand(base).getPointer();
+  size_t address = getOperand(instruction, 0).getPointer();
   const llvm::Type *ptrType = gepInst->getPointerOperandType();
 
   // Iterate over indices
-  llvm::User::const_op_iterator opItr;
-  for (opItr = gepInst->idx_begin(); opItr != gepInst->idx_end(); opItr++)
+  for (unsigned i = 1; i < instruction.numOperands; i++)
   {
-    int64_t offset = getOperand(opItr->get()).getSInt();
+    int64_t offset = getOperand(instruction, i).getSInt();
 
     if (ptrType->isPointerTy())
     {
@@ -1016,11 +1261,12 @@ INSTRUCTION(gep)
 
 INSTRUCTION(icmp)
 {
-  const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction;
+  const llvm::CmpInst *cmpInst =
+    (const llvm::CmpInst*)instruction.instruction;
   llvm::CmpInst::Predicate pred = cmpInst->getPredicate();
 
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
 
   uint64_t t = result.num > 1 ? -1 : 1;
   for (unsigned i = 0; i < result.num; i++)
@@ -1074,9 +1320,9 @@ INSTRUCTION(icmp)
 
 INSTRUCTION(insertelem)
 {
-  TypedValue vector  = getOperand(instruction->getOperand(0));
-  TypedValue element = getOperand(instruction->getOperand(1));
-  unsigned index     = getOperand(instruction->getOperand(2)).getUInt();
+  TypedValue vector  = getOperand(instruction, 0);
+  TypedValue element = getOperand(instruction, 1);
+  unsigned index     = getOperand(instruction, 2).getUInt();
   memcpy(result.data, vector.data, result.size*result.num);
   memcpy(result.data + index*result.size, element.data, result.size);
 }
@@ -1084,11 +1330,11 @@ INSTRUCTION(insertelem)
 INSTRUCTION(insertval)
 {
   const llvm::InsertValueInst *insert =
-    (const llvm::InsertValueInst*)instruction;
+    (const llvm::InsertValueInst*)instruction.instruction;
 
   // Load original aggregate data
   const llvm::Value *agg = insert->getAggregateOperand();
-  memcpy(result.data, getOperand(agg).data, result.size*result.num);
+  memcpy(result.data, getOperand(instruction, 0).data, result.size*result.num);
 
   // Compute offset for inserted value
   int offset = 0;
@@ -1115,13 +1361,13 @@ INSTRUCTION(insertval)
 
   // Copy inserted value into result
   const llvm::Value *value = insert->getInsertedValueOperand();
-  memcpy(result.data + offset, getOperand(value).data,
+  memcpy(result.data + offset, getOperand(instruction, 1).data,
          getTypeSize(value->getType()));
 }
 
 INSTRUCTION(inttoptr)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setPointer(op.getUInt(i), i);
@@ -1130,7 +1376,7 @@ INSTRUCTION(inttoptr)
 
 INSTRUCTION(itrunc)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     memcpy(result.data+i*result.size, op.data+i*op.size, result.size);
@@ -1139,10 +1385,11 @@ INSTRUCTION(itrunc)
 
 INSTRUCTION(load)
 {
-  const llvm::LoadInst *loadInst = (const llvm::LoadInst*)instruction;
+  const llvm::LoadInst *loadInst =
+    (const llvm::LoadInst*)instruction.instruction;
   unsigned addressSpace = loadInst->getPointerAddressSpace();
   const llvm::Value *opPtr = loadInst->getPointerOperand();
-  size_t address = getOperand(opPtr).getPointer();
+  size_t address = getOperand(instruction, 0).getPointer();
 
   // Check address is correctly aligned
   unsigned alignment = loadInst->getAlignment();
@@ -1160,8 +1407,8 @@ INSTRUCTION(load)
 
 INSTRUCTION(lshr)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -1173,8 +1420,8 @@ INSTRUCTION(lshr)
 
 INSTRUCTION(mul)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) * opB.getUInt(i), i);
@@ -1183,15 +1430,22 @@ INSTRUCTION(mul)
 
 INSTRUCTION(phi)
 {
-  const llvm::PHINode *phiNode = (const llvm::PHINode*)instruction;
-  const llvm::Value *value = phiNode->getIncomingValueForBlock(
-    (const llvm::BasicBlock*)m_position->prevBlock);
-  memcpy(result.data, getOperand(value).data, result.size*result.num);
+  // Find incoming value for the block we branched from
+  for (unsigned i = 0; i < instruction.numTargets; i++)
+  {
+    if (instruction.targets[i] == m_position->prevBlock)
+    {
+      memcpy(result.data, getOperand(instruction, i).data,
+             result.size*result.num);
+      return;
+    }
+  }
+  FATAL_ERROR("PHI node has no incoming value for previous block");
 }
 
 INSTRUCTION(ptrtoint)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(op.getPointer(i), i);
@@ -1200,19 +1454,17 @@ INSTRUCTION(ptrtoint)
 
 INSTRUCTION(ret)
 {
-  const llvm::ReturnInst *retInst = (const llvm::ReturnInst*)instruction;
-
   if (!m_position->callStack.empty())
   {
-    m_position->currInst = m_position->callStack.top();
-    m_position->currBlock = m_position->currInst->getParent();
+    unsigned callInst = m_position->callStack.top();
+    m_position->nextInst = callInst + 1;
     m_position->callStack.pop();
 
     // Set return value
-    const llvm::Value *returnVal = retInst->getReturnValue();
-    if (returnVal)
+    if (instruction.numOperands)
     {
-      setValue(m_position->currInst, m_pool.clone(getOperand(returnVal)));
+      storeResult(m_cache->getInstruction(callInst).result,
+                  getOperand(instruction, 0));
     }
 
     // Clear stack allocations
@@ -1226,7 +1478,6 @@ INSTRUCTION(ret)
   }
   else
   {
-    m_position->nextBlock = NULL;
     m_state = FINISHED;
     m_workGroup->notifyFinished(this);
   }
@@ -1234,8 +1485,8 @@ INSTRUCTION(ret)
 
 INSTRUCTION(sdiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t a = opA.getSInt(i);
@@ -1251,27 +1502,24 @@ INSTRUCTION(sdiv)
 
 INSTRUCTION(select)
 {
-  const llvm::SelectInst *selectInst = (const llvm::SelectInst*)instruction;
-  TypedValue opCondition = getOperand(selectInst->getCondition());
+  TypedValue opCondition = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     const bool cond =
-      selectInst->getCondition()->getType()->isVectorTy() ?
+      opCondition.num > 1 ?
       opCondition.getUInt(i) :
       opCondition.getUInt();
-    const llvm::Value *op = cond ?
-      selectInst->getTrueValue() :
-      selectInst->getFalseValue();
+    const TypedValue op = getOperand(instruction, cond ? 1 : 2);
     memcpy(result.data + i*result.size,
-           getOperand(op).data + i*result.size,
+           op.data + i*result.size,
            result.size);
   }
 }
 
 INSTRUCTION(sext)
 {
-  const llvm::Value *operand = instruction->getOperand(0);
-  TypedValue value = getOperand(operand);
+  const llvm::Value *operand = instruction.instruction->getOperand(0);
+  TypedValue value = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t val = value.getSInt(i);
@@ -1285,8 +1533,8 @@ INSTRUCTION(sext)
 
 INSTRUCTION(shl)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -1299,13 +1547,13 @@ INSTRUCTION(shl)
 INSTRUCTION(shuffle)
 {
   const llvm::ShuffleVectorInst *shuffle =
-    (const llvm::ShuffleVectorInst*)instruction;
+    (const llvm::ShuffleVectorInst*)instruction.instruction;
 
-  const llvm::Value *v1 = shuffle->getOperand(0);
-  const llvm::Value *v2 = shuffle->getOperand(1);
-  TypedValue mask = getOperand(shuffle->getMask());
+  TypedValue v1 = getOperand(instruction, 0);
+  TypedValue v2 = getOperand(instruction, 1);
+  TypedValue mask = getOperand(instruction, 2);
 
-  unsigned num = v1->getType()->getVectorNumElements();
+  unsigned num = v1.num;
   for (unsigned i = 0; i < result.num; i++)
   {
     if (shuffle->getMask()->getAggregateElement(i)->getValueID()
@@ -1315,21 +1563,21 @@ INSTRUCTION(shuffle)
       continue;
     }
 
-    const llvm::Value *src = v1;
+    const TypedValue *src = &v1;
     unsigned int index = mask.getUInt(i);
     if (index >= num)
     {
       index -= num;
-      src = v2;
+      src = &v2;
     }
     memcpy(result.data + i*result.size,
-           getOperand(src).data + index*result.size, result.size);
+           src->data + index*result.size, result.size);
   }
 }
 
 INSTRUCTION(sitofp)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getSInt(i), i);
@@ -1338,8 +1586,8 @@ INSTRUCTION(sitofp)
 
 INSTRUCTION(srem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t a = opA.getSInt(i);
@@ -1355,10 +1603,11 @@ INSTRUCTION(srem)
 
 INSTRUCTION(store)
 {
-  const llvm::StoreInst *storeInst = (const llvm::StoreInst*)instruction;
+  const llvm::StoreInst *storeInst =
+    (const llvm::StoreInst*)instruction.instruction;
   unsigned addressSpace = storeInst->getPointerAddressSpace();
   const llvm::Value *opPtr = storeInst->getPointerOperand();
-  size_t address = getOperand(opPtr).getPointer();
+  size_t address = getOperand(instruction, 1).getPointer();
 
   // Check address is correctly aligned
   unsigned alignment = storeInst->getAlignment();
@@ -1371,15 +1620,15 @@ INSTRUCTION(store)
   }
 
   // Store data
-  TypedValue operand = getOperand(storeInst->getValueOperand());
+  TypedValue operand = getOperand(instruction, 0);
   getMemory(addressSpace)->store(operand.data, address,
                                  operand.size*operand.num);
 }
 
 INSTRUCTION(sub)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) - opB.getUInt(i), i);
@@ -1388,18 +1637,32 @@ INSTRUCTION(sub)
 
 INSTRUCTION(swtch)
 {
-  const llvm::SwitchInst *swtch = (const llvm::SwitchInst*)instruction;
-  const llvm::Value *cond = swtch->getCondition();
-  uint64_t val = getOperand(cond).getUInt();
-  const llvm::ConstantInt *cval =
-    (const llvm::ConstantInt*)llvm::ConstantInt::get(cond->getType(), val);
-  m_position->nextBlock = swtch->findCaseValue(cval).getCaseSuccessor();
+  // Operand 0 is the condition, followed by the case values
+  // Target 0 is the default destination, followed by the case destinations
+  uint64_t val = getOperand(instruction, 0).getUInt();
+  m_position->prevBlock = m_position->currInst;
+  m_position->nextInst = instruction.targets[0];
+  for (unsigned i = 1; i < instruction.numOperands; i++)
+  {
+    if (getOperand(instruction, i).getUInt() == val)
+    {
+      m_position->nextInst = instruction.targets[i];
+      break;
+    }
+  }
+}
+
+INSTRUCTION(typed)
+{
+  instruction.typed(getOperand(instruction, 0).data,
+                    getOperand(instruction, 1).data,
+                    result.data);
 }
 
 INSTRUCTION(udiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t a = opA.getUInt(i);
@@ -1410,7 +1673,7 @@ INSTRUCTION(udiv)
 
 INSTRUCTION(uitofp)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t in = op.getUInt(i);
@@ -1421,10 +1684,32 @@ INSTRUCTION(uitofp)
   }
 }
 
+INSTRUCTION(uniform)
+{
+  // The result is shared by the whole work-group, so only the first
+  // work-item to reach the instruction needs to compute it
+  if (!m_workGroup->isUniformComputed(instruction.uniform))
+  {
+    dispatch(m_cache->getUniformInstruction(instruction.uniform), result);
+    m_workGroup->setUniformComputed(instruction.uniform);
+  }
+}
+
+INSTRUCTION(unreachable)
+{
+  FATAL_ERROR("Encountered unreachable instruction");
+}
+
+INSTRUCTION(unsupported)
+{
+  FATAL_ERROR("Unsupported instruction: %s",
+              instruction.instruction->getOpcodeName());
+}
+
 INSTRUCTION(urem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = getOperand(instruction, 0);
+  TypedValue opB = getOperand(instruction, 1);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t a = opA.getUInt(i);
@@ -1435,7 +1720,7 @@ INSTRUCTION(urem)
 
 INSTRUCTION(zext)
 {
-  TypedValue operand = getOperand(instruction->getOperand(0));
+  TypedValue operand = getOperand(instruction, 0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(operand.getUInt(i), i);
@@ -1445,8 +1730,380 @@ INSTRUCTION(zext)
 #undef INSTRUCTION
 
 
-////////////////////////////////
-// WorkItem::InterpreterCache //
+///////////////////////////////////
+//// Type-specialized handlers ////
+///////////////////////////////////
+
+// These implement common arithmetic and comparison instructions for a fixed
+// element type and vector width, so that the inner loops have no per-element
+// size checks and can be unrolled or vectorized by the compiler. Integer
+// operations are computed on 64-bit values and truncated, to match the
+// generic handlers.
+
+namespace
+{
+  typedef InterpreterCache::TypedHandler TypedHandler;
+  typedef InterpreterCache::BatchHandler BatchHandler;
+
+  // Scalar shifts are masked to at least 32 bits, as in the generic handlers
+  template<typename T, unsigned N>
+  struct ShiftMask
+  {
+    static const uint64_t value =
+      (N > 1 || sizeof(T) > 4 ? sizeof(T) : 4) * 8 - 1;
+  };
+
+#define INTEGER_OP(name, expr)                          \
+  struct name                                           \
+  {                                                     \
+    template<typename T, unsigned N>                    \
+    static T apply(T a, T b)                            \
+    {                                                   \
+      return (T)(expr);                                 \
+    }                                                   \
+  };
+  INTEGER_OP(AddOp,  (uint64_t)a + (uint64_t)b)
+  INTEGER_OP(SubOp,  (uint64_t)a - (uint64_t)b)
+  INTEGER_OP(MulOp,  (uint64_t)a * (uint64_t)b)
+  INTEGER_OP(AndOp,  a & b)
+  INTEGER_OP(OrOp,   a | b)
+  INTEGER_OP(XorOp,  a ^ b)
+  INTEGER_OP(ShlOp,  (uint64_t)a << ((uint64_t)b & ShiftMask<T,N>::value))
+  INTEGER_OP(LShrOp, (uint64_t)a >> ((uint64_t)b & ShiftMask<T,N>::value))
+#undef INTEGER_OP
+
+  struct AShrOp
+  {
+    template<typename T, unsigned N>
+    static T apply(T a, T b)
+    {
+      typedef typename make_signed<T>::type S;
+      return (T)((int64_t)(S)a >> ((uint64_t)b & ShiftMask<T,N>::value));
+    }
+  };
+
+#define FLOAT_OP(name, op)                              \
+  struct name                                           \
+  {                                                     \
+    template<typename T, unsigned N>                    \
+    static T apply(T a, T b)                            \
+    {                                                   \
+      return a op b;                                    \
+    }                                                   \
+  };
+  FLOAT_OP(FAddOp, +)
+  FLOAT_OP(FSubOp, -)
+  FLOAT_OP(FMulOp, *)
+  FLOAT_OP(FDivOp, /)
+#undef FLOAT_OP
+
+#define COMPARE_OP(name, op)                            \
+  struct name                                           \
+  {                                                     \
+    template<typename T>                                \
+    static bool apply(T a, T b)                         \
+    {                                                   \
+      return a op b;                                    \
+    }                                                   \
+  };
+  COMPARE_OP(EqualOp,        ==)
+  COMPARE_OP(NotEqualOp,     !=)
+  COMPARE_OP(GreaterOp,      >)
+  COMPARE_OP(GreaterEqualOp, >=)
+  COMPARE_OP(LessOp,         <)
+  COMPARE_OP(LessEqualOp,    <=)
+#undef COMPARE_OP
+
+  // Floating point comparison, where NaN operands make ordered comparisons
+  // false and unordered comparisons true
+  template<typename Compare, bool Ordered>
+  struct FCmpOp
+  {
+    template<typename T>
+    static bool apply(T a, T b)
+    {
+      if (::isnan((double)a) || ::isnan((double)b))
+        return !Ordered;
+      return Compare::apply(a, b);
+    }
+  };
+
+  template<typename T, unsigned N, typename Op>
+  struct BinaryKernel
+  {
+    static void apply(const unsigned char *opA, const unsigned char *opB,
+                      unsigned char *result)
+    {
+      const T *a = (const T*)opA;
+      const T *b = (const T*)opB;
+      T *r = (T*)result;
+      for (unsigned i = 0; i < N; i++)
+      {
+        r[i] = Op::template apply<T,N>(a[i], b[i]);
+      }
+    }
+  };
+
+  template<typename T, unsigned N, typename Op>
+  struct CompareKernel
+  {
+    static void apply(const unsigned char *opA, const unsigned char *opB,
+                      unsigned char *result)
+    {
+      // Vector comparisons produce all bits set for true
+      const uint8_t t = N > 1 ? 0xFF : 1;
+      const T *a = (const T*)opA;
+      const T *b = (const T*)opB;
+      uint8_t *r = (uint8_t*)result;
+      for (unsigned i = 0; i < N; i++)
+      {
+        r[i] = Op::apply(a[i], b[i]) ? t : 0;
+      }
+    }
+  };
+
+  // Batch kernels apply an operation to each of numLanes consecutive lanes
+  // When both operands vary across lanes, the lanes form one flat array
+  // that the compiler can vectorize for the host's SIMD units
+  template<typename T, unsigned N, typename Op>
+  struct BinaryBatchKernel
+  {
+    static void apply(const unsigned char *opA, size_t strideA,
+                      const unsigned char *opB, size_t strideB,
+                      unsigned char *result, size_t numLanes)
+    {
+      const T *a = (const T*)opA;
+      const T *b = (const T*)opB;
+      T *r = (T*)result;
+      if (strideA && strideB)
+      {
+        for (size_t i = 0; i < numLanes*N; i++)
+        {
+          r[i] = Op::template apply<T,N>(a[i], b[i]);
+        }
+        return;
+      }
+
+      size_t sa = strideA ? N : 0;
+      size_t sb = strideB ? N : 0;
+      for (size_t l = 0; l < numLanes; l++)
+      {
+        for (unsigned i = 0; i < N; i++)
+        {
+          r[l*N + i] = Op::template apply<T,N>(a[l*sa + i], b[l*sb + i]);
+        }
+      }
+    }
+  };
+
+  template<typename T, unsigned N, typename Op>
+  struct CompareBatchKernel
+  {
+    static void apply(const unsigned char *opA, size_t strideA,
+                      const unsigned char *opB, size_t strideB,
+                      unsigned char *result, size_t numLanes)
+    {
+      const uint8_t t = N > 1 ? 0xFF : 1;
+      const T *a = (const T*)opA;
+      const T *b = (const T*)opB;
+      uint8_t *r = (uint8_t*)result;
+      if (strideA && strideB)
+      {
+        for (size_t i = 0; i < numLanes*N; i++)
+        {
+          r[i] = Op::apply(a[i], b[i]) ? t : 0;
+        }
+        return;
+      }
+
+      size_t sa = strideA ? N : 0;
+      size_t sb = strideB ? N : 0;
+      for (size_t l = 0; l < numLanes; l++)
+      {
+        for (unsigned i = 0; i < N; i++)
+        {
+          r[l*N + i] = Op::apply(a[l*sa + i], b[l*sb + i]) ? t : 0;
+        }
+      }
+    }
+  };
+
+  template<typename H, template<typename,unsigned,typename> class Kernel,
+           typename T, typename Op>
+  H selectWidth(unsigned num)
+  {
+    switch (num)
+    {
+    case 1:
+      return Kernel<T,1,Op>::apply;
+    case 2:
+      return Kernel<T,2,Op>::apply;
+    case 3:
+      return Kernel<T,3,Op>::apply;
+    case 4:
+      return Kernel<T,4,Op>::apply;
+    case 8:
+      return Kernel<T,8,Op>::apply;
+    case 16:
+      return Kernel<T,16,Op>::apply;
+    default:
+      return NULL;
+    }
+  }
+
+  template<typename H, template<typename,unsigned,typename> class Kernel,
+           typename Op, bool Signed>
+  H selectInteger(pair<unsigned,unsigned> size)
+  {
+    switch (size.first)
+    {
+    case 1:
+      return selectWidth<H, Kernel,
+        typename conditional<Signed,int8_t,uint8_t>::type, Op>(size.second);
+    case 2:
+      return selectWidth<H, Kernel,
+        typename conditional<Signed,int16_t,uint16_t>::type, Op>(size.second);
+    case 4:
+      return selectWidth<H, Kernel,
+        typename conditional<Signed,int32_t,uint32_t>::type, Op>(size.second);
+    case 8:
+      return selectWidth<H, Kernel,
+        typename conditional<Signed,int64_t,uint64_t>::type, Op>(size.second);
+    default:
+      return NULL;
+    }
+  }
+
+  template<typename H, template<typename,unsigned,typename> class Kernel,
+           typename Op>
+  H selectFloat(pair<unsigned,unsigned> size)
+  {
+    switch (size.first)
+    {
+    case 4:
+      return selectWidth<H, Kernel, float, Op>(size.second);
+    case 8:
+      return selectWidth<H, Kernel, double, Op>(size.second);
+    default:
+      return NULL;
+    }
+  }
+
+  // Select an implementation of an instruction for its operand types, using
+  // the Binary and Compare kernel templates
+  template<typename H,
+           template<typename,unsigned,typename> class Binary,
+           template<typename,unsigned,typename> class Compare>
+  H getTypedHandler(const llvm::Instruction *instruction)
+  {
+    if (instruction->getNumOperands() != 2)
+    {
+      return NULL;
+    }
+
+    // Select on the operand type, since comparisons produce booleans
+    pair<unsigned,unsigned> size = getValueSize(instruction->getOperand(0));
+    if (instruction->getOperand(0)->getType()->getScalarSizeInBits() == 1)
+    {
+      // Leave boolean arithmetic to the generic handlers
+      if (instruction->getOpcode() != llvm::Instruction::ICmp)
+        return NULL;
+    }
+
+    switch (instruction->getOpcode())
+    {
+    case llvm::Instruction::Add:
+      return selectInteger<H, Binary, AddOp, false>(size);
+    case llvm::Instruction::Sub:
+      return selectInteger<H, Binary, SubOp, false>(size);
+    case llvm::Instruction::Mul:
+      return selectInteger<H, Binary, MulOp, false>(size);
+    case llvm::Instruction::And:
+      return selectInteger<H, Binary, AndOp, false>(size);
+    case llvm::Instruction::Or:
+      return selectInteger<H, Binary, OrOp, false>(size);
+    case llvm::Instruction::Xor:
+      return selectInteger<H, Binary, XorOp, false>(size);
+    case llvm::Instruction::Shl:
+      return selectInteger<H, Binary, ShlOp, false>(size);
+    case llvm::Instruction::LShr:
+      return selectInteger<H, Binary, LShrOp, false>(size);
+    case llvm::Instruction::AShr:
+      return selectInteger<H, Binary, AShrOp, false>(size);
+    case llvm::Instruction::FAdd:
+      return selectFloat<H, Binary, FAddOp>(size);
+    case llvm::Instruction::FSub:
+      return selectFloat<H, Binary, FSubOp>(size);
+    case llvm::Instruction::FMul:
+      return selectFloat<H, Binary, FMulOp>(size);
+    case llvm::Instruction::FDiv:
+      return selectFloat<H, Binary, FDivOp>(size);
+    case llvm::Instruction::ICmp:
+      switch (((const llvm::CmpInst*)instruction)->getPredicate())
+      {
+      case llvm::CmpInst::ICMP_EQ:
+        return selectInteger<H, Compare, EqualOp, false>(size);
+      case llvm::CmpInst::ICMP_NE:
+        return selectInteger<H, Compare, NotEqualOp, false>(size);
+      case llvm::CmpInst::ICMP_UGT:
+        return selectInteger<H, Compare, GreaterOp, false>(size);
+      case llvm::CmpInst::ICMP_UGE:
+        return selectInteger<H, Compare, GreaterEqualOp, false>(size);
+      case llvm::CmpInst::ICMP_ULT:
+        return selectInteger<H, Compare, LessOp, false>(size);
+      case llvm::CmpInst::ICMP_ULE:
+        return selectInteger<H, Compare, LessEqualOp, false>(size);
+      case llvm::CmpInst::ICMP_SGT:
+        return selectInteger<H, Compare, GreaterOp, true>(size);
+      case llvm::CmpInst::ICMP_SGE:
+        return selectInteger<H, Compare, GreaterEqualOp, true>(size);
+      case llvm::CmpInst::ICMP_SLT:
+        return selectInteger<H, Compare, LessOp, true>(size);
+      case llvm::CmpInst::ICMP_SLE:
+        return selectInteger<H, Compare, LessEqualOp, true>(size);
+      default:
+        return NULL;
+      }
+    case llvm::Instruction::FCmp:
+      switch (((const llvm::CmpInst*)instruction)->getPredicate())
+      {
+      case llvm::CmpInst::FCMP_OEQ:
+        return selectFloat<H, Compare, FCmpOp<EqualOp,true> >(size);
+      case llvm::CmpInst::FCMP_UEQ:
+        return selectFloat<H, Compare, FCmpOp<EqualOp,false> >(size);
+      case llvm::CmpInst::FCMP_ONE:
+        return selectFloat<H, Compare, FCmpOp<NotEqualOp,true> >(size);
+      case llvm::CmpInst::FCMP_UNE:
+        return selectFloat<H, Compare, FCmpOp<NotEqualOp,false> >(size);
+      case llvm::CmpInst::FCMP_OGT:
+        return selectFloat<H, Compare, FCmpOp<GreaterOp,true> >(size);
+      case llvm::CmpInst::FCMP_UGT:
+        return selectFloat<H, Compare, FCmpOp<GreaterOp,false> >(size);
+      case llvm::CmpInst::FCMP_OGE:
+        return selectFloat<H, Compare, FCmpOp<GreaterEqualOp,true> >(size);
+      case llvm::CmpInst::FCMP_UGE:
+        return selectFloat<H, Compare,
+                           FCmpOp<GreaterEqualOp,false> >(size);
+      case llvm::CmpInst::FCMP_OLT:
+        return selectFloat<H, Compare, FCmpOp<LessOp,true> >(size);
+      case llvm::CmpInst::FCMP_ULT:
+        return selectFloat<H, Compare, FCmpOp<LessOp,false> >(size);
+      case llvm::CmpInst::FCMP_OLE:
+        return selectFloat<H, Compare, FCmpOp<LessEqualOp,true> >(size);
+      case llvm::CmpInst::FCMP_ULE:
+        return selectFloat<H, Compare, FCmpOp<LessEqualOp,false> >(size);
+      default:
+        return NULL;
+      }
+    default:
+      return NULL;
+    }
+  }
+}
+
+
+////////////////////////////////
+// WorkItem::InterpreterCache //
 ////////////////////////////////
 
 InterpreterCache::InterpreterCache(llvm::Function *kernel)
@@ -1466,6 +2123,7 @@ InterpreterCache::InterpreterCache(llvm::Function *kernel)
 
   set<llvm::Function*> processed;
   set<llvm::Function*> pending;
+  vector<llvm::Function*> functions;
 
   pending.insert(kernel);
 
@@ -1475,6 +2133,7 @@ InterpreterCache::InterpreterCache(llvm::Function *kernel)
     llvm::Function *function = *pending.begin();
     processed.insert(function);
     pending.erase(function);
+    functions.push_back(function);
 
     // Iterate through the function arguments
     llvm::Function::arg_iterator A;
@@ -1511,15 +2170,175 @@ InterpreterCache::InterpreterCache(llvm::Function *kernel)
       for (llvm::User::value_op_iterator O = I->value_op_begin();
            O != I->value_op_end(); O++)
       {
+        // Callees are resolved when the call is decoded
+        if (I->getOpcode() == llvm::Instruction::Call &&
+            *O == ((const llvm::CallInst*)&*I)->getCalledValue())
+        {
+          continue;
+        }
+
         addOperand(*O);
       }
     }
   }
+
+  // Lay out basic blocks in the instruction array
+  // The kernel is processed first, so its entry block is at offset zero
+  BlockMap blockStarts, blockEnds;
+  unsigned offset = 0;
+  for (auto F = functions.begin(); F != functions.end(); F++)
+  {
+    for (auto B = (*F)->begin(); B != (*F)->end(); B++)
+    {
+      blockStarts[&*B] = offset;
+      offset += B->size();
+      blockEnds[&*B] = offset - 1;
+    }
+  }
+
+  // Decode instructions
+  vector< pair<size_t,size_t> > ranges;
+  m_instructions.reserve(offset);
+  for (auto F = functions.begin(); F != functions.end(); F++)
+  {
+    llvm::DominatorTreeBase<llvm::BasicBlock> postDominators(true);
+    postDominators.recalculate(**F);
+
+    llvm::inst_iterator I;
+    for (I = inst_begin(*F); I != inst_end(*F); I++)
+    {
+      m_offsets[&*I] = m_instructions.size();
+      m_instructions.push_back(decode(&*I, blockStarts, blockEnds, ranges));
+
+      // Record where diverging control flow reconverges
+      if (I->getOpcode() == llvm::Instruction::Br ||
+          I->getOpcode() == llvm::Instruction::Switch)
+      {
+        llvm::DomTreeNodeBase<llvm::BasicBlock> *node =
+          postDominators.getNode(I->getParent());
+        if (node && node->getIDom() && node->getIDom()->getBlock())
+        {
+          m_instructions.back().reconverge =
+            blockStarts.at(node->getIDom()->getBlock());
+        }
+      }
+    }
+  }
+
+  // Decode constant expressions, in the order that they depend on each other
+  for (auto E = m_constExprOrder.begin(); E != m_constExprOrder.end(); E++)
+  {
+    Instruction expr =
+      decode(m_constExpressions[*E], blockStarts, blockEnds, ranges);
+    expr.result = getValueID(*E);
+    m_constExprCode.push_back(expr);
+  }
+
+  // Now that the slot array is complete, resolve operand and target pointers
+  for (unsigned i = 0; i < m_instructions.size(); i++)
+  {
+    m_instructions[i].operands = m_slots.data() + ranges[i].first;
+    m_instructions[i].targets  = m_slots.data() + ranges[i].second;
+  }
+  for (unsigned i = 0; i < m_constExprCode.size(); i++)
+  {
+    size_t r = m_instructions.size() + i;
+    m_constExprCode[i].operands = m_slots.data() + ranges[r].first;
+    m_constExprCode[i].targets  = m_slots.data() + ranges[r].second;
+  }
+
+  // Share results that are the same across a work-group between work-items
+  findUniformInstructions(kernel);
+
+  // Assign each instruction result and the parameters of each called
+  // function a fixed location in the register frame, following the order
+  // of value IDs (OpenCL C forbids recursion, so one location is enough)
+  for (auto I = m_instructions.begin(); I != m_instructions.end(); I++)
+  {
+    // Uniform results live in the work-group's shared frame instead
+    if (I->size && I->handler != HandlerUniform)
+    {
+      Register reg = {I->result, I->size, I->num, 0};
+      m_registers.push_back(reg);
+    }
+  }
+  for (auto F = functions.begin() + 1; F != functions.end(); F++)
+  {
+    for (auto A = (*F)->arg_begin(); A != (*F)->arg_end(); A++)
+    {
+      pair<unsigned,unsigned> size = getValueSize(A);
+      Register reg = {getValueID(A), size.first, size.second, 0};
+      m_registers.push_back(reg);
+    }
+  }
+  sort(m_registers.begin(), m_registers.end(),
+       [](const Register& a, const Register& b){ return a.id < b.id; });
+  m_registerFrameSize = 0;
+  for (auto R = m_registers.begin(); R != m_registers.end(); R++)
+  {
+    R->offset = m_registerFrameSize;
+    m_registerFrameSize += R->size*R->num;
+  }
+
+  // Batch handlers can only be used when each operand is either in a lane
+  // of the register file, or is a constant or uniform value shared by every
+  // work-item
+  set<unsigned> lanes, shared;
+  for (auto R = m_registers.begin(); R != m_registers.end(); R++)
+    lanes.insert(R->id);
+  for (auto R = m_uniformRegisters.begin();
+            R != m_uniformRegisters.end(); R++)
+    shared.insert(R->id);
+  for (auto C = m_constants.begin(); C != m_constants.end(); C++)
+    shared.insert(C->first);
+  for (auto I = m_instructions.begin(); I != m_instructions.end(); I++)
+  {
+    if (I->handler != HandlerTyped)
+    {
+      I->batch = NULL;
+      continue;
+    }
+
+    for (unsigned i = 0; i < I->numOperands; i++)
+    {
+      if (lanes.count(I->operands[i]))
+      {
+        I->varying |= 1<<i;
+      }
+      else if (!shared.count(I->operands[i]))
+      {
+        I->batch = NULL;
+        break;
+      }
+    }
+  }
+
+  // Compile the kernel to native code if requested
+  // Not used in interactive mode, where instructions are stepped through,
+  // or where work-items can't be suspended at barriers
+  m_jit = NULL;
+#ifndef _WIN32
+  if (checkEnv("OCLGRIND_JIT") && !checkEnv("OCLGRIND_INTERACTIVE"))
+  {
+    JITCompiler::Callbacks callbacks =
+    {
+      WorkItem::nativeExecute,
+      WorkItem::nativeCall,
+      WorkItem::nativeReturn,
+    };
+    m_jit = new JITCompiler(this, callbacks);
+    if (!m_jit->compile(functions))
+    {
+      delete m_jit;
+      m_jit = NULL;
+    }
+  }
+#endif
 }
 
 InterpreterCache::~InterpreterCache()
 {
-  ConstantMap::iterator constItr;
+  ConstantList::iterator constItr;
   for (constItr  = m_constants.begin();
        constItr != m_constants.end(); constItr++)
   {
@@ -1532,6 +2351,8 @@ InterpreterCache::~InterpreterCache()
   {
     delete constExprItr->second;
   }
+
+  delete m_jit;
 }
 
 void InterpreterCache::addBuiltin(
@@ -1560,12 +2381,44 @@ void InterpreterCache::addBuiltin(
     overload = "";
   }
 
+  Builtin builtin;
+  builtin.name     = name;
+  builtin.overload = overload;
+
+  // Extract the (first) argument type from the overload, using the element
+  // type for vectors
+  builtin.argType = overload.empty() ? 0 : overload[0];
+  if (builtin.argType == 'D')
+  {
+    char *typestr;
+    strtol(overload.c_str() + 2, &typestr, 10);
+    builtin.argType = typestr[1];
+  }
+  builtin.lastArgType = overload.empty() ? 0 : *overload.rbegin();
+
+  // Find the address space of the memory that the builtin accesses
+  builtin.addrSpace = AddrSpacePrivate;
+  llvm::FunctionType *type = function->getFunctionType();
+  for (auto P = type->param_begin(); P != type->param_end(); P++)
+  {
+    if ((*P)->isPointerTy())
+    {
+      builtin.addrSpace = (*P)->getPointerAddressSpace();
+      break;
+    }
+  }
+
+  // Extract conversion modifiers
+  size_t rpos = name.find("_rt");
+  builtin.rounding = rpos != string::npos ? name[rpos+3] : 0;
+  builtin.saturate = name.find("_sat") != string::npos;
+
   // Find builtin function in map
   BuiltinFunctionMap::iterator bItr = workItemBuiltins.find(name);
   if (bItr != workItemBuiltins.end())
   {
     // Add builtin to cache
-    const InterpreterCache::Builtin builtin = {bItr->second, name, overload};
+    builtin.function = bItr->second;
     m_builtins[function] = builtin;
     return;
   }
@@ -1578,7 +2431,7 @@ void InterpreterCache::addBuiltin(
     if (name.compare(0, pItr->first.length(), pItr->first) == 0)
     {
       // Add builtin to cache
-      const InterpreterCache::Builtin builtin = {pItr->second, name, overload};
+      builtin.function = pItr->second;
       m_builtins[function] = builtin;
       return;
     }
@@ -1588,7 +2441,7 @@ void InterpreterCache::addBuiltin(
   FATAL_ERROR("Undefined external function: %s", name.c_str());
 }
 
-InterpreterCache::Builtin InterpreterCache::getBuiltin(
+const Builtin& InterpreterCache::getBuiltin(
   const llvm::Function *function) const
 {
   return m_builtins.at(function);
@@ -1597,7 +2450,7 @@ InterpreterCache::Builtin InterpreterCache::getBuiltin(
 void InterpreterCache::addConstant(const llvm::Value *value)
 {
   // Check if constant already in cache
-  if (m_constants.count(value))
+  if (m_valueIDs.count(value))
   {
     return;
   }
@@ -1610,30 +2463,344 @@ void InterpreterCache::addConstant(const llvm::Value *value)
   constant.data = new unsigned char[getTypeSize(value->getType())];
   getConstantData(constant.data, (const llvm::Constant*)value);
 
-  m_constants[value] = constant;
+  m_constants.push_back(make_pair(addValueID(value), constant));
+}
+
+const InterpreterCache::ConstantList& InterpreterCache::getConstants() const
+{
+  return m_constants;
+}
+
+const vector<InterpreterCache::Instruction>&
+  InterpreterCache::getConstantExpressions() const
+{
+  return m_constExprCode;
 }
 
-TypedValue InterpreterCache::getConstant(const llvm::Value *operand) const
+InterpreterCache::Instruction InterpreterCache::decode(
+  const llvm::Instruction *instruction,
+  const BlockMap& blockStarts, const BlockMap& blockEnds,
+  vector< pair<size_t,size_t> >& ranges)
 {
-  ConstantMap::const_iterator itr = m_constants.find(operand);
-  if (itr == m_constants.end())
+  pair<unsigned,unsigned> size = getValueSize(instruction);
+
+  Instruction decoded;
+  decoded.instruction = instruction;
+  decoded.opcode      = instruction->getOpcode();
+  decoded.result      = hasValue(instruction) ? getValueID(instruction) : 0;
+  decoded.size        = size.first;
+  decoded.num         = size.second;
+  decoded.reconverge  = NO_OFFSET;
+  decoded.uniform     = NO_OFFSET;
+  decoded.operands    = NULL;
+  decoded.targets     = NULL;
+  decoded.builtin     = NULL;
+
+  vector<unsigned> operands, targets;
+  switch (decoded.opcode)
   {
-    FATAL_ERROR("Constant not found in cache (ID %d)", operand->getValueID());
+  case llvm::Instruction::Br:
+  {
+    const llvm::BranchInst *br = (const llvm::BranchInst*)instruction;
+    if (br->isConditional())
+    {
+      operands.push_back(getValueID(br->getCondition()));
+    }
+    for (unsigned i = 0; i < br->getNumSuccessors(); i++)
+    {
+      targets.push_back(blockStarts.at(br->getSuccessor(i)));
+    }
+    break;
+  }
+  case llvm::Instruction::Switch:
+  {
+    const llvm::SwitchInst *swtch = (const llvm::SwitchInst*)instruction;
+    operands.push_back(getValueID(swtch->getCondition()));
+    targets.push_back(blockStarts.at(swtch->getDefaultDest()));
+    for (auto C = swtch->case_begin(); C != swtch->case_end(); C++)
+    {
+      operands.push_back(getValueID(C.getCaseValue()));
+      targets.push_back(blockStarts.at(C.getCaseSuccessor()));
+    }
+    break;
+  }
+  case llvm::Instruction::PHI:
+  {
+    const llvm::PHINode *phi = (const llvm::PHINode*)instruction;
+    for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+    {
+      operands.push_back(getValueID(phi->getIncomingValue(i)));
+      targets.push_back(blockEnds.at(phi->getIncomingBlock(i)));
+    }
+    break;
+  }
+  case llvm::Instruction::Call:
+  {
+    const llvm::CallInst *call = (const llvm::CallInst*)instruction;
+    const llvm::Function *callee =
+      (const llvm::Function*)call->getCalledValue()->stripPointerCasts();
+    for (unsigned i = 0; i < call->getNumArgOperands(); i++)
+    {
+      operands.push_back(getValueID(call->getArgOperand(i)));
+    }
+    if (callee->isDeclaration())
+    {
+      decoded.builtin = &m_builtins.at(callee);
+    }
+    else
+    {
+      // Append callee parameter slots and entry point
+      for (auto A = callee->arg_begin(); A != callee->arg_end(); A++)
+      {
+        operands.push_back(getValueID(A));
+      }
+      targets.push_back(blockStarts.at(&callee->getEntryBlock()));
+    }
+    break;
+  }
+  default:
+    for (unsigned i = 0; i < instruction->getNumOperands(); i++)
+    {
+      operands.push_back(getValueID(instruction->getOperand(i)));
+    }
+    break;
+  }
+
+  // Select handler
+  switch (decoded.opcode)
+  {
+#define INSTRUCTION(opcode, name)                   \
+  case llvm::Instruction::opcode:                   \
+    decoded.handler = Handler##opcode;              \
+    break;
+  INSTRUCTION_LIST(INSTRUCTION)
+#undef INSTRUCTION
+  default:
+    // Defer error until the instruction is actually executed
+    decoded.handler = HandlerUnsupported;
+    break;
+  }
+
+  // Use a type-specialized implementation if one is available
+  decoded.typed =
+    getTypedHandler<TypedHandler, BinaryKernel, CompareKernel>(instruction);
+  decoded.batch = NULL;
+  decoded.varying = 0;
+  if (decoded.typed)
+  {
+    decoded.handler = HandlerTyped;
+    decoded.batch = getTypedHandler<BatchHandler, BinaryBatchKernel,
+                                    CompareBatchKernel>(instruction);
+  }
+
+  // Append operands and targets to slot array
+  decoded.numOperands = operands.size();
+  decoded.numTargets  = targets.size();
+  ranges.push_back(make_pair(m_slots.size(), m_slots.size()+operands.size()));
+  m_slots.insert(m_slots.end(), operands.begin(), operands.end());
+  m_slots.insert(m_slots.end(), targets.begin(), targets.end());
+
+  return decoded;
+}
+
+static bool isUniformConstant(const llvm::Constant *constant)
+{
+  // Private variables have a separate copy in each work-item
+  if (auto global = llvm::dyn_cast<llvm::GlobalValue>(constant))
+    return global->getType()->getPointerAddressSpace() != AddrSpacePrivate;
+
+  for (auto O = constant->op_begin(); O != constant->op_end(); O++)
+  {
+    if (!isUniformConstant(llvm::cast<llvm::Constant>(*O)))
+      return false;
+  }
+  return true;
+}
+
+void InterpreterCache::findUniformInstructions(const llvm::Function *kernel)
+{
+  // Builtins that return the same value for every work-item in a work-group
+  static const set<string> uniformBuiltins = {
+    "get_global_offset",
+    "get_global_size",
+    "get_group_id",
+    "get_local_size",
+    "get_num_groups",
+    "get_work_dim",
+  };
+
+  // Kernel arguments are uniform, except those copied into private memory
+  set<const llvm::Value*> uniform;
+  for (auto A = kernel->arg_begin(); A != kernel->arg_end(); A++)
+  {
+    const llvm::Type *type = A->getType();
+    if (!type->isPointerTy() ||
+        type->getPointerAddressSpace() != AddrSpacePrivate)
+      uniform.insert(&*A);
+  }
+
+  // An instruction is uniform if it has no side effects and all of its
+  // operands are uniform. PHI nodes are never uniform, so there are no
+  // cycles, and repeating until nothing changes handles any block order.
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (auto I = llvm::inst_begin(kernel); I != llvm::inst_end(kernel); I++)
+    {
+      if (uniform.count(&*I))
+        continue;
+
+      const llvm::Value *callee = NULL;
+      switch (I->getOpcode())
+      {
+      case llvm::Instruction::Add:
+      case llvm::Instruction::And:
+      case llvm::Instruction::AShr:
+      case llvm::Instruction::BitCast:
+      case llvm::Instruction::ExtractElement:
+      case llvm::Instruction::ExtractValue:
+      case llvm::Instruction::FAdd:
+      case llvm::Instruction::FCmp:
+      case llvm::Instruction::FDiv:
+      case llvm::Instruction::FMul:
+      case llvm::Instruction::FPExt:
+      case llvm::Instruction::FPToSI:
+      case llvm::Instruction::FPToUI:
+      case llvm::Instruction::FPTrunc:
+      case llvm::Instruction::FRem:
+      case llvm::Instruction::FSub:
+      case llvm::Instruction::GetElementPtr:
+      case llvm::Instruction::ICmp:
+      case llvm::Instruction::InsertElement:
+      case llvm::Instruction::InsertValue:
+      case llvm::Instruction::IntToPtr:
+      case llvm::Instruction::LShr:
+      case llvm::Instruction::Mul:
+      case llvm::Instruction::Or:
+      case llvm::Instruction::PtrToInt:
+      case llvm::Instruction::SDiv:
+      case llvm::Instruction::Select:
+      case llvm::Instruction::SExt:
+      case llvm::Instruction::Shl:
+      case llvm::Instruction::ShuffleVector:
+      case llvm::Instruction::SIToFP:
+      case llvm::Instruction::SRem:
+      case llvm::Instruction::Sub:
+      case llvm::Instruction::Trunc:
+      case llvm::Instruction::UDiv:
+      case llvm::Instruction::UIToFP:
+      case llvm::Instruction::URem:
+      case llvm::Instruction::Xor:
+      case llvm::Instruction::ZExt:
+        break;
+      case llvm::Instruction::Call:
+      {
+        const llvm::CallInst *call = (const llvm::CallInst*)&*I;
+        const llvm::Function *function = call->getCalledFunction();
+        if (!function || !function->isDeclaration() ||
+            !m_builtins.count(function) ||
+            !uniformBuiltins.count(m_builtins.at(function).name))
+          continue;
+        callee = call->getCalledValue();
+        break;
+      }
+      default:
+        continue;
+      }
+
+      bool isUniform = true;
+      for (auto O = I->value_op_begin(); O != I->value_op_end(); O++)
+      {
+        if (*O == callee || uniform.count(*O))
+          continue;
+        if (auto constant = llvm::dyn_cast<llvm::Constant>(*O))
+        {
+          if (isUniformConstant(constant))
+            continue;
+        }
+        isUniform = false;
+        break;
+      }
+
+      if (isUniform)
+      {
+        uniform.insert(&*I);
+        changed = true;
+      }
+    }
+  }
+
+  // Redirect uniform instructions to the uniform handler, and give each
+  // result a location in the work-group's shared frame
+  m_uniformFrameSize = 0;
+  for (auto I = llvm::inst_begin(kernel); I != llvm::inst_end(kernel); I++)
+  {
+    Instruction& instruction = m_instructions[getInstructionOffset(&*I)];
+    if (!uniform.count(&*I) || !instruction.size)
+      continue;
+
+    Register reg = {instruction.result, instruction.size, instruction.num,
+                    m_uniformFrameSize};
+    m_uniformRegisters.push_back(reg);
+    m_uniformFrameSize += instruction.size*instruction.num;
+
+    m_uniformCode.push_back(instruction);
+    instruction.handler = HandlerUniform;
+    instruction.uniform = m_uniformCode.size() - 1;
   }
-  return itr->second;
 }
 
-const llvm::Instruction* InterpreterCache::getConstantExpr(
-  const llvm::Value *expr) const
+const InterpreterCache::Instruction& InterpreterCache::getInstruction(
+  unsigned offset) const
 {
-  ConstExprMap::const_iterator itr = m_constExpressions.find(expr);
-  if (itr == m_constExpressions.end())
+  return m_instructions[offset];
+}
+
+const vector<InterpreterCache::Register>&
+  InterpreterCache::getRegisters() const
+{
+  return m_registers;
+}
+
+size_t InterpreterCache::getRegisterFrameSize() const
+{
+  return m_registerFrameSize;
+}
+
+unsigned InterpreterCache::getInstructionOffset(
+  const llvm::Instruction *instruction) const
+{
+  auto itr = m_offsets.find(instruction);
+  if (itr == m_offsets.end())
   {
-    FATAL_ERROR("Constant expression not found in cache");
+    FATAL_ERROR("Instruction not found in cache");
   }
   return itr->second;
 }
 
+const JITCompiler* InterpreterCache::getJIT() const
+{
+  return m_jit;
+}
+
+const InterpreterCache::Instruction& InterpreterCache::getUniformInstruction(
+  unsigned index) const
+{
+  return m_uniformCode[index];
+}
+
+const vector<InterpreterCache::Register>&
+  InterpreterCache::getUniformRegisters() const
+{
+  return m_uniformRegisters;
+}
+
+size_t InterpreterCache::getUniformFrameSize() const
+{
+  return m_uniformFrameSize;
+}
+
 unsigned InterpreterCache::addValueID(const llvm::Value *value)
 {
   ValueMap::iterator itr = m_valueIDs.find(value);
@@ -1693,7 +2860,8 @@ void InterpreterCache::addOperand(const llvm::Value *operand)
         addOperand(*O);
       }
       m_constExpressions[expr] = getConstExprAsInstruction(expr);
-      // TODO: Resolve actual value?
+      m_constExprOrder.push_back(expr);
+      addValueID(expr);
     }
   }
   else
@@ -8,6 +8,60 @@
 
 #include "common.h"
 
+// LLVM instructions supported by the interpreter, paired with their handlers
+#define INSTRUCTION_LIST(X)         \
+  X(Add,            add)            \
+  X(Alloca,         alloc)          \
+  X(And,            bwand)          \
+  X(AShr,           ashr)           \
+  X(BitCast,        bitcast)        \
+  X(Br,             br)             \
+  X(Call,           call)           \
+  X(ExtractElement, extractelem)    \
+  X(ExtractValue,   extractval)     \
+  X(FAdd,           fadd)           \
+  X(FCmp,           fcmp)           \
+  X(FDiv,           fdiv)           \
+  X(FMul,           fmul)           \
+  X(FPExt,          fpext)          \
+  X(FPToSI,         fptosi)         \
+  X(FPToUI,         fptoui)         \
+  X(FPTrunc,        fptrunc)        \
+  X(FRem,           frem)           \
+  X(FSub,           fsub)           \
+  X(GetElementPtr,  gep)            \
+  X(ICmp,           icmp)           \
+  X(InsertElement,  insertelem)     \
+  X(InsertValue,    insertval)      \
+  X(IntToPtr,       inttoptr)       \
+  X(Load,           load)           \
+  X(LShr,           lshr)           \
+  X(Mul,            mul)            \
+  X(Or,             bwor)           \
+  X(PHI,            phi)            \
+  X(PtrToInt,       ptrtoint)       \
+  X(Ret,            ret)            \
+  X(SDiv,           sdiv)           \
+  X(Select,         select)         \
+  X(SExt,           sext)           \
+  X(Shl,            shl)            \
+  X(ShuffleVector,  shuffle)        \
+  X(SIToFP,         sitofp)         \
+  X(SRem,           srem)           \
+  X(Store,          store)          \
+  X(Sub,            sub)            \
+  X(Switch,         swtch)          \
+  X(Trunc,          itrunc)         \
+  X(UDiv,           udiv)           \
+  X(UIToFP,         uitofp)         \
+  X(Unreachable,    unreachable)    \
+  X(URem,           urem)           \
+  X(Xor,            bwxor)          \
+  X(ZExt,           zext)
+
+// Sentinel for an instruction offset that does not exist
+#define NO_OFFSET ((unsigned)-1)
+
 namespace llvm
 {
   class BasicBlock;
@@ -21,6 +75,7 @@ namespace llvm
 namespace oclgrind
 {
   class Context;
+  class JITCompiler;
   class Kernel;
   class KernelInvocation;
   class Memory;
@@ -29,21 +84,35 @@ namespace oclgrind
   class WorkItemBuiltins;
 
   // Data structures for builtin functions
+  struct Builtin;
   struct BuiltinFunction
   {
-    void (*func)(WorkItem*, const llvm::CallInst*,
-                 const std::string&, const std::string&, TypedValue&, void*);
+    void (*func)(WorkItem*, const llvm::CallInst*, const Builtin&,
+                 TypedValue&, void*);
     void *op;
     BuiltinFunction(){};
     BuiltinFunction(void (*f)(WorkItem*, const llvm::CallInst*,
-                     const std::string&, const std::string&, TypedValue&,
-                     void*),
+                     const Builtin&, TypedValue&, void*),
                      void *o) : func(f), op(o) {};
   };
   typedef std::unordered_map<std::string,BuiltinFunction> BuiltinFunctionMap;
   typedef std::list< std::pair<std::string, BuiltinFunction> >
     BuiltinFunctionPrefixList;
 
+  // Builtin function resolved for a particular declaration
+  // Properties of the mangled name are decoded when the kernel is loaded,
+  // so that calls do not need to inspect the name or overload strings
+  struct Builtin
+  {
+    BuiltinFunction function;
+    std::string name, overload;
+    char argType;       // Mangled type of the first argument (element type)
+    char lastArgType;   // Mangled type of the last argument (element type)
+    char rounding;      // Rounding mode from an _rt* suffix, or 0 if none
+    bool saturate;      // Has a _sat suffix
+    unsigned addrSpace; // Address space of the first pointer argument
+  };
+
   extern BuiltinFunctionMap workItemBuiltins;
   extern BuiltinFunctionPrefixList workItemPrefixBuiltins;
 
@@ -51,21 +120,100 @@ namespace oclgrind
   class InterpreterCache
   {
   public:
-    struct Builtin
+    // Identifiers for instruction handlers, used for dispatch
+    enum Handler
+    {
+#define HANDLER_ID(opcode, name) Handler##opcode,
+      INSTRUCTION_LIST(HANDLER_ID)
+#undef HANDLER_ID
+      HandlerUnsupported,
+      HandlerTyped,
+      HandlerUniform,
+    };
+
+    // Implementation of an instruction specialized for its operand types,
+    // selected when the kernel is decoded
+    typedef void (*TypedHandler)(const unsigned char *opA,
+                                 const unsigned char *opB,
+                                 unsigned char *result);
+
+    // Type-specialized implementation applied across consecutive lanes of
+    // the work-group register file, for work-items executing in lockstep
+    // Operand strides are zero for values shared by every lane
+    typedef void (*BatchHandler)(const unsigned char *opA, size_t strideA,
+                                 const unsigned char *opB, size_t strideB,
+                                 unsigned char *result, size_t numLanes);
+
+    // Pre-decoded instruction, stored in a flat per-kernel array
+    // Operands are indices into the work-item value store, and branch
+    // targets are offsets into the instruction array. For PHI nodes, each
+    // target is the offset of the terminator of the incoming block. For
+    // calls to defined functions, the first target is the callee entry point
+    // and the operands are the call arguments followed by the callee's
+    // parameter slots. Calls to builtin functions are resolved to builtin
+    // when the kernel is decoded. For conditional branches and switches,
+    // reconverge is the offset of the immediate post-dominator, where
+    // work-items executing in lockstep can rejoin after diverging
+    // (NO_OFFSET if there is none).
+    // Instructions whose result is the same for every work-item in a
+    // work-group use the uniform handler, with uniform indexing the shared
+    // value and the original instruction (NO_OFFSET for other instructions).
+    // Type-specialized instructions whose operands are all registers or
+    // shared values also have a batch handler, and varying has a bit set
+    // for each operand that is a register.
+    struct Instruction
+    {
+      const llvm::Instruction *instruction;
+      Handler handler;
+      TypedHandler typed;
+      BatchHandler batch;
+      unsigned varying;
+      unsigned opcode;
+      unsigned result;
+      unsigned size, num;
+      unsigned numOperands;
+      unsigned numTargets;
+      unsigned reconverge;
+      unsigned uniform;
+      const unsigned *operands;
+      const unsigned *targets;
+      const Builtin *builtin;
+    };
+
+    typedef std::vector< std::pair<unsigned,TypedValue> > ConstantList;
+
+    // Fixed location of an instruction result or function parameter within
+    // a register frame
+    // A work-group register file holds one frame per work-item, with the
+    // same register of every work-item stored contiguously
+    struct Register
     {
-      BuiltinFunction function;
-      std::string name, overload;
+      unsigned id;
+      unsigned size, num;
+      size_t offset;
     };
 
     InterpreterCache(llvm::Function *kernel);
     ~InterpreterCache();
 
     void addBuiltin(const llvm::Function *function);
-    Builtin getBuiltin(const llvm::Function *function) const;
+    const Builtin& getBuiltin(const llvm::Function *function) const;
 
     void addConstant(const llvm::Value *constant);
-    TypedValue getConstant(const llvm::Value *operand) const;
-    const llvm::Instruction* getConstantExpr(const llvm::Value *expr) const;
+    const ConstantList& getConstants() const;
+    const std::vector<Instruction>& getConstantExpressions() const;
+
+    const Instruction& getInstruction(unsigned offset) const;
+    const std::vector<Register>& getRegisters() const;
+    size_t getRegisterFrameSize() const;
+    unsigned getInstructionOffset(const llvm::Instruction *instruction) const;
+
+    // Native code for the kernel, or NULL if it was not compiled
+    const JITCompiler* getJIT() const;
+
+    const Instruction& getUniformInstruction(unsigned index) const;
+    const std::vector<Register>& getUniformRegisters() const;
+    size_t getUniformFrameSize() const;
 
     unsigned addValueID(const llvm::Value *value);
     unsigned getValueID(const llvm::Value *value) const;
@@ -75,20 +223,42 @@ namespace oclgrind
   private:
     typedef std::unordered_map<const llvm::Value*, unsigned> ValueMap;
     typedef std::unordered_map<const llvm::Function*, Builtin> BuiltinMap;
-    typedef std::unordered_map<const llvm::Value*, TypedValue> ConstantMap;
     typedef std::unordered_map<const llvm::Value*, const llvm::Instruction*>
       ConstExprMap;
+    typedef std::unordered_map<const llvm::BasicBlock*, unsigned> BlockMap;
 
     BuiltinMap m_builtins;
-    ConstantMap m_constants;
+    ConstantList m_constants;
     ConstExprMap m_constExpressions;
+    std::vector<const llvm::ConstantExpr*> m_constExprOrder;
     ValueMap m_valueIDs;
 
+    // Linear instruction array and operand/target storage
+    std::vector<Instruction> m_instructions;
+    std::vector<Instruction> m_constExprCode;
+    std::vector<unsigned> m_slots;
+    std::unordered_map<const llvm::Instruction*, unsigned> m_offsets;
+
+    std::vector<Register> m_registers;
+    size_t m_registerFrameSize;
+
+    // Work-group uniform instructions and the layout of their shared values
+    std::vector<Instruction> m_uniformCode;
+    std::vector<Register> m_uniformRegisters;
+    size_t m_uniformFrameSize;
+    void findUniformInstructions(const llvm::Function *kernel);
+
+    JITCompiler *m_jit;
+
     void addOperand(const llvm::Value *value);
+    Instruction decode(const llvm::Instruction *instruction,
+                       const BlockMap& blockStarts, const BlockMap& blockEnds,
+                       std::vector< std::pair<size_t,size_t> >& ranges);
   };
 
   class WorkItem
   {
+    friend class InterpreterCache;
     friend class WorkItemBuiltins;
 
   public:
@@ -96,15 +266,19 @@ namespace oclgrind
 
   public:
     WorkItem(const KernelInvocation *kernelInvocation,
-             WorkGroup *workGroup, Size3 lid);
+             WorkGroup *workGroup, const InterpreterCache *cache, Size3 lid);
     virtual ~WorkItem();
 
     void clearBarrier();
-    void dispatch(const llvm::Instruction *instruction, TypedValue& result);
-    void execute(const llvm::Instruction *instruction);
-    const std::stack<const llvm::Instruction*>& getCallStack() const;
+    void dispatch(const InterpreterCache::Instruction& instruction,
+                  TypedValue& result);
+    void execute(const InterpreterCache::Instruction& instruction);
+    static void executeBatch(const InterpreterCache::Instruction& instruction,
+                             WorkItem *const *workItems, size_t num);
+    std::stack<const llvm::Instruction*> getCallStack() const;
     const llvm::BasicBlock* getCurrentBlock() const;
     const llvm::Instruction* getCurrentInstruction() const;
+    unsigned getCurrentOffset() const;
     Size3 getGlobalID() const;
     size_t getGlobalIndex() const;
     Size3 getLocalID() const;
@@ -117,59 +291,19 @@ namespace oclgrind
     const WorkGroup* getWorkGroup() const;
     bool printValue(const llvm::Value *value) const;
     bool printVariable(std::string name) const;
+    State run(unsigned stop = NO_OFFSET);
     State step();
+    void yield();
 
     // SPIR instructions
   private:
-#define INSTRUCTION(name) \
-  void name(const llvm::Instruction *instruction, TypedValue& result)
-    INSTRUCTION(add);
-    INSTRUCTION(alloc);
-    INSTRUCTION(ashr);
-    INSTRUCTION(bitcast);
-    INSTRUCTION(br);
-    INSTRUCTION(bwand);
-    INSTRUCTION(bwor);
-    INSTRUCTION(bwxor);
-    INSTRUCTION(call);
-    INSTRUCTION(extractelem);
-    INSTRUCTION(extractval);
-    INSTRUCTION(fadd);
-    INSTRUCTION(fcmp);
-    INSTRUCTION(fdiv);
-    INSTRUCTION(fmul);
-    INSTRUCTION(fpext);
-    INSTRUCTION(fptosi);
-    INSTRUCTION(fptoui);
-    INSTRUCTION(fptrunc);
-    INSTRUCTION(frem);
-    INSTRUCTION(fsub);
-    INSTRUCTION(gep);
-    INSTRUCTION(icmp);
-    INSTRUCTION(insertelem);
-    INSTRUCTION(insertval);
-    INSTRUCTION(inttoptr);
-    INSTRUCTION(itrunc);
-    INSTRUCTION(load);
-    INSTRUCTION(lshr);
-    INSTRUCTION(mul);
-    INSTRUCTION(phi);
-    INSTRUCTION(ptrtoint);
-    INSTRUCTION(ret);
-    INSTRUCTION(sdiv);
-    INSTRUCTION(select);
-    INSTRUCTION(sext);
-    INSTRUCTION(shl);
-    INSTRUCTION(shuffle);
-    INSTRUCTION(sitofp);
-    INSTRUCTION(srem);
-    INSTRUCTION(store);
-    INSTRUCTION(sub);
-    INSTRUCTION(swtch);
-    INSTRUCTION(udiv);
-    INSTRUCTION(uitofp);
-    INSTRUCTION(urem);
-    INSTRUCTION(zext);
+#define INSTRUCTION(opcode, name) \
+  void name(const InterpreterCache::Instruction& instruction, \
+            TypedValue& result);
+    INSTRUCTION_LIST(INSTRUCTION)
+    INSTRUCTION(Unsupported, unsupported)
+    INSTRUCTION(Typed, typed)
+    INSTRUCTION(Uniform, uniform)
 #undef INSTRUCTION
 
   private:
@@ -178,25 +312,58 @@ namespace oclgrind
     size_t m_globalIndex;
     Size3 m_globalID;
     Size3 m_localID;
-    TypedValueMap m_phiTemps;
+    std::vector< std::pair<unsigned,TypedValue> > m_phiTemps;
     VariableMap m_variables;
     const Context *m_context;
     const KernelInvocation *m_kernelInvocation;
     Memory *m_privateMemory;
     WorkGroup *m_workGroup;
     mutable MemoryPool m_pool;
+    mutable MemoryPool m_scratch;
 
     State m_state;
+    bool m_yield;
     struct Position;
     Position *m_position;
 
+    // Execution of the kernel's native code, on a stack of its own so that
+    // the work-item can be suspended at barriers
+    struct NativeState;
+    NativeState *m_native;
+    State runNative();
+    static void nativeCall(WorkItem *workItem, unsigned offset);
+    static void nativeExecute(WorkItem *workItem, unsigned offset);
+    static void nativeReturn(WorkItem *workItem);
+    static void nativeStart(unsigned high, unsigned low);
+
+    void beginInstruction(const InterpreterCache::Instruction& instruction,
+                          TypedValue& result);
+    void endInstruction(const InterpreterCache::Instruction& instruction,
+                        TypedValue& result);
+
     Memory* getMemory(unsigned int addrSpace) const;
 
     // Store for instruction results and other operand values
+    // Instruction results and function parameters have fixed locations in
+    // a register frame, and are written in place
     std::vector<TypedValue> m_values;
+    unsigned char *m_frame;
+    void storeResult(unsigned id, const TypedValue& value);
     TypedValue getValue(const llvm::Value *key) const;
     bool hasValue(const llvm::Value *key) const;
     void setValue(const llvm::Value *key, TypedValue value);
+    TypedValue getOperand(const InterpreterCache::Instruction& instruction,
+                          unsigned index) const
+    {
+      return m_values[instruction.operands[index]];
+    }
+
+    // Operand slots of the arguments to the builtin call being executed
+    const unsigned *m_builtinArgs;
+    TypedValue getArgument(unsigned index) const
+    {
+      return m_values[m_builtinArgs[index]];
+    }
 
     const InterpreterCache *m_cache;
   };
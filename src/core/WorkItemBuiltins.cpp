@@ -55,13 +55,12 @@ namespace oclgrind
     // Utility macros for creating builtins
 #define DEFINE_BUILTIN(name)                                           \
   static void name(WorkItem *workItem, const llvm::CallInst *callInst, \
-                   const string& fnName, const string& overload,       \
-                   TypedValue& result, void *)
+                   const Builtin& builtin, TypedValue& result, void *)
 #define ARG(i) (callInst->getArgOperand(i))
-#define UARGV(i,v) workItem->getOperand(ARG(i)).getUInt(v)
-#define SARGV(i,v) workItem->getOperand(ARG(i)).getSInt(v)
-#define FARGV(i,v) workItem->getOperand(ARG(i)).getFloat(v)
-#define PARGV(i,v) workItem->getOperand(ARG(i)).getPointer(v)
+#define UARGV(i,v) workItem->getArgument(i).getUInt(v)
+#define SARGV(i,v) workItem->getArgument(i).getSInt(v)
+#define FARGV(i,v) workItem->getArgument(i).getFloat(v)
+#define PARGV(i,v) workItem->getArgument(i).getPointer(v)
 #define UARG(i) UARGV(i, 0)
 #define SARG(i) SARGV(i, 0)
 #define FARG(i) FARGV(i, 0)
@@ -69,8 +68,8 @@ namespace oclgrind
 
     // Functions that apply generic builtins to each component of a vector
     static void f1arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, double (*func)(double))
+                      const Builtin& builtin, TypedValue& result,
+                      double (*func)(double))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -78,8 +77,8 @@ namespace oclgrind
       }
     }
     static void f2arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, double (*func)(double, double))
+                      const Builtin& builtin, TypedValue& result,
+                      double (*func)(double, double))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -87,8 +86,8 @@ namespace oclgrind
       }
     }
     static void f3arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, double (*func)(double, double, double))
+                      const Builtin& builtin, TypedValue& result,
+                      double (*func)(double, double, double))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -96,8 +95,8 @@ namespace oclgrind
       }
     }
     static void u1arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, uint64_t (*func)(uint64_t))
+                      const Builtin& builtin, TypedValue& result,
+                      uint64_t (*func)(uint64_t))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -105,8 +104,8 @@ namespace oclgrind
       }
     }
     static void u2arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, uint64_t (*func)(uint64_t, uint64_t))
+                      const Builtin& builtin, TypedValue& result,
+                      uint64_t (*func)(uint64_t, uint64_t))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -114,8 +113,8 @@ namespace oclgrind
       }
     }
     static void u3arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, uint64_t (*func)(uint64_t, uint64_t, uint64_t))
+                      const Builtin& builtin, TypedValue& result,
+                      uint64_t (*func)(uint64_t, uint64_t, uint64_t))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -123,8 +122,8 @@ namespace oclgrind
       }
     }
     static void s1arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, int64_t (*func)(int64_t))
+                      const Builtin& builtin, TypedValue& result,
+                      int64_t (*func)(int64_t))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -132,8 +131,8 @@ namespace oclgrind
       }
     }
     static void s2arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, int64_t (*func)(int64_t, int64_t))
+                      const Builtin& builtin, TypedValue& result,
+                      int64_t (*func)(int64_t, int64_t))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -141,8 +140,8 @@ namespace oclgrind
       }
     }
     static void s3arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                      const string& name, const string& overload,
-                      TypedValue& result, int64_t (*func)(int64_t, int64_t, int64_t))
+                      const Builtin& builtin, TypedValue& result,
+                      int64_t (*func)(int64_t, int64_t, int64_t))
     {
       for (unsigned i = 0; i < result.num; i++)
       {
@@ -150,8 +149,8 @@ namespace oclgrind
       }
     }
     static void rel1arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                        const string& name, const string& overload,
-                        TypedValue& result, int64_t (*func)(double))
+                        const Builtin& builtin, TypedValue& result,
+                        int64_t (*func)(double))
     {
       int64_t t = result.num > 1 ? -1 : 1;
       for (unsigned i = 0; i < result.num; i++)
@@ -160,8 +159,8 @@ namespace oclgrind
       }
     }
     static void rel2arg(WorkItem *workItem, const llvm::CallInst *callInst,
-                        const string& name, const string& overload,
-                        TypedValue& result, int64_t (*func)(double, double))
+                        const Builtin& builtin, TypedValue& result,
+                        int64_t (*func)(double, double))
     {
       int64_t t = result.num > 1 ? -1 : 1;
       for (unsigned i = 0; i < result.num; i++)
@@ -170,24 +169,12 @@ namespace oclgrind
       }
     }
 
-    // Extract the (first) argument type from an overload string
-    static char getOverloadArgType(const string& overload)
-    {
-      char type = overload[0];
-      if (type == 'D')
-      {
-        char *typestr;
-        strtol(overload.c_str() + 2, &typestr, 10);
-        type = typestr[1];
-      }
-      return type;
-    }
-
 
     ///////////////////////////////////////
     // Async Copy and Prefetch Functions //
     ///////////////////////////////////////
 
+    template<bool strided>
     DEFINE_BUILTIN(async_work_group_copy)
     {
       int arg = 0;
@@ -207,7 +194,7 @@ namespace oclgrind
       uint64_t stride = 1;
       size_t srcStride = 1;
       size_t destStride = 1;
-      if (fnName == "async_work_group_strided_copy")
+      if (strided)
       {
         stride = UARG(arg++);
       }
@@ -216,7 +203,7 @@ namespace oclgrind
 
       // Get type of copy
       WorkGroup::AsyncCopyType type;
-      if (destOp->getType()->getPointerAddressSpace() == AddrSpaceLocal)
+      if (builtin.addrSpace == AddrSpaceLocal)
       {
         type = WorkGroup::GLOBAL_TO_LOCAL;
         srcStride = stride;
@@ -273,158 +260,117 @@ namespace oclgrind
     // Atomic Functions //
     //////////////////////
 
-    DEFINE_BUILTIN(atomic_add)
+    template<typename T>
+    static T atomicOp(Memory *memory, AtomicOp op, size_t address,
+                      uint64_t cmp, uint64_t value)
+    {
+      if (op == AtomicCmpXchg)
+        return memory->atomicCmpxchg<T>(address, cmp, value);
+      else
+        return memory->atomic<T>(op, address, value);
+    }
+
+    // Performs an atomic operation with the width and signedness of the
+    // builtin's value type, which is 64-bit for cl_khr_int64_*_atomics
+    static void atomicBuiltin(WorkItem *workItem,
+                              const llvm::CallInst *callInst,
+                              const Builtin& builtin, TypedValue& result,
+                              AtomicOp op)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_add");
+      char type = builtin.lastArgType;
+      size_t size = (type == 'l' || type == 'm') ? 8 : 4;
+
+      // Verify the address is aligned to the value size
+      if ((address & (size-1)) != 0)
+      {
+        string msg = "Unaligned address on " + builtin.name;
+        workItem->m_context->logError(msg.c_str());
+      }
+
+      uint64_t cmp = 0, value = 0;
+      if (op == AtomicCmpXchg)
+      {
+        cmp = UARG(1);
+        value = UARG(2);
+      }
+      else if (op != AtomicDec && op != AtomicInc)
+      {
+        value = UARG(1);
+      }
+
+      switch (type)
+      {
+      case 'i':
+        result.setSInt(atomicOp<int32_t>(memory, op, address, cmp, value));
+        break;
+      case 'l':
+        result.setSInt(atomicOp<int64_t>(memory, op, address, cmp, value));
+        break;
+      case 'm':
+        result.setUInt(atomicOp<uint64_t>(memory, op, address, cmp, value));
+        break;
+      default:
+        result.setUInt(atomicOp<uint32_t>(memory, op, address, cmp, value));
+        break;
       }
-      uint32_t old = memory->atomic(AtomicAdd, address, UARG(1));
-      result.setUInt(old);
     }
 
-    DEFINE_BUILTIN(atomic_and)
+    DEFINE_BUILTIN(atomic_add)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicAdd);
+    }
 
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_and");
-      }
-      uint32_t old = memory->atomic(AtomicAnd, address, UARG(1));
-      result.setUInt(old);
+    DEFINE_BUILTIN(atomic_and)
+    {
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicAnd);
     }
 
     DEFINE_BUILTIN(atomic_cmpxchg)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_cmpxchg");
-      }
-      uint32_t old = memory->atomicCmpxchg(address, UARG(1), UARG(2));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicCmpXchg);
     }
 
     DEFINE_BUILTIN(atomic_dec)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_dec");
-      }
-      uint32_t old = memory->atomic(AtomicDec, address);
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicDec);
     }
 
     DEFINE_BUILTIN(atomic_inc)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_dec");
-      }
-      uint32_t old = memory->atomic(AtomicInc, address);
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicInc);
     }
 
     DEFINE_BUILTIN(atomic_max)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_max");
-      }
-      uint32_t old = memory->atomic(AtomicMax, address, UARG(1));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicMax);
     }
 
     DEFINE_BUILTIN(atomic_min)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_min");
-      }
-      uint32_t old = memory->atomic(AtomicMin, address, UARG(1));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicMin);
     }
 
     DEFINE_BUILTIN(atomic_or)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_or");
-      }
-      uint32_t old = memory->atomic(AtomicOr, address, UARG(1));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicOr);
     }
 
     DEFINE_BUILTIN(atomic_sub)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_sub");
-      }
-      uint32_t old = memory->atomic(AtomicSub, address, UARG(1));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicSub);
     }
 
     DEFINE_BUILTIN(atomic_xchg)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_xchg");
-      }
-      uint32_t old = memory->atomic(AtomicXchg, address, UARG(1));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicXchg);
     }
 
     DEFINE_BUILTIN(atomic_xor)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(0)->getType()->getPointerAddressSpace());
-
-      size_t address = PARG(0);
-      // Verify the address is 4-byte aligned
-      if ((address & 0x3) != 0) {
-        workItem->m_context->logError("Unaligned address on atomic_xor");
-      }
-      uint32_t old = memory->atomic(AtomicXor, address, UARG(1));
-      result.setUInt(old);
+      atomicBuiltin(workItem, callInst, builtin, result, AtomicXor);
     }
 
 
@@ -461,13 +407,13 @@ namespace oclgrind
 
     DEFINE_BUILTIN(clamp)
     {
-      switch (getOverloadArgType(overload))
+      switch (builtin.argType)
       {
         case 'f':
         case 'd':
           if (ARG(1)->getType()->isVectorTy())
           {
-            f3arg(workItem, callInst, fnName, overload, result, _clamp_);
+            f3arg(workItem, callInst, builtin, result, _clamp_);
           }
           else
           {
@@ -484,29 +430,29 @@ namespace oclgrind
         case 't':
         case 'j':
         case 'm':
-          u3arg(workItem, callInst, fnName, overload, result, _clamp_);
+          u3arg(workItem, callInst, builtin, result, _clamp_);
           break;
         case 'c':
         case 's':
         case 'i':
         case 'l':
-          s3arg(workItem, callInst, fnName, overload, result, _clamp_);
+          s3arg(workItem, callInst, builtin, result, _clamp_);
           break;
         default:
           FATAL_ERROR("Unsupported argument type: %c",
-                      getOverloadArgType(overload));
+                      builtin.argType);
       }
     }
 
     DEFINE_BUILTIN(max)
     {
-      switch (getOverloadArgType(overload))
+      switch (builtin.argType)
       {
         case 'f':
         case 'd':
           if (ARG(1)->getType()->isVectorTy())
           {
-            f2arg(workItem, callInst, fnName, overload, result, fmax);
+            f2arg(workItem, callInst, builtin, result, fmax);
           }
           else
           {
@@ -522,29 +468,29 @@ namespace oclgrind
         case 't':
         case 'j':
         case 'm':
-          u2arg(workItem, callInst, fnName, overload, result, _max_);
+          u2arg(workItem, callInst, builtin, result, _max_);
           break;
         case 'c':
         case 's':
         case 'i':
         case 'l':
-          s2arg(workItem, callInst, fnName, overload, result, _max_);
+          s2arg(workItem, callInst, builtin, result, _max_);
           break;
         default:
           FATAL_ERROR("Unsupported argument type: %c",
-                      getOverloadArgType(overload));
+                      builtin.argType);
       }
     }
 
     DEFINE_BUILTIN(min)
     {
-      switch (getOverloadArgType(overload))
+      switch (builtin.argType)
       {
         case 'f':
         case 'd':
           if (ARG(1)->getType()->isVectorTy())
           {
-            f2arg(workItem, callInst, fnName, overload, result, fmin);
+            f2arg(workItem, callInst, builtin, result, fmin);
           }
           else
           {
@@ -560,17 +506,17 @@ namespace oclgrind
         case 't':
         case 'j':
         case 'm':
-          u2arg(workItem, callInst, fnName, overload, result, _min_);
+          u2arg(workItem, callInst, builtin, result, _min_);
           break;
         case 'c':
         case 's':
         case 'i':
         case 'l':
-          s2arg(workItem, callInst, fnName, overload, result, _min_);
+          s2arg(workItem, callInst, builtin, result, _min_);
           break;
         default:
           FATAL_ERROR("Unsupported argument type: %c",
-                      getOverloadArgType(overload));
+                      builtin.argType);
       }
     }
 
@@ -1096,7 +1042,7 @@ namespace oclgrind
                         + channel*channelSize;
 
       // Load channel data
-      unsigned char *data = workItem->m_pool.alloc(channelSize);
+      unsigned char *data = workItem->m_scratch.alloc(channelSize);
       if (!workItem->getMemory(AddrSpaceGlobal)->load(data, address,
                                                        channelSize))
       {
@@ -1170,7 +1116,7 @@ namespace oclgrind
                         + channel*channelSize;
 
       // Load channel data
-      unsigned char *data = workItem->m_pool.alloc(channelSize);
+      unsigned char *data = workItem->m_scratch.alloc(channelSize);
       if (!workItem->getMemory(AddrSpaceGlobal)->load(data, address,
                                                        channelSize))
       {
@@ -1235,7 +1181,7 @@ namespace oclgrind
                         + channel*channelSize;
 
       // Load channel data
-      unsigned char *data = workItem->m_pool.alloc(channelSize);
+      unsigned char *data = workItem->m_scratch.alloc(channelSize);
       if (!workItem->getMemory(AddrSpaceGlobal)->load(data, address,
                                                        channelSize))
       {
@@ -1300,7 +1246,7 @@ namespace oclgrind
 
       // Get coordinates
       float s = 0.f, t = 0.f, r = 0.f;
-      char coordType = *overload.rbegin();
+      char coordType = builtin.lastArgType;
       s = getCoordinate(ARG(coordIndex), 0, coordType, workItem);
       if (ARG(coordIndex)->getType()->isVectorTy())
       {
@@ -1418,7 +1364,7 @@ namespace oclgrind
 
       // Get coordinates
       float s = 0.f, t = 0.f, r = 0.f;
-      char coordType = *overload.rbegin();
+      char coordType = builtin.lastArgType;
       s = getCoordinate(ARG(coordIndex), 0, coordType, workItem);
       if (ARG(coordIndex)->getType()->isVectorTy())
       {
@@ -1491,7 +1437,7 @@ namespace oclgrind
 
       // Get coordinates
       float s = 0.f, t = 0.f, r = 0.f;
-      char coordType = *overload.rbegin();
+      char coordType = builtin.lastArgType;
       s = getCoordinate(ARG(coordIndex), 0, coordType, workItem);
       if (ARG(coordIndex)->getType()->isVectorTy())
       {
@@ -1614,7 +1560,7 @@ namespace oclgrind
 
       // Generate channel values
       Memory *memory = workItem->getMemory(AddrSpaceGlobal);
-      unsigned char *data = workItem->m_pool.alloc(channelSize*numChannels);
+      unsigned char *data = workItem->m_scratch.alloc(channelSize*numChannels);
       for (unsigned i = 0; i < numChannels; i++)
       {
         switch (image->format.image_channel_data_type)
@@ -1716,7 +1662,7 @@ namespace oclgrind
 
       // Generate channel values
       Memory *memory = workItem->getMemory(AddrSpaceGlobal);
-      unsigned char *data = workItem->m_pool.alloc(channelSize*numChannels);
+      unsigned char *data = workItem->m_scratch.alloc(channelSize*numChannels);
       for (unsigned i = 0; i < numChannels; i++)
       {
         switch (image->format.image_channel_data_type)
@@ -1806,7 +1752,7 @@ namespace oclgrind
 
       // Generate channel values
       Memory *memory = workItem->getMemory(AddrSpaceGlobal);
-      unsigned char *data = workItem->m_pool.alloc(channelSize*numChannels);
+      unsigned char *data = workItem->m_scratch.alloc(channelSize*numChannels);
       for (unsigned i = 0; i < numChannels; i++)
       {
         switch (image->format.image_channel_data_type)
@@ -1839,7 +1785,7 @@ namespace oclgrind
     {
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -1855,7 +1801,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -1864,7 +1810,7 @@ namespace oclgrind
     {
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -1888,7 +1834,7 @@ namespace oclgrind
           }
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -1899,7 +1845,7 @@ namespace oclgrind
       {
         uint64_t uresult = UARGV(0,i) + UARGV(1,i);
         int64_t  sresult = SARGV(0,i) + SARGV(1,i);
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
             uresult = _min_<uint64_t>(uresult, UINT8_MAX);
@@ -1939,7 +1885,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -1965,7 +1911,7 @@ namespace oclgrind
     {
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -1991,7 +1937,7 @@ namespace oclgrind
           }
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2059,7 +2005,7 @@ namespace oclgrind
     {
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -2083,7 +2029,7 @@ namespace oclgrind
           }
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2094,7 +2040,7 @@ namespace oclgrind
       {
         uint64_t uresult = UARGV(0,i)*UARGV(1,i) + UARGV(2,i);
         int64_t  sresult = SARGV(0,i)*SARGV(1,i) + SARGV(2,i);
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
             uresult = _min_<uint64_t>(uresult, UINT8_MAX);
@@ -2149,7 +2095,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2163,7 +2109,7 @@ namespace oclgrind
     {
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -2185,7 +2131,7 @@ namespace oclgrind
           }
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2205,7 +2151,7 @@ namespace oclgrind
     {
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -2231,7 +2177,7 @@ namespace oclgrind
           }
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2254,7 +2200,7 @@ namespace oclgrind
       {
         uint64_t uresult = UARGV(0,i) - UARGV(1,i);
         int64_t  sresult = SARGV(0,i) - SARGV(1,i);
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
             uresult = uresult > UINT8_MAX ? 0 : uresult;
@@ -2294,7 +2240,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2374,8 +2320,7 @@ namespace oclgrind
 
     DEFINE_BUILTIN(fract)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(1)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t iptr = PARG(1);
       for (unsigned i = 0; i < result.num; i++)
@@ -2410,8 +2355,7 @@ namespace oclgrind
 
     DEFINE_BUILTIN(frexp_builtin)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(1)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t iptr = PARG(1);
       for (unsigned i = 0; i < result.num; i++)
@@ -2441,8 +2385,7 @@ namespace oclgrind
 
     DEFINE_BUILTIN(lgamma_r)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(1)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t signp = PARG(1);
       for (unsigned i = 0; i < result.num; i++)
@@ -2456,8 +2399,7 @@ namespace oclgrind
 
     DEFINE_BUILTIN(modf_builtin)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(1)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t iptr = PARG(1);
       for (unsigned i = 0; i < result.num; i++)
@@ -2557,8 +2499,7 @@ namespace oclgrind
 
     DEFINE_BUILTIN(remquo_builtin)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(2)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t quop = PARG(2);
       for (unsigned i = 0; i < result.num; i++)
@@ -2619,8 +2560,7 @@ namespace oclgrind
 
     DEFINE_BUILTIN(sincos)
     {
-      Memory *memory =
-        workItem->getMemory(ARG(1)->getType()->getPointerAddressSpace());
+      Memory *memory = workItem->getMemory(builtin.addrSpace);
 
       size_t cv = PARG(1);
       for (unsigned i = 0; i < result.num; i++)
@@ -2741,11 +2681,11 @@ namespace oclgrind
 
     DEFINE_BUILTIN(bitselect)
     {
-      switch (getOverloadArgType(overload))
+      switch (builtin.argType)
       {
         case 'f':
         case 'd':
-          f3arg(workItem, callInst, fnName, overload, result, _fbitselect_);
+          f3arg(workItem, callInst, builtin, result, _fbitselect_);
           break;
         case 'h':
         case 't':
@@ -2755,17 +2695,17 @@ namespace oclgrind
         case 's':
         case 'i':
         case 'l':
-          u3arg(workItem, callInst, fnName, overload, result, _ibitselect_);
+          u3arg(workItem, callInst, builtin, result, _ibitselect_);
           break;
         default:
           FATAL_ERROR("Unsupported argument type: %c",
-                      getOverloadArgType(overload));
+                      builtin.argType);
       }
     }
 
     DEFINE_BUILTIN(select_builtin)
     {
-      char type = getOverloadArgType(overload);
+      char type = builtin.argType;
       for (unsigned i = 0; i < result.num; i++)
       {
         int64_t c = SARGV(2, i);
@@ -2788,7 +2728,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
     }
@@ -2817,42 +2757,36 @@ namespace oclgrind
     DEFINE_BUILTIN(vload)
     {
       size_t base = PARG(1);
-      unsigned int addressSpace = ARG(1)->getType()->getPointerAddressSpace();
       uint64_t offset = UARG(0);
 
       size_t address = base + offset*result.size*result.num;
       size_t size = result.size*result.num;
-      workItem->getMemory(addressSpace)->load(result.data, address, size);
+      workItem->getMemory(builtin.addrSpace)->load(result.data, address, size);
     }
 
     DEFINE_BUILTIN(vstore)
     {
-      const llvm::Value *value = ARG(0);
-      unsigned size = getTypeSize(value->getType());
-      if (isVector3(value))
-      {
-        // 3-element vectors are same size as 4-element vectors,
-        // but vstore address offset shouldn't use this.
-        size = (size/4) * 3;
-      }
+      // 3-element vectors are stored without padding
+      TypedValue value = workItem->getArgument(0);
+      size_t size = value.size*value.num;
 
       size_t base = PARG(2);
-      unsigned int addressSpace = ARG(2)->getType()->getPointerAddressSpace();
       uint64_t offset = UARG(1);
 
       size_t address = base + offset*size;
-      unsigned char *data = workItem->getOperand(value).data;
-      workItem->getMemory(addressSpace)->store(data, address, size);
+      workItem->getMemory(builtin.addrSpace)->store(value.data, address, size);
     }
 
+    // The vloada_half and vstorea_half variants align 3-element vectors to
+    // 4 elements
+    template<bool aligned>
     DEFINE_BUILTIN(vload_half)
     {
       size_t base = PARG(1);
-      unsigned int addressSpace = ARG(1)->getType()->getPointerAddressSpace();
       uint64_t offset = UARG(0);
 
       size_t address;
-      if (fnName.compare(0, 6, "vloada") == 0 && result.num == 3)
+      if (aligned && result.num == 3)
       {
         address = base + offset*sizeof(cl_half)*4;
       }
@@ -2861,9 +2795,9 @@ namespace oclgrind
         address = base + offset*sizeof(cl_half)*result.num;
       }
       size_t size = sizeof(cl_half)*result.num;
-      uint16_t *halfData = (uint16_t*)workItem->m_pool.alloc(2*result.num);
-      workItem->getMemory(addressSpace)->load((unsigned char*)halfData,
-                                              address, size);
+      uint16_t *halfData = (uint16_t*)workItem->m_scratch.alloc(2*result.num);
+      workItem->getMemory(builtin.addrSpace)->load((unsigned char*)halfData,
+                                                   address, size);
 
       // Convert to floats
       for (unsigned i = 0; i < result.num; i++)
@@ -2872,36 +2806,20 @@ namespace oclgrind
       }
     }
 
+    template<bool aligned>
     DEFINE_BUILTIN(vstore_half)
     {
-      const llvm::Value *value = ARG(0);
-      unsigned size = getTypeSize(value->getType());
-      if (isVector3(value))
-      {
-        // 3-element vectors are same size as 4-element vectors,
-        // but vstore address offset shouldn't use this.
-        size = (size/4) * 3;
-      }
-
-
       size_t base = PARG(2);
-      unsigned int addressSpace = ARG(2)->getType()->getPointerAddressSpace();
       uint64_t offset = UARG(1);
 
       // Convert to halfs
-      TypedValue op = workItem->getOperand(value);
+      TypedValue op = workItem->getArgument(0);
       unsigned char *data = op.data;
-      size = op.num*sizeof(cl_half);
-      uint16_t *halfData = (uint16_t*)workItem->m_pool.alloc(2*op.num);
-
-      // Parse rounding mode (RTE is the default)
-      HalfRoundMode rmode = Half_RTE;
-      if (fnName.find("_rtz") != std::string::npos)
-        rmode = Half_RTZ;
-      else if (fnName.find("_rtn") != std::string::npos)
-        rmode = Half_RTN;
-      else if (fnName.find("_rtp") != std::string::npos)
-        rmode = Half_RTP;
+      size_t size = op.num*sizeof(cl_half);
+      uint16_t *halfData = (uint16_t*)workItem->m_scratch.alloc(2*op.num);
+
+      // Use rounding mode (RTE is the default)
+      HalfRoundMode rmode = getHalfRoundMode(builtin.rounding);
 
       for (unsigned i = 0; i < op.num; i++)
       {
@@ -2912,7 +2830,7 @@ namespace oclgrind
       }
 
       size_t address;
-      if (fnName.compare(0, 7, "vstorea") == 0 && op.num == 3)
+      if (aligned && op.num == 3)
       {
         address = base + offset*sizeof(cl_half)*4;
       }
@@ -2921,8 +2839,8 @@ namespace oclgrind
         address = base + offset*sizeof(cl_half)*op.num;
       }
 
-      workItem->getMemory(addressSpace)->store((unsigned char*)halfData,
-                                               address, size);
+      workItem->getMemory(builtin.addrSpace)->store((unsigned char*)halfData,
+                                                    address, size);
     }
 
 
@@ -2995,12 +2913,26 @@ namespace oclgrind
     // Other Functions //
     /////////////////////
 
-    static void setConvertRoundingMode(const string& name, int def)
+    static HalfRoundMode getHalfRoundMode(char rounding)
+    {
+      switch (rounding)
+      {
+      case 'z':
+        return Half_RTZ;
+      case 'n':
+        return Half_RTN;
+      case 'p':
+        return Half_RTP;
+      default:
+        return Half_RTE;
+      }
+    }
+
+    static void setConvertRoundingMode(char rounding, int def)
     {
-      size_t rpos = name.find("_rt");
-      if (rpos != string::npos)
+      if (rounding)
       {
-        switch (name[rpos+3])
+        switch (rounding)
         {
         case 'e':
           fesetround(FE_TONEAREST);
@@ -3015,7 +2947,7 @@ namespace oclgrind
           fesetround(FE_DOWNWARD);
           break;
         default:
-          FATAL_ERROR("Unsupported rounding mode: %c", name[rpos+3]);
+          FATAL_ERROR("Unsupported rounding mode: %c", rounding);
         }
       }
       else
@@ -3028,11 +2960,11 @@ namespace oclgrind
     {
       // Use rounding mode
       const int origRnd = fegetround();
-      setConvertRoundingMode(fnName, FE_TONEAREST);
+      setConvertRoundingMode(builtin.rounding, FE_TONEAREST);
 
       for (unsigned i = 0; i < result.num; i++)
       {
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -3058,7 +2990,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
       }
       fesetround(origRnd);
@@ -3067,14 +2999,8 @@ namespace oclgrind
     DEFINE_BUILTIN(convert_half)
     {
       float f;
-      HalfRoundMode rmode = Half_RTE;
-      if (fnName.find("_rtz") != std::string::npos)
-        rmode = Half_RTZ;
-      else if (fnName.find("_rtn") != std::string::npos)
-        rmode = Half_RTN;
-      else if (fnName.find("_rtp") != std::string::npos)
-        rmode = Half_RTP;
-      const char srcType = getOverloadArgType(overload);
+      HalfRoundMode rmode = getHalfRoundMode(builtin.rounding);
+      const char srcType = builtin.argType;
       for (unsigned i = 0; i < result.num; i++)
       {
         switch (srcType)
@@ -3096,7 +3022,7 @@ namespace oclgrind
             f = FARGV(0, i);
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
         result.setUInt(floatToHalf(f, rmode), i);
       }
@@ -3105,7 +3031,7 @@ namespace oclgrind
     DEFINE_BUILTIN(convert_uint)
     {
       // Check for saturation modifier
-      bool sat = fnName.find("_sat") != string::npos;
+      bool sat = builtin.saturate;
       uint64_t max;
       switch (result.size)
       {
@@ -3125,12 +3051,12 @@ namespace oclgrind
 
       // Use rounding mode
       const int origRnd = fegetround();
-      setConvertRoundingMode(fnName, FE_TOWARDZERO);
+      setConvertRoundingMode(builtin.rounding, FE_TOWARDZERO);
 
       for (unsigned i = 0; i < result.num; i++)
       {
         uint64_t r;
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -3176,7 +3102,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
 
         result.setUInt(r, i);
@@ -3187,7 +3113,7 @@ namespace oclgrind
     DEFINE_BUILTIN(convert_sint)
     {
       // Check for saturation modifier
-      bool sat = fnName.find("_sat") != string::npos;
+      bool sat = builtin.saturate;
       int64_t min, max;
       switch (result.size)
       {
@@ -3211,12 +3137,12 @@ namespace oclgrind
 
       // Use rounding mode
       const int origRnd = fegetround();
-      setConvertRoundingMode(fnName, FE_TOWARDZERO);
+      setConvertRoundingMode(builtin.rounding, FE_TOWARDZERO);
 
       for (unsigned i = 0; i < result.num; i++)
       {
         int64_t r;
-        switch (getOverloadArgType(overload))
+        switch (builtin.argType)
         {
           case 'h':
           case 't':
@@ -3252,7 +3178,7 @@ namespace oclgrind
             break;
           default:
             FATAL_ERROR("Unsupported argument type: %c",
-                        getOverloadArgType(overload));
+                        builtin.argType);
         }
 
         result.setSInt(r, i);
@@ -3483,7 +3409,7 @@ namespace oclgrind
       unsigned destAddrSpace = memcpyInst->getDestAddressSpace();
       unsigned srcAddrSpace = memcpyInst->getSourceAddressSpace();
 
-      unsigned char *buffer = workItem->m_pool.alloc(size);
+      unsigned char *buffer = workItem->m_scratch.alloc(size);
       workItem->getMemory(srcAddrSpace)->load(buffer, src, size);
       workItem->getMemory(destAddrSpace)->store(buffer, dest, size);
     }
@@ -3495,7 +3421,7 @@ namespace oclgrind
       size_t size = workItem->getOperand(memsetInst->getLength()).getUInt();
       unsigned addressSpace = memsetInst->getDestAddressSpace();
 
-      unsigned char *buffer = workItem->m_pool.alloc(size);
+      unsigned char *buffer = workItem->m_scratch.alloc(size);
       unsigned char value = UARG(1);
       memset(buffer, value, size);
       workItem->getMemory(addressSpace)->store(buffer, dest, size);
@@ -3513,7 +3439,7 @@ namespace oclgrind
   // Utility macros for generating builtin function map
 #define CAST                                \
   void(*)(WorkItem*, const llvm::CallInst*, \
-  const std::string&, const std::string&, TypedValue& result, void*)
+  const Builtin&, TypedValue& result, void*)
 #define F1ARG(name) (double(*)(double))name
 #define F2ARG(name) (double(*)(double,double))name
 #define F3ARG(name) (double(*)(double,double,double))name
@@ -3531,8 +3457,9 @@ namespace oclgrind
     BuiltinFunctionMap builtins;
 
     // Async Copy and Prefetch Functions
-    ADD_BUILTIN("async_work_group_copy", async_work_group_copy, NULL);
-    ADD_BUILTIN("async_work_group_strided_copy", async_work_group_copy, NULL);
+    ADD_BUILTIN("async_work_group_copy", async_work_group_copy<false>, NULL);
+    ADD_BUILTIN("async_work_group_strided_copy",
+                async_work_group_copy<true>, NULL);
     ADD_BUILTIN("wait_group_events", wait_group_events, NULL);
     ADD_BUILTIN("prefetch", prefetch, NULL);
 
@@ -3745,10 +3672,10 @@ namespace oclgrind
     ADD_BUILTIN("write_mem_fence", mem_fence, NULL);
 
     // Vector Data Load and Store Functions
-    ADD_PREFIX_BUILTIN("vload_half", vload_half, NULL);
-    ADD_PREFIX_BUILTIN("vloada_half", vload_half, NULL);
-    ADD_PREFIX_BUILTIN("vstore_half", vstore_half, NULL);
-    ADD_PREFIX_BUILTIN("vstorea_half", vstore_half, NULL);
+    ADD_PREFIX_BUILTIN("vload_half", vload_half<false>, NULL);
+    ADD_PREFIX_BUILTIN("vloada_half", vload_half<true>, NULL);
+    ADD_PREFIX_BUILTIN("vstore_half", vstore_half<false>, NULL);
+    ADD_PREFIX_BUILTIN("vstorea_half", vstore_half<true>, NULL);
     ADD_PREFIX_BUILTIN("vload", vload, NULL);
     ADD_PREFIX_BUILTIN("vstore", vstore, NULL);
 
@@ -325,6 +325,32 @@ int __OVERLOAD__ atomic_cmpxchg(volatile __local int *p, int cmp, int val);
 uint __OVERLOAD__ atomic_cmpxchg(volatile __global uint *p, uint cmp, uint val);
 uint __OVERLOAD__ atomic_cmpxchg(volatile __local uint *p, uint cmp, uint val);
 
+// cl_khr_int64_base_atomics and cl_khr_int64_extended_atomics
+#define ATOMIC64_0ARG(name)            \
+  ATOMIC_0ARG_DEF(atom_##name, long);  \
+  ATOMIC_0ARG_DEF(atom_##name, ulong);
+#define ATOMIC64_1ARG(name)            \
+  ATOMIC_1ARG_DEF(atom_##name, long);  \
+  ATOMIC_1ARG_DEF(atom_##name, ulong);
+
+ATOMIC64_1ARG(add);
+ATOMIC64_1ARG(and);
+ATOMIC64_0ARG(dec);
+ATOMIC64_0ARG(inc);
+ATOMIC64_1ARG(max);
+ATOMIC64_1ARG(min);
+ATOMIC64_1ARG(or);
+ATOMIC64_1ARG(sub);
+ATOMIC64_1ARG(xchg);
+ATOMIC64_1ARG(xor);
+
+long __OVERLOAD__ atom_cmpxchg(volatile __global long *p, long cmp, long val);
+long __OVERLOAD__ atom_cmpxchg(volatile __local long *p, long cmp, long val);
+ulong __OVERLOAD__ atom_cmpxchg(volatile __global ulong *p,
+                                ulong cmp, ulong val);
+ulong __OVERLOAD__ atom_cmpxchg(volatile __local ulong *p,
+                                ulong cmp, ulong val);
+
 
 //////////////////////
 // Common Functions //
@@ -766,6 +766,32 @@ namespace oclgrind
     return buffer;
   }
 
+  void MemoryPool::reset()
+  {
+    // Keep the current block for reuse, and release everything else
+    uint8_t *current = NULL;
+    if (m_offset < m_blockSize)
+    {
+      current = m_blocks.front();
+      m_blocks.pop_front();
+    }
+    for (auto itr = m_blocks.begin(); itr != m_blocks.end(); itr++)
+    {
+      delete[] *itr;
+    }
+    m_blocks.clear();
+
+    if (current)
+    {
+      m_blocks.push_back(current);
+      m_offset = 0;
+    }
+    else
+    {
+      m_offset = m_blockSize;
+    }
+  }
+
   TypedValue MemoryPool::clone(const TypedValue& source)
   {
     TypedValue dest;
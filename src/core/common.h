@@ -216,6 +216,7 @@ namespace oclgrind
     ~MemoryPool();
     uint8_t* alloc(size_t size);
     TypedValue clone(const TypedValue& source);
+    void reset();
   private:
     size_t m_blockSize;
     size_t m_offset;
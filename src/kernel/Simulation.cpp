@@ -8,6 +8,7 @@
 
 #include "config.h"
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <sstream>
@@ -719,14 +720,24 @@ void Simulation::parseRange(unsigned char *result, size_t size,
   }
 }
 
-void Simulation::run(bool dumpGlobalMemory)
+void Simulation::run(bool dumpGlobalMemory, bool reportTiming)
 {
   assert(m_kernel && m_program);
   assert(m_kernel->allArgumentsSet());
 
+  // The program has already been built, so this only times the kernel
+  typedef chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+
   Size3 offset(0, 0, 0);
   KernelInvocation::run(m_context, m_kernel, 3, offset, m_ndrange, m_wgsize);
 
+  if (reportTiming)
+  {
+    chrono::duration<double> elapsed = Clock::now() - start;
+    cerr << "Kernel execution time: " << elapsed.count() << " s" << endl;
+  }
+
   // Dump individual arguments
   cout << dec;
   list<DumpArg>::iterator itr;
@@ -42,7 +42,7 @@ class Simulation
     virtual ~Simulation();
 
     bool load(const char *filename);
-    void run(bool dumpGlobalMemory=false);
+    void run(bool dumpGlobalMemory=false, bool reportTiming=false);
 
   private:
     oclgrind::Context *m_context;
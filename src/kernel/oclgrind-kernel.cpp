@@ -18,6 +18,7 @@ using namespace oclgrind;
 using namespace std;
 
 static bool outputGlobalMemory = false;
+static bool outputTiming = false;
 static const char *simfile = NULL;
 
 static bool parseArguments(int argc, char *argv[]);
@@ -40,14 +41,18 @@ int main(int argc, char *argv[])
   }
 
   // Run simulation
-  simulation.run(outputGlobalMemory);
+  simulation.run(outputGlobalMemory, outputTiming);
 }
 
 static bool parseArguments(int argc, char *argv[])
 {
   for (int i = 1; i < argc; i++)
   {
-    if (!strcmp(argv[i], "--build-options"))
+    if (!strcmp(argv[i], "--access-patterns"))
+    {
+      setEnvironment("OCLGRIND_ACCESS_PATTERNS", "1");
+    }
+    else if (!strcmp(argv[i], "--build-options"))
     {
       if (++i >= argc)
       {
@@ -72,11 +77,24 @@ static bool parseArguments(int argc, char *argv[])
     {
       outputGlobalMemory = true;
     }
+    else if (!strcmp(argv[i], "--group-order"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --group-order" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_GROUP_ORDER", argv[i]);
+    }
     else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
     {
       printUsage();
       exit(0);
     }
+    else if (!strcmp(argv[i], "--huge-pages"))
+    {
+      setEnvironment("OCLGRIND_HUGE_PAGES", "1");
+    }
     else if (!strcmp(argv[i], "--inst-counts"))
     {
       setEnvironment("OCLGRIND_INST_COUNTS", "1");
@@ -85,6 +103,14 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_INTERACTIVE", "1");
     }
+    else if (!strcmp(argv[i], "--jit"))
+    {
+      setEnvironment("OCLGRIND_JIT", "1");
+    }
+    else if (!strcmp(argv[i], "--lockstep"))
+    {
+      setEnvironment("OCLGRIND_LOCKSTEP", "1");
+    }
     else if (!strcmp(argv[i], "--log"))
     {
       if (++i >= argc)
@@ -112,6 +138,15 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_NUM_THREADS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--num-banks"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --num-banks" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_NUM_BANKS", argv[i]);
+    }
     else if (!strcmp(argv[i], "--pch-dir"))
     {
       if (++i >= argc)
@@ -130,10 +165,36 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_PLUGINS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--pool-stats"))
+    {
+      setEnvironment("OCLGRIND_POOL_STATS", "1");
+    }
+    else if (!strcmp(argv[i], "--profile"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --profile" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_PROFILE", argv[i]);
+    }
     else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quick"))
     {
       setEnvironment("OCLGRIND_QUICK", "1");
     }
+    else if (!strcmp(argv[i], "--swap-dir"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --swap-dir" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_SWAP_DIR", argv[i]);
+    }
+    else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--timing"))
+    {
+      outputTiming = true;
+    }
     else if (!strcmp(argv[i], "--uniform-writes"))
     {
       setEnvironment("OCLGRIND_UNIFORM_WRITES", "1");
@@ -142,6 +203,15 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_UNINITIALIZED", "1");
     }
+    else if (!strcmp(argv[i], "--window-size"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --window-size" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_WINDOW_SIZE", argv[i]);
+    }
     else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--version"))
     {
       cout << endl;
@@ -189,6 +259,8 @@ static void printUsage()
     << "       oclgrind-kernel [--help | --version]" << endl
     << endl
     << "Options:" << endl
+    << "     --access-patterns         "
+             "Report memory access coalescing and bank conflicts" << endl
     << "     --build-options  OPTIONS  "
              "Additional options to pass to the OpenCL compiler" << endl
     << "     --data-races              "
@@ -199,30 +271,51 @@ static void printUsage()
              "Dump SPIR to /tmp/oclgrind_*.{ll,bc}" << endl
     << "  -g --global-mem              "
              "Output global memory at exit" << endl
+    << "     --group-order    ORDER    "
+             "Order to run work-groups in (row-major|morton|tiled)" << endl
     << "  -h --help                    "
              "Display usage information" << endl
+    << "     --huge-pages              "
+             "Use huge pages for large global memory buffers" << endl
     << "     --inst-counts             "
              "Output histograms of instructions executed" << endl
     << "  -i --interactive             "
              "Enable interactive mode" << endl
+    << "     --jit                     "
+             "Compile kernels to native code where possible" << endl
+    << "     --lockstep                "
+             "Execute work-items in lockstep where possible" << endl
     << "     --log            LOGFILE  "
              "Redirect log/error messages to a file" << endl
     << "     --max-errors     NUM      "
              "Limit the number of error/warning messages" << endl
+    << "     --num-banks      NUM      "
+             "Set the number of local memory banks to analyze" << endl
     << "     --num-threads    NUM      "
              "Set the number of worker threads to use" << endl
     << "     --pch-dir        DIR      "
              "Override directory containing precompiled headers" << endl
     << "     --plugins        PLUGINS  "
              "Load colon separated list of plugin libraries" << endl
+    << "     --pool-stats              "
+             "Output worker thread pool statistics at exit" << endl
+    << "     --profile        FILE     "
+             "Write a callgrind format profile to a file" << endl
     << "  -q --quick                   "
              "Only run first and last work-group" << endl
+    << "     --swap-dir       DIR      "
+             "Back global memory buffers with files in a directory" << endl
+    << "  -t --timing                  "
+             "Report the time taken to execute the kernel" << endl
     << "     --uniform-writes          "
              "Don't suppress uniform write-write data-races" << endl
     << "     --uninitialized           "
              "Report loads from uninitialized memory locations" << endl
     << "  -v --version                 "
              "Display version information" << endl
+    << "     --window-size    NUM      "
+             "Set the number of work-items to analyze accesses across"
+             << endl
     << endl
     << "For more information, please visit the Oclgrind wiki page:" << endl
     << "-> https://github.com/jrprice/Oclgrind/wiki" << endl
@@ -0,0 +1,375 @@
+// AccessAnalyzer.cpp (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "core/common.h"
+
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+
+#include "AccessAnalyzer.h"
+
+#include "core/Kernel.h"
+#include "core/KernelInvocation.h"
+#include "core/Memory.h"
+#include "core/WorkGroup.h"
+#include "core/WorkItem.h"
+
+using namespace oclgrind;
+using namespace std;
+
+#define DEFAULT_WINDOW_SIZE 32
+#define DEFAULT_NUM_BANKS   32
+#define SEGMENT_SIZE        128
+#define BANK_WIDTH          4
+
+static size_t getLineNumber(const llvm::Instruction *instruction)
+{
+  llvm::MDNode *md = instruction->getMetadata("dbg");
+  if (md)
+  {
+#if LLVM_VERSION > 36
+    llvm::DILocation *loc = (llvm::DILocation*)md;
+    return loc->getLine();
+#else
+    llvm::DILocation loc((llvm::MDLocation*)md);
+    return loc.getLineNumber();
+#endif
+  }
+  return 0;
+}
+
+static size_t getInstructionIndex(const llvm::Instruction *instruction)
+{
+  size_t index = 0;
+  const llvm::Function *function = instruction->getParent()->getParent();
+  for (auto B = function->begin(); B != function->end(); B++)
+  {
+    for (auto I = B->begin(); I != B->end(); I++, index++)
+    {
+      if (&*I == instruction)
+        return index;
+    }
+  }
+  return index;
+}
+
+static size_t getEnvSize(const char *name, size_t defaultValue)
+{
+  const char *value = getenv(name);
+  if (!value)
+    return defaultValue;
+
+  char *next;
+  size_t result = strtoul(value, &next, 10);
+  if (strlen(next) || result == 0)
+  {
+    cerr << "Oclgrind: Invalid value for " << name << endl;
+    return defaultValue;
+  }
+  return result;
+}
+
+AccessAnalyzer::AccessAnalyzer(const Context *context)
+ : Plugin(context)
+{
+  m_windowSize = getEnvSize("OCLGRIND_WINDOW_SIZE", DEFAULT_WINDOW_SIZE);
+  m_numBanks   = getEnvSize("OCLGRIND_NUM_BANKS", DEFAULT_NUM_BANKS);
+}
+
+bool AccessAnalyzer::handlesAddressSpace(unsigned addrSpace) const
+{
+  return addrSpace != AddrSpacePrivate;
+}
+
+bool AccessAnalyzer::handlesEvent(EventType event) const
+{
+  switch (event)
+  {
+  case KERNEL_BEGIN:
+  case KERNEL_END:
+  case MEMORY_LOAD:
+  case MEMORY_STORE:
+  case WORK_GROUP_BEGIN:
+  case WORK_GROUP_COMPLETE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void AccessAnalyzer::kernelBegin(const KernelInvocation *kernelInvocation)
+{
+  m_workers.begin(kernelInvocation, WorkerState());
+}
+
+void AccessAnalyzer::kernelEnd(const KernelInvocation *kernelInvocation)
+{
+  // Merge the statistics from each worker
+  vector<WorkerState> workers = m_workers.end(kernelInvocation);
+  StatisticsMap statistics;
+  for (auto W = workers.begin(); W != workers.end(); W++)
+  {
+    for (auto S = W->statistics.begin(); S != W->statistics.end(); S++)
+    {
+      Statistics& instStats = statistics[S->first];
+      instStats.addrSpace = S->second.addrSpace;
+      instStats.store = S->second.store;
+      instStats += S->second;
+    }
+  }
+
+  // Combine statistics for the same kind of access on each source line
+  // Instructions are listed in source order, so that output is repeatable
+  map<tuple<const llvm::Function*,size_t,unsigned,bool>,Statistics> lines;
+  set<tuple<size_t,size_t,const llvm::Instruction*>> instructions;
+  for (auto S = statistics.begin(); S != statistics.end(); S++)
+  {
+    const llvm::Instruction *instruction = S->first;
+    Statistics& line = lines[make_tuple(instruction->getParent()->getParent(),
+                                        getLineNumber(instruction),
+                                        S->second.addrSpace,
+                                        S->second.store)];
+    line.addrSpace = S->second.addrSpace;
+    line.store = S->second.store;
+    line += S->second;
+
+    instructions.insert(make_tuple(getLineNumber(instruction),
+                                   getInstructionIndex(instruction),
+                                   instruction));
+  }
+
+  // Output is serialised in case several kernels finish at once
+  lock_guard<mutex> lock(m_outputMutex);
+
+  cout << "Memory access patterns for kernel '"
+       << kernelInvocation->getKernel()->getName() << "' ("
+       << m_windowSize << " work-item windows, "
+       << SEGMENT_SIZE << " byte segments, "
+       << m_numBanks << " local memory banks):" << endl;
+
+  cout << endl << "Per source line:" << endl;
+  for (auto L = lines.begin(); L != lines.end(); L++)
+  {
+    cout << "  Line " << dec << get<1>(L->first) << " of "
+         << get<0>(L->first)->getName().str() << ":" << endl;
+    printStatistics(L->second);
+  }
+
+  cout << endl << "Per instruction:" << endl;
+  for (auto I = instructions.begin(); I != instructions.end(); I++)
+  {
+    const llvm::Instruction *instruction = get<2>(*I);
+    cout << " ";
+    dumpInstruction(cout, instruction);
+    cout << endl;
+    printStatistics(statistics.at(instruction));
+  }
+  cout << endl;
+}
+
+void AccessAnalyzer::memoryLoad(const Memory *memory,
+                                const WorkItem *workItem,
+                                size_t address, size_t size)
+{
+  registerAccess(memory, workItem, address, size, false);
+}
+
+void AccessAnalyzer::memoryStore(const Memory *memory,
+                                 const WorkItem *workItem,
+                                 size_t address, size_t size,
+                                 const uint8_t *storeData)
+{
+  registerAccess(memory, workItem, address, size, true);
+}
+
+void AccessAnalyzer::workGroupBegin(const WorkGroup *workGroup)
+{
+  m_workers.bind();
+  m_workers.get().groups[workGroup];
+}
+
+void AccessAnalyzer::workGroupComplete(const WorkGroup *workGroup)
+{
+  WorkerState& worker = m_workers.get();
+  WorkGroupState& state = worker.groups.at(workGroup);
+
+  // Analyze each window access made by the work-group
+  StatisticsMap& statistics = worker.statistics;
+  for (auto W = state.windows.begin(); W != state.windows.end(); W++)
+  {
+    const WindowAccesses& window = W->second;
+    Statistics& instStats = statistics[get<0>(W->first)];
+    instStats.addrSpace = window.addrSpace;
+    instStats.store = get<1>(W->first);
+    for (auto I = window.instances.begin(); I != window.instances.end(); I++)
+    {
+      analyze(window, *I, instStats);
+    }
+  }
+
+  // Clean-up work-group state
+  worker.groups.erase(workGroup);
+}
+
+void AccessAnalyzer::analyze(const WindowAccesses& window,
+                             const vector<Access>& accesses,
+                             Statistics& statistics) const
+{
+  statistics.accesses++;
+  statistics.lanes += accesses.size();
+
+  // Count distinct segments touched by the window
+  set<size_t> segments;
+  for (auto A = accesses.begin(); A != accesses.end(); A++)
+  {
+    size_t address = get<1>(*A);
+    size_t size = get<2>(*A);
+    for (size_t s = address/SEGMENT_SIZE;
+         s <= (address+size-1)/SEGMENT_SIZE; s++)
+    {
+      segments.insert(s);
+    }
+  }
+  statistics.segments += segments.size();
+
+  // Classify the access pattern by the stride between lanes
+  vector<Access> sorted(accesses);
+  sort(sorted.begin(), sorted.end());
+  bool uniform = true, constant = true;
+  int64_t stride = 0;
+  for (size_t i = 1; i < sorted.size(); i++)
+  {
+    int64_t laneDiff    = get<0>(sorted[i]) - get<0>(sorted[i-1]);
+    int64_t addressDiff = get<1>(sorted[i]) - get<1>(sorted[i-1]);
+    if (addressDiff != 0)
+      uniform = false;
+    if (laneDiff == 0 || addressDiff % laneDiff)
+    {
+      constant = false;
+      continue;
+    }
+
+    int64_t laneStride = addressDiff / laneDiff;
+    if (i == 1)
+      stride = laneStride;
+    else if (laneStride != stride)
+      constant = false;
+  }
+
+  if (uniform)
+    statistics.uniform++;
+  else if (!constant)
+    statistics.irregular++;
+  else if (stride == (int64_t)get<2>(sorted.front()))
+    statistics.contiguous++;
+  else
+    statistics.strided++;
+
+  // Count bank conflicts as the largest number of distinct words that the
+  // window accesses in a single bank, since lanes accessing the same word
+  // are served by a broadcast
+  if (window.addrSpace == AddrSpaceLocal)
+  {
+    vector< set<size_t> > banks(m_numBanks);
+    size_t degree = 1;
+    for (auto A = accesses.begin(); A != accesses.end(); A++)
+    {
+      size_t address = get<1>(*A);
+      size_t size = get<2>(*A);
+      for (size_t w = address/BANK_WIDTH;
+           w <= (address+size-1)/BANK_WIDTH; w++)
+      {
+        set<size_t>& bank = banks[w % m_numBanks];
+        bank.insert(w);
+        degree = max(degree, bank.size());
+      }
+    }
+    statistics.conflicts += degree - 1;
+  }
+}
+
+void AccessAnalyzer::printStatistics(const Statistics& statistics) const
+{
+  double accesses = statistics.accesses;
+  streamsize precision = cout.precision();
+
+  cout << "    " << getAddressSpaceName(statistics.addrSpace)
+       << (statistics.store ? " store" : " load") << ", "
+       << statistics.accesses << " window accesses from "
+       << statistics.lanes << " work-item accesses" << endl;
+
+  cout << "    " << fixed << setprecision(2)
+       << statistics.segments/accesses << " segments per access, "
+       << 100*statistics.contiguous/accesses << "% contiguous, "
+       << 100*statistics.strided/accesses << "% strided, "
+       << 100*statistics.uniform/accesses << "% uniform, "
+       << 100*statistics.irregular/accesses << "% irregular" << endl;
+
+  if (statistics.addrSpace == AddrSpaceLocal)
+  {
+    cout << "    " << statistics.conflicts/accesses
+         << " bank conflicts per access" << endl;
+  }
+  cout.unsetf(ios::floatfield);
+  cout.precision(precision);
+}
+
+void AccessAnalyzer::registerAccess(const Memory *memory,
+                                    const WorkItem *workItem,
+                                    size_t address, size_t size, bool store)
+{
+  const llvm::Instruction *instruction = workItem->getCurrentInstruction();
+  if (!instruction || !size)
+    return;
+
+  WorkGroupState& state = m_workers.get().groups.at(workItem->getWorkGroup());
+
+  // Accesses from the nth execution of an instruction by each work-item in
+  // a window are grouped together
+  size_t index  = workItem->getGlobalIndex();
+  size_t window = index / m_windowSize;
+  size_t lane   = index % m_windowSize;
+  size_t instance =
+    state.executions[make_tuple(instruction, store, workItem)]++;
+
+  WindowAccesses& accesses =
+    state.windows[make_tuple(instruction, store, window)];
+  accesses.addrSpace = memory->getAddressSpace();
+  if (instance >= accesses.instances.size())
+    accesses.instances.resize(instance+1);
+  accesses.instances[instance].push_back(make_tuple(lane, address, size));
+}
+
+AccessAnalyzer::Statistics::Statistics()
+{
+  addrSpace  = AddrSpacePrivate;
+  store      = false;
+  accesses   = 0;
+  lanes      = 0;
+  segments   = 0;
+  contiguous = 0;
+  strided    = 0;
+  uniform    = 0;
+  irregular  = 0;
+  conflicts  = 0;
+}
+
+AccessAnalyzer::Statistics&
+AccessAnalyzer::Statistics::operator+=(const Statistics& statistics)
+{
+  accesses   += statistics.accesses;
+  lanes      += statistics.lanes;
+  segments   += statistics.segments;
+  contiguous += statistics.contiguous;
+  strided    += statistics.strided;
+  uniform    += statistics.uniform;
+  irregular  += statistics.irregular;
+  conflicts  += statistics.conflicts;
+  return *this;
+}
@@ -0,0 +1,94 @@
+// AccessAnalyzer.h (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "core/Plugin.h"
+
+#include <mutex>
+#include <tuple>
+
+#include "WorkerData.h"
+
+namespace oclgrind
+{
+  // Groups the memory accesses made by each instruction across windows of
+  // consecutive work-items, as a GPU would issue them for a sub-group, and
+  // reports how well they coalesce and how many local memory bank conflicts
+  // they cause
+  class AccessAnalyzer : public Plugin
+  {
+  public:
+    AccessAnalyzer(const Context *context);
+
+    virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
+    virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
+    virtual void memoryLoad(const Memory *memory, const WorkItem *workItem,
+                            size_t address, size_t size) override;
+    virtual void memoryStore(const Memory *memory, const WorkItem *workItem,
+                             size_t address, size_t size,
+                             const uint8_t *storeData) override;
+    virtual void workGroupBegin(const WorkGroup *workGroup) override;
+    virtual void workGroupComplete(const WorkGroup *workGroup) override;
+
+    virtual bool handlesAddressSpace(unsigned addrSpace) const override;
+    virtual bool handlesEvent(EventType event) const override;
+
+  private:
+    size_t m_windowSize;
+    size_t m_numBanks;
+
+    struct Statistics
+    {
+      unsigned addrSpace;
+      bool store;
+      size_t accesses;    // Window accesses
+      size_t lanes;       // Work-item accesses
+      size_t segments;    // Distinct memory segments touched
+      size_t contiguous;  // Window accesses with unit stride
+      size_t strided;     // Window accesses with a constant non-unit stride
+      size_t uniform;     // Window accesses with all lanes at one address
+      size_t irregular;   // Window accesses with no constant stride
+      size_t conflicts;   // Extra local memory transactions due to conflicts
+      Statistics();
+      Statistics& operator+=(const Statistics& statistics);
+    };
+    typedef std::map<const llvm::Instruction*,Statistics> StatisticsMap;
+
+    // Accesses made by an instruction for a window of work-items, with one
+    // list of (lane, address, size) tuples for each time it was executed
+    typedef std::tuple<size_t,size_t,size_t> Access;
+    typedef std::tuple<const llvm::Instruction*,bool,size_t> WindowKey;
+    struct WindowAccesses
+    {
+      unsigned addrSpace;
+      std::vector< std::vector<Access> > instances;
+    };
+    struct WorkGroupState
+    {
+      std::map<WindowKey,WindowAccesses> windows;
+      std::map<std::tuple<const llvm::Instruction*,bool,const WorkItem*>,
+               size_t> executions;
+    };
+
+    // Each worker analyzes the accesses made by its work-groups when they
+    // complete, and the statistics are merged when the kernel ends
+    struct WorkerState
+    {
+      std::unordered_map<const WorkGroup*,WorkGroupState> groups;
+      StatisticsMap statistics;
+    };
+    WorkerData<WorkerState> m_workers;
+    std::mutex m_outputMutex;
+
+    void analyze(const WindowAccesses& window,
+                 const std::vector<Access>& accesses,
+                 Statistics& statistics) const;
+    void printStatistics(const Statistics& statistics) const;
+    void registerAccess(const Memory *memory, const WorkItem *workItem,
+                        size_t address, size_t size, bool store);
+  };
+}
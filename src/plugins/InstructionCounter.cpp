@@ -13,6 +13,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 
 #include "InstructionCounter.h"
@@ -32,14 +33,16 @@ static bool compareNamedCount(pair<string,size_t> a, pair<string,size_t> b)
   return a.second > b.second;
 }
 
-string InstructionCounter::getOpcodeName(unsigned opcode) const
+string InstructionCounter::getOpcodeName(const Counts& counts,
+                                         unsigned opcode) const
 {
   if (opcode >= COUNTED_CALL_BASE)
   {
     // Get functon name
     unsigned index = opcode - COUNTED_CALL_BASE;
-    assert(index < m_functions.size());
-    return "call " + m_functions[index]->getName().str() + "()";
+    assert(index < counts.functions->functions.size());
+    return "call " +
+      counts.functions->functions[index]->getName().str() + "()";
   }
   else if (opcode >= COUNTED_LOAD_BASE)
   {
@@ -49,7 +52,7 @@ string InstructionCounter::getOpcodeName(unsigned opcode) const
     name.imbue(defaultLocale);
 
     // Get number of bytes
-    size_t bytes = m_memopBytes[opcode-COUNTED_LOAD_BASE];
+    size_t bytes = counts.memopBytes[opcode-COUNTED_LOAD_BASE];
 
     // Get name of operation
     if (opcode >= COUNTED_STORE_BASE)
@@ -75,10 +78,18 @@ string InstructionCounter::getOpcodeName(unsigned opcode) const
   return llvm::Instruction::getOpcodeName(opcode);
 }
 
+bool InstructionCounter::handlesEvent(EventType event) const
+{
+  return event == INSTRUCTION_EXECUTED ||
+         event == KERNEL_BEGIN || event == KERNEL_END ||
+         event == WORK_GROUP_BEGIN;
+}
+
 void InstructionCounter::instructionExecuted(
   const WorkItem *workItem, const llvm::Instruction *instruction,
   const TypedValue& result)
 {
+  Counts& counts = m_counts.get();
   unsigned opcode = instruction->getOpcode();
 
   // Check for loads and stores
@@ -92,7 +103,7 @@ void InstructionCounter::instructionExecuted(
 
     // Count total number of bytes loaded/stored
     unsigned bytes = getTypeSize(type->getPointerElementType());
-    m_memopBytes[opcode-COUNTED_LOAD_BASE] += bytes;
+    counts.memopBytes[opcode-COUNTED_LOAD_BASE] += bytes;
   }
   else if (opcode == llvm::Instruction::Call)
   {
@@ -101,45 +112,54 @@ void InstructionCounter::instructionExecuted(
     const llvm::Function *function = callInst->getCalledFunction();
     if (function)
     {
-      vector<const llvm::Function*>::iterator itr =
-        find(m_functions.begin(), m_functions.end(), function);
-      if (itr == m_functions.end())
-      {
-        opcode = COUNTED_CALL_BASE + m_functions.size();
-        m_functions.push_back(function);
-      }
-      else
-      {
-        opcode = COUNTED_CALL_BASE + (itr - m_functions.begin());
-      }
+      opcode = COUNTED_CALL_BASE + counts.functions->indices.at(function);
     }
   }
 
-  if (opcode >= m_instructionCounts.size())
-  {
-    m_instructionCounts.resize(opcode+1);
-  }
-  m_instructionCounts[opcode]++;
-}
-
-bool InstructionCounter::isThreadSafe() const
-{
-  return false;
+  counts.instructionCounts[opcode]++;
 }
 
 void InstructionCounter::kernelBegin(const KernelInvocation *kernelInvocation)
 {
-  m_instructionCounts.clear();
-  m_instructionCounts.resize(COUNTED_CALL_BASE);
-
-  m_memopBytes.clear();
-  m_memopBytes.resize(16);
+  FunctionTable *functions = new FunctionTable;
+  const llvm::Module *module =
+    kernelInvocation->getKernel()->getFunction()->getParent();
+  for (auto F = module->begin(); F != module->end(); F++)
+  {
+    functions->indices[&*F] = functions->functions.size();
+    functions->functions.push_back(&*F);
+  }
 
-  m_functions.clear();
+  // Each worker counts into its own copy of the counts
+  Counts counts;
+  counts.functions.reset(functions);
+  counts.instructionCounts.resize(COUNTED_CALL_BASE +
+                                  functions->functions.size());
+  counts.memopBytes.resize(16);
+  m_counts.begin(kernelInvocation, counts);
 }
 
 void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
 {
+  // Merge the counts from each worker
+  vector<Counts> workers = m_counts.end(kernelInvocation);
+  Counts& counts = workers.front();
+  for (auto W = workers.begin() + 1; W != workers.end(); W++)
+  {
+    for (size_t i = 0; i < counts.instructionCounts.size(); i++)
+    {
+      counts.instructionCounts[i] += W->instructionCounts[i];
+    }
+    for (size_t i = 0; i < counts.memopBytes.size(); i++)
+    {
+      counts.memopBytes[i] += W->memopBytes[i];
+    }
+  }
+  const vector<size_t>& instructionCounts = counts.instructionCounts;
+
+  // Output is serialised in case several kernels finish at once
+  lock_guard<mutex> lock(m_outputMutex);
+
   // Load default locale
   locale previousLocale = cout.getloc();
   locale defaultLocale("");
@@ -151,20 +171,20 @@ void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
 
   // Generate list named instructions and their counts
   vector< pair<string,size_t> > namedCounts;
-  for (unsigned i = 0; i < m_instructionCounts.size(); i++)
+  for (unsigned i = 0; i < instructionCounts.size(); i++)
   {
-    if (m_instructionCounts[i] == 0)
+    if (instructionCounts[i] == 0)
     {
       continue;
     }
 
-    string name = getOpcodeName(i);
+    string name = getOpcodeName(counts, i);
     if (name.compare(0, 14, "call llvm.dbg.") == 0)
     {
       continue;
     }
 
-    namedCounts.push_back(make_pair(name, m_instructionCounts[i]));
+    namedCounts.push_back(make_pair(name, instructionCounts[i]));
   }
 
   // Sort named counts
@@ -182,3 +202,8 @@ void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
   // Restore locale
   cout.imbue(previousLocale);
 }
+
+void InstructionCounter::workGroupBegin(const WorkGroup *workGroup)
+{
+  m_counts.bind();
+}
@@ -8,6 +8,10 @@
 
 #include "core/Plugin.h"
 
+#include <mutex>
+
+#include "WorkerData.h"
+
 namespace llvm
 {
   class Function;
@@ -25,14 +29,28 @@ namespace oclgrind
                                      const TypedValue& result) override;
     virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
     virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
+    virtual void workGroupBegin(const WorkGroup *workGroup) override;
 
-    virtual bool isThreadSafe() const override;
+    virtual bool handlesEvent(EventType event) const override;
 
   private:
-    std::vector<size_t> m_instructionCounts;
-    std::vector<size_t> m_memopBytes;
-    std::vector<const llvm::Function*> m_functions;
+    // Functions in the program, numbered so that calls can be counted
+    // without searching for the function each time
+    struct FunctionTable
+    {
+      std::vector<const llvm::Function*> functions;
+      std::unordered_map<const llvm::Function*,unsigned> indices;
+    };
+
+    struct Counts
+    {
+      std::shared_ptr<const FunctionTable> functions;
+      std::vector<size_t> instructionCounts;
+      std::vector<size_t> memopBytes;
+    };
+    WorkerData<Counts> m_counts;
+    std::mutex m_outputMutex;
 
-    std::string getOpcodeName(unsigned opcode) const;
+    std::string getOpcodeName(const Counts& counts, unsigned opcode) const;
   };
 }
@@ -79,6 +79,12 @@ InteractiveDebugger::InteractiveDebugger(const Context *context)
   ADD_CMD("workitem",     "wi", workitem);
 }
 
+bool InteractiveDebugger::handlesEvent(EventType event) const
+{
+  return event == INSTRUCTION_EXECUTED || event == KERNEL_BEGIN ||
+         event == KERNEL_END || event == LOG;
+}
+
 void InteractiveDebugger::instructionExecuted(
   const WorkItem *workItem, const llvm::Instruction *instruction,
   const TypedValue& result)
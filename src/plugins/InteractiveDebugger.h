@@ -24,6 +24,7 @@ namespace oclgrind
     virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
     virtual void log(MessageType type, const char *message) override;
 
+    virtual bool handlesEvent(EventType event) const override;
     virtual bool isThreadSafe() const override;
 
   private:
@@ -60,6 +60,11 @@ Logger::~Logger()
   }
 }
 
+bool Logger::handlesEvent(EventType event) const
+{
+  return event == LOG;
+}
+
 void Logger::log(MessageType type, const char *message)
 {
   lock_guard<mutex> lock(logMutex);
@@ -18,6 +18,8 @@ namespace oclgrind
 
     virtual void log(MessageType type, const char *message) override;
 
+    virtual bool handlesEvent(EventType event) const override;
+
   private:
     std::ostream *m_log;
 
@@ -25,6 +25,30 @@ MemCheck::MemCheck(const Context *context)
 {
 }
 
+bool MemCheck::handlesEvent(EventType event) const
+{
+  switch (event)
+  {
+  case INSTRUCTION_EXECUTED:
+  case MEMORY_ATOMIC_LOAD:
+  case MEMORY_ATOMIC_STORE:
+  case MEMORY_LOAD:
+  case MEMORY_MAP:
+  case MEMORY_STORE:
+  case MEMORY_UNMAP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool MemCheck::handlesOpcode(unsigned opcode) const
+{
+  // Only loads and stores have their array bounds checked
+  return opcode == llvm::Instruction::Load ||
+         opcode == llvm::Instruction::Store;
+}
+
 void MemCheck::instructionExecuted(const WorkItem *workItem,
                                    const llvm::Instruction *instruction,
                                    const TypedValue& result)
@@ -47,6 +47,9 @@ namespace oclgrind
     virtual void memoryUnmap(const Memory *memory, size_t address,
                              const void *ptr) override;
 
+    virtual bool handlesEvent(EventType event) const override;
+    virtual bool handlesOpcode(unsigned opcode) const override;
+
   private:
     void checkArrayAccess(const WorkItem *workItem,
                           const llvm::GetElementPtrInst *GEPI) const;
@@ -0,0 +1,363 @@
+// Profiler.cpp (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "core/common.h"
+
+#include <fstream>
+
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Type.h"
+
+#include "Profiler.h"
+
+#include "core/KernelInvocation.h"
+#include "core/Memory.h"
+#include "core/WorkGroup.h"
+#include "core/WorkItem.h"
+
+using namespace oclgrind;
+using namespace std;
+
+#define COST_INSTRUCTIONS 0
+#define COST_LOAD_BASE    1
+#define COST_STORE_BASE   5
+
+static const char *costNames[] =
+{
+  "Ir",
+  "PrivLd", "GlobLd", "ConstLd", "LocalLd",
+  "PrivSt", "GlobSt", "ConstSt", "LocalSt",
+};
+
+static bool getDebugLocation(const llvm::Instruction *instruction,
+                             size_t& line, string& file)
+{
+  llvm::MDNode *md = instruction->getMetadata("dbg");
+  if (!md)
+    return false;
+
+#if LLVM_VERSION > 36
+  llvm::DILocation *loc = (llvm::DILocation*)md;
+  line = loc->getLine();
+  file = loc->getFilename().str();
+#else
+  llvm::DILocation loc((llvm::MDLocation*)md);
+  line = loc.getLineNumber();
+  file = loc.getFilename().str();
+#endif
+  return true;
+}
+
+static void writeCosts(ostream& output, size_t block, size_t line,
+                       const size_t *values)
+{
+  output << "0x" << hex << block << dec << " " << line;
+  for (unsigned i = 0; i < sizeof(costNames)/sizeof(costNames[0]); i++)
+  {
+    output << " " << values[i];
+  }
+  output << endl;
+}
+
+Profiler::Profiler(const Context *context, const char *filename)
+ : Plugin(context)
+{
+  m_filename = filename;
+}
+
+void Profiler::addMemoryCost(const Memory *memory,
+                             const llvm::Instruction *instruction,
+                             size_t size, bool store)
+{
+  unsigned addrSpace = memory->getAddressSpace();
+  if (!instruction || addrSpace > AddrSpaceLocal)
+    return;
+
+  unsigned base = store ? COST_STORE_BASE : COST_LOAD_BASE;
+  m_costs.get()[instruction].values[base + addrSpace] += size;
+}
+
+Profiler::Costs Profiler::getCallCosts(const string& callee, size_t count,
+                                       CostMap& inclusive,
+                                       const CallCounts& numCalls) const
+{
+  Costs costs;
+  if (!m_profile.count(callee))
+  {
+    // Builtin functions count as a single instruction
+    costs.values[COST_INSTRUCTIONS] = count;
+    return costs;
+  }
+
+  // Share the callee's inclusive costs between its call sites
+  Costs calleeCosts = getInclusiveCosts(callee, inclusive, numCalls);
+  double fraction = count / (double)numCalls.at(callee);
+  for (unsigned i = 0; i < NUM_COSTS; i++)
+  {
+    costs.values[i] = calleeCosts.values[i] * fraction;
+  }
+  return costs;
+}
+
+Profiler::Costs Profiler::getInclusiveCosts(const string& function,
+                                            CostMap& inclusive,
+                                            const CallCounts& numCalls) const
+{
+  auto itr = inclusive.find(function);
+  if (itr != inclusive.end())
+    return itr->second;
+
+  // OpenCL doesn't allow recursion, so this always terminates
+  Costs costs;
+  const FunctionProfile& profile = m_profile.at(function);
+  for (auto C = profile.costs.begin(); C != profile.costs.end(); C++)
+  {
+    costs += C->second;
+  }
+  for (auto C = profile.calls.begin(); C != profile.calls.end(); C++)
+  {
+    costs += getCallCosts(C->first.second, C->second, inclusive, numCalls);
+  }
+
+  inclusive[function] = costs;
+  return costs;
+}
+
+bool Profiler::handlesEvent(EventType event) const
+{
+  switch (event)
+  {
+  case INSTRUCTION_EXECUTED:
+  case KERNEL_BEGIN:
+  case KERNEL_END:
+  case MEMORY_ATOMIC_LOAD:
+  case MEMORY_ATOMIC_STORE:
+  case MEMORY_LOAD:
+  case MEMORY_STORE:
+  case WORK_GROUP_BEGIN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Profiler::instructionExecuted(const WorkItem *workItem,
+                                   const llvm::Instruction *instruction,
+                                   const TypedValue& result)
+{
+  m_costs.get()[instruction].values[COST_INSTRUCTIONS]++;
+}
+
+void Profiler::kernelBegin(const KernelInvocation *kernelInvocation)
+{
+  m_costs.begin(kernelInvocation, InstCosts());
+}
+
+void Profiler::kernelEnd(const KernelInvocation *kernelInvocation)
+{
+  vector<InstCosts> workers = m_costs.end(kernelInvocation);
+
+  // Rewrite the profile after every kernel, so that it is complete even if
+  // the application never releases its context
+  lock_guard<mutex> lock(m_profileMutex);
+  for (auto W = workers.begin(); W != workers.end(); W++)
+  {
+    mergeProfile(*W);
+  }
+  writeProfile();
+}
+
+void Profiler::memoryAtomicLoad(const Memory *memory,
+                                const WorkItem *workItem,
+                                AtomicOp op, size_t address, size_t size)
+{
+  addMemoryCost(memory, workItem->getCurrentInstruction(), size, false);
+}
+
+void Profiler::memoryAtomicStore(const Memory *memory,
+                                 const WorkItem *workItem,
+                                 AtomicOp op, size_t address, size_t size)
+{
+  addMemoryCost(memory, workItem->getCurrentInstruction(), size, true);
+}
+
+void Profiler::memoryLoad(const Memory *memory, const WorkItem *workItem,
+                          size_t address, size_t size)
+{
+  addMemoryCost(memory, workItem->getCurrentInstruction(), size, false);
+}
+
+void Profiler::memoryLoad(const Memory *memory, const WorkGroup *workGroup,
+                          size_t address, size_t size)
+{
+  // Async copies are performed when the work-group waits for them
+  addMemoryCost(memory, workGroup->getCurrentBarrier(), size, false);
+}
+
+void Profiler::memoryStore(const Memory *memory, const WorkItem *workItem,
+                           size_t address, size_t size,
+                           const uint8_t *storeData)
+{
+  addMemoryCost(memory, workItem->getCurrentInstruction(), size, true);
+}
+
+void Profiler::memoryStore(const Memory *memory, const WorkGroup *workGroup,
+                           size_t address, size_t size,
+                           const uint8_t *storeData)
+{
+  addMemoryCost(memory, workGroup->getCurrentBarrier(), size, true);
+}
+
+void Profiler::mergeProfile(const InstCosts& costs)
+{
+  unordered_map<const llvm::BasicBlock*,size_t> blockIndices;
+  for (auto itr = costs.begin(); itr != costs.end(); itr++)
+  {
+    const llvm::Instruction *instruction = itr->first;
+    size_t count = itr->second.values[COST_INSTRUCTIONS];
+
+    // Ignore debugging intrinsics
+    const llvm::Function *callee = NULL;
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(instruction))
+    {
+      callee = call->getCalledFunction();
+      if (callee && callee->getName().startswith("llvm.dbg."))
+        continue;
+    }
+
+    // Number basic blocks in the order they appear in their function
+    const llvm::BasicBlock *block = instruction->getParent();
+    const llvm::Function *function = block->getParent();
+    if (!blockIndices.count(block))
+    {
+      size_t index = 0;
+      for (auto B = function->begin(); B != function->end(); B++)
+      {
+        blockIndices[&*B] = index++;
+      }
+    }
+
+    size_t line = 0;
+    string file;
+    FunctionProfile& profile = m_profile[function->getName().str()];
+    if (getDebugLocation(instruction, line, file) && profile.file.empty())
+      profile.file = file;
+
+    Position position(blockIndices[block], line);
+    profile.costs[position] += itr->second;
+
+    if (callee)
+    {
+      profile.calls[make_pair(position, callee->getName().str())] += count;
+    }
+  }
+}
+
+void Profiler::workGroupBegin(const WorkGroup *workGroup)
+{
+  m_costs.bind();
+}
+
+void Profiler::writeProfile() const
+{
+  ofstream output(m_filename.c_str());
+  if (!output.good())
+  {
+    cerr << "Oclgrind: Unable to open profile file '"
+         << m_filename << "'" << endl;
+    return;
+  }
+
+  // Count calls to each function, for sharing costs between call sites
+  Costs totals;
+  CallCounts numCalls;
+  for (auto F = m_profile.begin(); F != m_profile.end(); F++)
+  {
+    for (auto C = F->second.costs.begin(); C != F->second.costs.end(); C++)
+    {
+      totals += C->second;
+    }
+    for (auto C = F->second.calls.begin(); C != F->second.calls.end(); C++)
+    {
+      numCalls[C->first.second] += C->second;
+    }
+  }
+
+  // Header
+  output << "# callgrind format" << endl
+         << "version: 1" << endl
+         << "creator: Oclgrind " PACKAGE_VERSION << endl
+         << "positions: instr line" << endl
+         << "event: Ir : Instructions executed" << endl;
+  for (unsigned i = 0; i <= AddrSpaceLocal; i++)
+  {
+    output << "event: " << costNames[COST_LOAD_BASE + i] << " : Bytes loaded"
+           << " from " << getAddressSpaceName(i) << " memory" << endl;
+  }
+  for (unsigned i = 0; i <= AddrSpaceLocal; i++)
+  {
+    output << "event: " << costNames[COST_STORE_BASE + i] << " : Bytes stored"
+           << " to " << getAddressSpaceName(i) << " memory" << endl;
+  }
+  output << "events:";
+  for (unsigned i = 0; i < NUM_COSTS; i++)
+  {
+    output << " " << costNames[i];
+  }
+  output << endl << "summary:";
+  for (unsigned i = 0; i < NUM_COSTS; i++)
+  {
+    output << " " << totals.values[i];
+  }
+  output << endl;
+
+  // Costs for each function
+  CostMap inclusive;
+  for (auto F = m_profile.begin(); F != m_profile.end(); F++)
+  {
+    const FunctionProfile& profile = F->second;
+    output << endl
+           << "fl=" << (profile.file.empty() ? "???" : profile.file) << endl
+           << "fn=" << F->first << endl;
+
+    for (auto C = profile.costs.begin(); C != profile.costs.end(); C++)
+    {
+      writeCosts(output, C->first.first, C->first.second, C->second.values);
+    }
+
+    for (auto C = profile.calls.begin(); C != profile.calls.end(); C++)
+    {
+      const Position& position = C->first.first;
+      const string& callee = C->first.second;
+      Costs costs = getCallCosts(callee, C->second, inclusive, numCalls);
+
+      output << "cfn=" << callee << endl
+             << "calls=" << C->second << " 0x0 0" << endl;
+      writeCosts(output, position.first, position.second, costs.values);
+    }
+  }
+}
+
+Profiler::Costs::Costs()
+{
+  for (unsigned i = 0; i < NUM_COSTS; i++)
+  {
+    values[i] = 0;
+  }
+}
+
+Profiler::Costs& Profiler::Costs::operator+=(const Costs& costs)
+{
+  for (unsigned i = 0; i < NUM_COSTS; i++)
+  {
+    values[i] += costs.values[i];
+  }
+  return *this;
+}
@@ -0,0 +1,91 @@
+// Profiler.h (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "core/Plugin.h"
+
+#include <mutex>
+
+#include "WorkerData.h"
+
+namespace oclgrind
+{
+  // Attributes executed instructions and memory traffic to source lines and
+  // basic blocks, and writes them to a file in callgrind format
+  class Profiler : public Plugin
+  {
+  public:
+    Profiler(const Context *context, const char *filename);
+
+    virtual void instructionExecuted(const WorkItem *workItem,
+                                     const llvm::Instruction *instruction,
+                                     const TypedValue& result) override;
+    virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
+    virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
+    virtual void memoryAtomicLoad(const Memory *memory,
+                                  const WorkItem *workItem,
+                                  AtomicOp op, size_t address,
+                                  size_t size) override;
+    virtual void memoryAtomicStore(const Memory *memory,
+                                   const WorkItem *workItem,
+                                   AtomicOp op, size_t address,
+                                   size_t size) override;
+    virtual void memoryLoad(const Memory *memory, const WorkItem *workItem,
+                            size_t address, size_t size) override;
+    virtual void memoryLoad(const Memory *memory, const WorkGroup *workGroup,
+                            size_t address, size_t size) override;
+    virtual void memoryStore(const Memory *memory, const WorkItem *workItem,
+                             size_t address, size_t size,
+                             const uint8_t *storeData) override;
+    virtual void memoryStore(const Memory *memory, const WorkGroup *workGroup,
+                             size_t address, size_t size,
+                             const uint8_t *storeData) override;
+    virtual void workGroupBegin(const WorkGroup *workGroup) override;
+
+    virtual bool handlesEvent(EventType event) const override;
+
+  private:
+    // Costs are instructions executed, followed by bytes loaded and then
+    // bytes stored in each address space
+    static const unsigned NUM_COSTS = 9;
+    struct Costs
+    {
+      size_t values[NUM_COSTS];
+      Costs();
+      Costs& operator+=(const Costs& costs);
+    };
+
+    // Costs of each instruction, counted by each worker
+    typedef std::unordered_map<const llvm::Instruction*,Costs> InstCosts;
+    WorkerData<InstCosts> m_costs;
+
+    // Profile positions are (basic block, source line) pairs
+    typedef std::pair<size_t,size_t> Position;
+    struct FunctionProfile
+    {
+      std::string file;
+      std::map<Position,Costs> costs;
+      std::map<std::pair<Position,std::string>,size_t> calls;
+    };
+    std::map<std::string,FunctionProfile> m_profile;
+    std::mutex m_profileMutex;
+    std::string m_filename;
+
+    typedef std::map<std::string,Costs> CostMap;
+    typedef std::map<std::string,size_t> CallCounts;
+    Costs getCallCosts(const std::string& callee, size_t count,
+                       CostMap& inclusive, const CallCounts& numCalls) const;
+    Costs getInclusiveCosts(const std::string& function,
+                            CostMap& inclusive,
+                            const CallCounts& numCalls) const;
+    void addMemoryCost(const Memory *memory,
+                       const llvm::Instruction *instruction,
+                       size_t size, bool store);
+    void mergeProfile(const InstCosts& costs);
+    void writeProfile() const;
+  };
+}
@@ -8,6 +8,8 @@
 
 #include "core/common.h"
 
+#include <algorithm>
+
 #include "core/Context.h"
 #include "core/KernelInvocation.h"
 #include "core/Memory.h"
@@ -23,107 +25,112 @@ THREAD_LOCAL RaceDetector::WorkerState RaceDetector::m_state = {NULL};
 
 #define STATE(workgroup) (m_state.groups->at(workgroup))
 
-// Use a bank of mutexes to reduce unnecessary synchronisation
-#define NUM_GLOBAL_MUTEXES 4096 // Must be power of two
-#define GLOBAL_MUTEX(buffer,offset) \
-  m_globalMutexes[buffer][offset & (NUM_GLOBAL_MUTEXES-1)]
+#define SHADOW_PAGE_SIZE ((size_t)1 << Memory::RecordShadow::PAGE_BITS)
+
+// Epochs are shared by every race detector, as record shadows outlive the
+// plugins that register them
+static atomic<uint64_t> nextEpoch(1);
 
 RaceDetector::RaceDetector(const Context *context)
  : Plugin(context)
 {
-  m_kernelInvocation = NULL;
-
   m_allowUniformWrites = !checkEnv("OCLGRIND_UNIFORM_WRITES");
+  m_numShadows = 0;
 }
 
-void RaceDetector::kernelBegin(const KernelInvocation *kernelInvocation)
+RaceDetector::~RaceDetector()
 {
-  m_kernelInvocation = kernelInvocation;
-}
-
-void RaceDetector::kernelEnd(const KernelInvocation *kernelInvocation)
-{
-  // Clear all global memory accesses
-  for (auto buffer  = m_globalAccesses.begin();
-            buffer != m_globalAccesses.end();
-            buffer++)
+  for (auto kernel = m_kernels.begin(); kernel != m_kernels.end(); kernel++)
   {
-    size_t sz = buffer->second.size();
-    buffer->second.clear();
-    buffer->second.resize(sz);
+    m_freeShadows.push_back(kernel->second.shadow);
   }
 
-  m_kernelInvocation = NULL;
-}
-
-void RaceDetector::memoryAllocated(const Memory *memory, size_t address,
-                                   size_t size, cl_mem_flags flags,
-                                   const uint8_t *initData)
-{
-  size_t buffer = memory->extractBuffer(address);
-  if (memory->getAddressSpace() == AddrSpaceGlobal)
+  for (auto shadow  = m_freeShadows.begin();
+            shadow != m_freeShadows.end();
+            shadow++)
   {
-    m_globalAccesses[buffer].resize(size);
-    m_globalMutexes[buffer] = new mutex[NUM_GLOBAL_MUTEXES];
+    Memory::unregisterRecordShadow(*shadow);
   }
 }
 
-void RaceDetector::memoryAtomicLoad(const Memory *memory,
-                                    const WorkItem *workItem,
-                                    AtomicOp op, size_t address, size_t size)
+bool RaceDetector::handlesAddressSpace(unsigned addrSpace) const
 {
-  registerAccess(memory, workItem->getWorkGroup(), workItem,
-                 address, size, true);
+  // Races can only occur in memory shared between work-items
+  return addrSpace == AddrSpaceGlobal || addrSpace == AddrSpaceLocal;
 }
 
-void RaceDetector::memoryAtomicStore(const Memory *memory,
-                                     const WorkItem *workItem,
-                                     AtomicOp op, size_t address, size_t size)
+bool RaceDetector::handlesEvent(EventType event) const
 {
-  registerAccess(memory, workItem->getWorkGroup(), workItem,
-                 address, size, true,
-                 (const uint8_t*)memory->getPointer(address));
+  switch (event)
+  {
+  case KERNEL_BEGIN:
+  case KERNEL_END:
+  case MEMORY_ACCESSES:
+  case WORK_GROUP_BARRIER:
+  case WORK_GROUP_BEGIN:
+  case WORK_GROUP_COMPLETE:
+    return true;
+  default:
+    return false;
+  }
 }
 
-void RaceDetector::memoryDeallocated(const Memory *memory, size_t address)
+void RaceDetector::kernelBegin(const KernelInvocation *kernelInvocation)
 {
-  size_t buffer = memory->extractBuffer(address);
-  if (memory->getAddressSpace() == AddrSpaceGlobal)
-  {
-    m_globalAccesses.erase(buffer);
+  unique_lock<mutex> lock(m_kernelsMutex);
 
-    delete[] m_globalMutexes.at(buffer);
-    m_globalMutexes.erase(buffer);
+  // Reuse a shadow from a previous kernel if one is available
+  if (m_freeShadows.empty() && m_numShadows < MAX_SHADOWS)
+  {
+    m_freeShadows.push_back(
+      Memory::registerRecordShadow(sizeof(AccessRecord)));
+    m_numShadows++;
   }
-}
+  m_shadowReleased.wait(lock, [this](){ return !m_freeShadows.empty(); });
 
-void RaceDetector::memoryLoad(const Memory *memory, const WorkItem *workItem,
-                              size_t address, size_t size)
-{
-  registerAccess(memory, workItem->getWorkGroup(), workItem,
-                 address, size, false, NULL);
+  // Starting a new epoch invalidates all accesses already in the shadow
+  Shadow shadow = {m_freeShadows.back(), nextEpoch++};
+  m_freeShadows.pop_back();
+  m_kernels[kernelInvocation] = shadow;
 }
 
-void RaceDetector::memoryLoad(const Memory *memory, const WorkGroup *workGroup,
-                              size_t address, size_t size)
+void RaceDetector::kernelEnd(const KernelInvocation *kernelInvocation)
 {
-  registerAccess(memory, workGroup, NULL, address, size, false);
+  {
+    lock_guard<mutex> lock(m_kernelsMutex);
+    m_freeShadows.push_back(m_kernels.at(kernelInvocation).shadow);
+    m_kernels.erase(kernelInvocation);
+  }
+  m_shadowReleased.notify_one();
 }
 
-void RaceDetector::memoryStore(const Memory *memory, const WorkItem *workItem,
-                               size_t address, size_t size,
-                               const uint8_t *storeData)
+void RaceDetector::memoryAccesses(const Plugin::MemoryAccess *accesses,
+                                  size_t num)
 {
-  registerAccess(memory, workItem->getWorkGroup(), workItem,
-                 address, size, false, storeData);
-}
+  const InterpreterCache *cache =
+    KernelInvocation::getCurrent()->getInterpreterCache();
 
-void RaceDetector::memoryStore(const Memory *memory, const WorkGroup *workGroup,
-                               size_t address, size_t size,
-                               const uint8_t *storeData)
-{
-  registerAccess(memory, workGroup, NULL,
-                 address, size, false, storeData);
+  // Only look up work-group state when the work-group changes, and
+  // instruction offsets when the instruction changes
+  const WorkGroup *workGroup = NULL;
+  WorkGroupState *state = NULL;
+  const llvm::Instruction *instruction = NULL;
+  unsigned offset = NO_OFFSET;
+  for (size_t i = 0; i < num; i++)
+  {
+    if (accesses[i].workGroup != workGroup)
+    {
+      workGroup = accesses[i].workGroup;
+      state = &STATE(workGroup);
+    }
+    if (accesses[i].instruction != instruction)
+    {
+      instruction = accesses[i].instruction;
+      offset = instruction ? cache->getInstructionOffset(instruction)
+                           : NO_OFFSET;
+    }
+    registerAccess(*state, accesses[i], offset);
+  }
 }
 
 void RaceDetector::workGroupBarrier(const WorkGroup *workGroup, uint32_t flags)
@@ -167,21 +174,50 @@ void RaceDetector::workGroupComplete(const WorkGroup *workGroup)
   syncWorkItems(workGroup->getLocalMemory(), state, state.wiLocal);
   syncWorkItems(m_context->getGlobalMemory(), state, state.wiGlobal);
 
-  // Merge global accesses across kernel invocation
-  RaceList races;
-  size_t group = workGroup->getGroupIndex();
+  // Merge global accesses across kernel invocation, in address order so
+  // that each shadow page is only looked up and locked once
+  const Memory *memory = m_context->getGlobalMemory();
+  vector< pair<size_t,AccessRecord*> > records;
+  records.reserve(state.wgGlobal.size());
   for (auto record  = state.wgGlobal.begin();
             record != state.wgGlobal.end();
             record++)
   {
+    records.push_back(make_pair(record->first, &record->second));
+  }
+  sort(records.begin(), records.end());
+
+  Shadow shadow = getShadow();
+  RaceList races;
+  size_t group = workGroup->getGroupIndex();
+  AccessRecord *page = NULL;
+  size_t pageIndex = 0;
+  unique_lock<mutex> pageLock;
+  for (auto record = records.begin(); record != records.end(); record++)
+  {
+    // Buffer offsets are in the low bits of each address, so every page in
+    // global memory has a distinct index
     size_t address = record->first;
-    size_t buffer = m_context->getGlobalMemory()->extractBuffer(address);
-    size_t offset = m_context->getGlobalMemory()->extractOffset(address);
+    size_t offset = memory->extractOffset(address);
+    if (!page || (address / SHADOW_PAGE_SIZE) != pageIndex)
+    {
+      if (pageLock.owns_lock())
+        pageLock.unlock();
+      pageIndex = address / SHADOW_PAGE_SIZE;
 
-    lock_guard<mutex> lock(GLOBAL_MUTEX(buffer, offset));
+      Memory::RecordShadow *recordShadow =
+        memory->getRecordShadow(shadow.shadow, address);
+      if (!recordShadow)
+      {
+        page = NULL;
+        continue;
+      }
+      page = (AccessRecord*)recordShadow->lockPage(offset, shadow.epoch,
+                                                   pageLock);
+    }
 
-    AccessRecord& a = record->second;
-    AccessRecord& b = m_globalAccesses.at(buffer)[offset];
+    AccessRecord& a = *record->second;
+    AccessRecord& b = page[offset % SHADOW_PAGE_SIZE];
 
     // Check for races with previous accesses
     if (check(a.load,  b.store) && getAccessWorkGroup(b.store) != group)
@@ -197,6 +233,8 @@ void RaceDetector::workGroupComplete(const WorkGroup *workGroup)
     if (a.store.isSet())
       insert(b, a.store);
   }
+  if (pageLock.owns_lock())
+    pageLock.unlock();
   state.wgGlobal.clear();
 
   // Log races
@@ -235,7 +273,9 @@ bool RaceDetector::check(const MemoryAccess& a,
       return true;
 
     // Write-write race if not uniform
-    if (!m_allowUniformWrites || (a.getStoreData() != b.getStoreData()))
+    // Atomic stores have no store data, so they are never uniform
+    if (!m_allowUniformWrites || a.isAtomic() || b.isAtomic() ||
+        (a.getStoreData() != b.getStoreData()))
       return true;
   }
 
@@ -246,13 +286,31 @@ size_t RaceDetector::getAccessWorkGroup(const MemoryAccess& access) const
 {
   if (access.isWorkItem())
   {
-    const Size3& wgsize = m_kernelInvocation->getLocalSize();
+    const Size3& wgsize = KernelInvocation::getCurrent()->getLocalSize();
     return access.getEntity() / (wgsize.x*wgsize.y*wgsize.z);
   }
   else
     return access.getEntity();
 }
 
+const llvm::Instruction* RaceDetector::getInstruction(
+  const MemoryAccess& access) const
+{
+  unsigned offset = access.getInstructionOffset();
+  if (offset == NO_OFFSET)
+    return NULL;
+
+  const InterpreterCache *cache =
+    KernelInvocation::getCurrent()->getInterpreterCache();
+  return cache->getInstruction(offset).instruction;
+}
+
+RaceDetector::Shadow RaceDetector::getShadow()
+{
+  lock_guard<mutex> lock(m_kernelsMutex);
+  return m_kernels.at(KernelInvocation::getCurrent());
+}
+
 void RaceDetector::insert(AccessRecord& record,
                           const MemoryAccess& access) const
 {
@@ -274,8 +332,8 @@ void RaceDetector::insertRace(RaceList& races, const Race& race) const
   for (auto x = races.begin(); x != races.end(); x++)
   {
     // Check if races are equal modulo address
-    if ((race.a.getInstruction() == x->a.getInstruction()) &&
-        (race.b.getInstruction() == x->b.getInstruction()) &&
+    if ((race.a.getInstructionOffset() == x->a.getInstructionOffset()) &&
+        (race.b.getInstructionOffset() == x->b.getInstructionOffset()) &&
         (race.a.isLoad() == x->a.isLoad()) &&
         (race.b.isLoad() == x->b.isLoad()) &&
         (race.a.isWorkItem() == x->a.isWorkItem()) &&
@@ -306,6 +364,8 @@ void RaceDetector::logRace(const Race& race) const
   else
     raceType = "Write-write";
 
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+
   Context::Message msg(ERROR, m_context);
   msg << raceType << " data race at "
       << getAddressSpaceName(race.addrspace)
@@ -317,8 +377,8 @@ void RaceDetector::logRace(const Race& race) const
 
   if (race.a.isWorkItem())
   {
-    Size3 wgsize = m_kernelInvocation->getLocalSize();
-    Size3 global(race.a.getEntity(), m_kernelInvocation->getGlobalSize());
+    Size3 wgsize = kernelInvocation->getLocalSize();
+    Size3 global(race.a.getEntity(), kernelInvocation->getGlobalSize());
     Size3 local(global.x%wgsize.x, global.y%wgsize.y, global.z%wgsize.z);
     Size3 group(global.x/wgsize.x, global.y/wgsize.y, global.z/wgsize.z);
     msg << "Global" << global << " Local" << local << " Group" << group;
@@ -326,18 +386,18 @@ void RaceDetector::logRace(const Race& race) const
   else
   {
     msg << "Group"
-        << Size3(race.a.getEntity(), m_kernelInvocation->getLocalSize());
+        << Size3(race.a.getEntity(), kernelInvocation->getLocalSize());
   }
 
-  msg << endl << race.a.getInstruction() << endl
+  msg << endl << getInstruction(race.a) << endl
       << endl
       << "Second entity: ";
 
   // Show details of other entity involved in race
   if (race.b.isWorkItem())
   {
-    Size3 wgsize = m_kernelInvocation->getLocalSize();
-    Size3 global(race.b.getEntity(), m_kernelInvocation->getGlobalSize());
+    Size3 wgsize = kernelInvocation->getLocalSize();
+    Size3 global(race.b.getEntity(), kernelInvocation->getGlobalSize());
     Size3 local(global.x%wgsize.x, global.y%wgsize.y, global.z%wgsize.z);
     Size3 group(global.x/wgsize.x, global.y/wgsize.y, global.z/wgsize.z);
     msg << "Global" << global << " Local" << local << " Group" << group;
@@ -345,50 +405,49 @@ void RaceDetector::logRace(const Race& race) const
   else
   {
     msg << "Group"
-        << Size3(race.b.getEntity(), m_kernelInvocation->getLocalSize());
+        << Size3(race.b.getEntity(), kernelInvocation->getLocalSize());
   }
-  msg << endl << race.b.getInstruction() << endl;
+  msg << endl << getInstruction(race.b) << endl;
   msg.send();
 }
 
-void RaceDetector::registerAccess(const Memory *memory,
-                                  const WorkGroup *workGroup,
-                                  const WorkItem *workItem,
-                                  size_t address, size_t size, bool atomic,
-                                  const uint8_t *storeData)
+void RaceDetector::registerAccess(WorkGroupState& state,
+                                  const Plugin::MemoryAccess& access,
+                                  unsigned instruction) const
 {
+  const Memory *memory = access.memory;
   unsigned addrSpace = memory->getAddressSpace();
   if (addrSpace == AddrSpacePrivate ||
       addrSpace == AddrSpaceConstant)
     return;
-  if (!memory->isAddressValid(address, size))
+  if (!memory->isAddressValid(access.address, access.size))
     return;
 
   // Construct access
-  MemoryAccess access(workGroup, workItem, storeData != NULL, atomic);
+  MemoryAccess record(access.workGroup, access.workItem, instruction,
+                      access.store, access.atomic);
 
   size_t index;
-  if (workItem)
+  if (access.workItem)
   {
-    Size3 wgsize = workGroup->getGroupSize();
-    Size3 lid = workItem->getLocalID();
+    Size3 wgsize = access.workGroup->getGroupSize();
+    Size3 lid = access.workItem->getLocalID();
     index = lid.x + (lid.y + lid.z*wgsize.y)*wgsize.x;
   }
   else
   {
-    index = STATE(workGroup).wiLocal.size() - 1;
+    index = state.wiLocal.size() - 1;
   }
 
   AccessMap& accesess = (addrSpace == AddrSpaceGlobal) ?
-    STATE(workGroup).wiGlobal[index] :
-    STATE(workGroup).wiLocal[index];
+    state.wiGlobal[index] : state.wiLocal[index];
 
-  for (size_t i = 0; i < size; i++)
+  for (size_t i = 0; i < access.size; i++)
   {
-    if (storeData)
-      access.setStoreData(storeData[i]);
+    if (access.storeData)
+      record.setStoreData(access.storeData[i]);
 
-    insert(accesess[address+i], access);
+    insert(accesess[access.address+i], record);
   }
 }
 
@@ -443,11 +502,11 @@ void RaceDetector::syncWorkItems(const Memory *memory,
 RaceDetector::MemoryAccess::MemoryAccess()
 {
   this->info = 0;
-  this->instruction = NULL;
 }
 
 RaceDetector::MemoryAccess::MemoryAccess(const WorkGroup *workGroup,
                                          const WorkItem *workItem,
+                                         unsigned instruction,
                                          bool store, bool atomic)
 {
   this->info = 0;
@@ -456,23 +515,28 @@ RaceDetector::MemoryAccess::MemoryAccess(const WorkGroup *workGroup,
   this->info |= store << STORE_BIT;
   this->info |= atomic << ATOMIC_BIT;
 
+  size_t entity;
   if (workItem)
   {
-    this->entity = workItem->getGlobalIndex();
-    this->instruction = workItem->getCurrentInstruction();
+    entity = workItem->getGlobalIndex();
   }
   else
   {
     this->info |= (1<<WG_BIT);
-    this->entity = workGroup->getGroupIndex();
-    this->instruction = NULL; // TODO?
+    entity = workGroup->getGroupIndex();
+    instruction = NO_OFFSET; // TODO?
   }
+  this->info |= (uint64_t)entity << ENTITY_SHIFT;
+
+  const unsigned unknown = (1<<INSTRUCTION_BITS) - 1;
+  if (instruction > unknown)
+    instruction = unknown;
+  this->info |= (uint64_t)instruction << INSTRUCTION_SHIFT;
 }
 
 void RaceDetector::MemoryAccess::clear()
 {
   this->info = 0;
-  this->instruction = NULL;
 }
 
 bool RaceDetector::MemoryAccess::isSet() const
@@ -507,20 +571,23 @@ bool RaceDetector::MemoryAccess::isWorkItem() const
 
 size_t RaceDetector::MemoryAccess::getEntity() const
 {
-  return this->entity;
+  return this->info >> ENTITY_SHIFT;
 }
 
-const llvm::Instruction* RaceDetector::MemoryAccess::getInstruction() const
+unsigned RaceDetector::MemoryAccess::getInstructionOffset() const
 {
-  return this->instruction;
+  const unsigned unknown = (1<<INSTRUCTION_BITS) - 1;
+  unsigned offset = (this->info >> INSTRUCTION_SHIFT) & unknown;
+  return offset == unknown ? NO_OFFSET : offset;
 }
 
 uint8_t RaceDetector::MemoryAccess::getStoreData() const
 {
-  return this->storeData;
+  return (this->info >> DATA_SHIFT) & 0xFF;
 }
 
 void RaceDetector::MemoryAccess::setStoreData(uint8_t data)
 {
-  this->storeData = data;
+  this->info &= ~((uint64_t)0xFF << DATA_SHIFT);
+  this->info |= (uint64_t)data << DATA_SHIFT;
 }
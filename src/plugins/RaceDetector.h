@@ -8,6 +8,7 @@
 
 #include "core/Plugin.h"
 
+#include <condition_variable>
 #include <mutex>
 
 namespace oclgrind
@@ -16,49 +17,38 @@ namespace oclgrind
   {
   public:
     RaceDetector(const Context *context);
+    virtual ~RaceDetector();
 
     virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
     virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
-    virtual void memoryAllocated(const Memory *memory, size_t address,
-                                 size_t size, cl_mem_flags flags,
-                                 const uint8_t *initData) override;
-    virtual void memoryAtomicLoad(const Memory *memory,
-                                  const WorkItem *workItem,
-                                  AtomicOp op,
-                                  size_t address, size_t size) override;
-    virtual void memoryAtomicStore(const Memory *memory,
-                                   const WorkItem *workItem,
-                                   AtomicOp op,
-                                   size_t address, size_t size) override;
-    virtual void memoryDeallocated(const Memory *memory, size_t address);
-    virtual void memoryLoad(const Memory *memory, const WorkItem *workItem,
-                            size_t address, size_t size) override;
-    virtual void memoryLoad(const Memory *memory, const WorkGroup *workGroup,
-                            size_t address, size_t size) override;
-    virtual void memoryStore(const Memory *memory, const WorkItem *workItem,
-                             size_t address, size_t size,
-                             const uint8_t *storeData) override;
-    virtual void memoryStore(const Memory *memory, const WorkGroup *workGroup,
-                             size_t address, size_t size,
-                             const uint8_t *storeData) override;
+    virtual void memoryAccesses(const Plugin::MemoryAccess *accesses,
+                                size_t num) override;
     virtual void workGroupBarrier(const WorkGroup *workGroup,
                                   uint32_t flags) override;
     virtual void workGroupBegin(const WorkGroup *workGroup) override;
     virtual void workGroupComplete(const WorkGroup *workGroup) override;
 
+    virtual bool handlesAddressSpace(unsigned addrSpace) const override;
+    virtual bool handlesEvent(EventType event) const override;
+
   private:
     struct MemoryAccess
     {
     private:
-      size_t entity;
-      const llvm::Instruction *instruction;
-
-      uint8_t info;
-      static const unsigned SET_BIT     = 0;
-      static const unsigned STORE_BIT   = 1;
-      static const unsigned ATOMIC_BIT  = 2;
-      static const unsigned WG_BIT      = 3;
-      uint8_t storeData;
+      // Flags, store data, instruction and entity index are packed into a
+      // single word, with the instruction held as its offset in the
+      // kernel's interpreter cache
+      // Offsets that don't fit are recorded as unknown instructions
+      uint64_t info;
+
+      static const unsigned SET_BIT           = 0;
+      static const unsigned STORE_BIT         = 1;
+      static const unsigned ATOMIC_BIT        = 2;
+      static const unsigned WG_BIT            = 3;
+      static const unsigned DATA_SHIFT        = 4;
+      static const unsigned INSTRUCTION_SHIFT = 12;
+      static const unsigned INSTRUCTION_BITS  = 20;
+      static const unsigned ENTITY_SHIFT      = 32;
 
     public:
       void clear();
@@ -72,14 +62,14 @@ namespace oclgrind
       bool isWorkItem() const;
 
       size_t getEntity() const;
-      const llvm::Instruction* getInstruction() const;
+      unsigned getInstructionOffset() const;
 
       uint8_t getStoreData() const;
       void    setStoreData(uint8_t);
 
       MemoryAccess();
       MemoryAccess(const WorkGroup *workGroup, const WorkItem *workItem,
-                   bool store, bool atomic);
+                   unsigned instruction, bool store, bool atomic);
     };
     struct AccessRecord
     {
@@ -94,8 +84,21 @@ namespace oclgrind
       PoolAllocator<std::pair<const size_t,AccessRecord>,8192>
       > AccessMap;
 
-    std::unordered_map<size_t,std::vector<AccessRecord>> m_globalAccesses;
-    std::map< size_t,std::mutex* > m_globalMutexes;
+    // Global memory accesses are recorded in record shadows kept by Memory
+    // Each kernel invocation has its own shadow, since several kernels can
+    // run at once, but shadows are reused by later kernels in a new epoch
+    // Kernels wait to begin while every shadow is in use
+    static const unsigned MAX_SHADOWS = 4;
+    struct Shadow
+    {
+      unsigned shadow;
+      uint64_t epoch;
+    };
+    std::map<const KernelInvocation*,Shadow> m_kernels;
+    std::list<unsigned> m_freeShadows;
+    unsigned m_numShadows;
+    std::mutex m_kernelsMutex;
+    std::condition_variable m_shadowReleased;
 
     struct WorkGroupState
     {
@@ -119,19 +122,18 @@ namespace oclgrind
     typedef std::list<Race> RaceList;
 
     bool m_allowUniformWrites;
-    const KernelInvocation *m_kernelInvocation;
 
     size_t getAccessWorkGroup(const MemoryAccess& access) const;
+    const llvm::Instruction* getInstruction(const MemoryAccess& access) const;
+    Shadow getShadow();
 
     bool check(const MemoryAccess& a, const MemoryAccess& b) const;
     void insert(AccessRecord& record, const MemoryAccess& access) const;
     void insertRace(RaceList& races, const Race& race) const;
     void logRace(const Race& race) const;
-    void registerAccess(const Memory *memory,
-                        const WorkGroup *workGroup,
-                        const WorkItem *workItem,
-                        size_t address, size_t size, bool atomic,
-                        const uint8_t *storeData = NULL);
+    void registerAccess(WorkGroupState& state,
+                        const Plugin::MemoryAccess& access,
+                        unsigned instruction) const;
     void syncWorkItems(const Memory *memory,
                        WorkGroupState& state,
                        std::vector<AccessMap>& accesses);
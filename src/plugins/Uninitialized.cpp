@@ -20,11 +20,39 @@
 using namespace oclgrind;
 using namespace std;
 
-THREAD_LOCAL Uninitialized::LocalState Uninitialized::m_localState = {NULL};
-
 Uninitialized::Uninitialized(const Context *context)
  : Plugin(context)
 {
+  m_shadow = Memory::registerShadow(1);
+}
+
+Uninitialized::~Uninitialized()
+{
+  Memory::unregisterShadow(m_shadow);
+}
+
+bool Uninitialized::handlesEvent(EventType event) const
+{
+  switch (event)
+  {
+  case HOST_MEMORY_STORE:
+  case INSTRUCTION_EXECUTED:
+  case MEMORY_ALLOCATED:
+  case MEMORY_ATOMIC_LOAD:
+  case MEMORY_ATOMIC_STORE:
+  case MEMORY_LOAD:
+  case MEMORY_MAP:
+  case MEMORY_STORE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool Uninitialized::handlesOpcode(unsigned opcode) const
+{
+  // Only allocas need their structure padding initialized
+  return opcode == llvm::Instruction::Alloca;
 }
 
 void Uninitialized::hostMemoryStore(const Memory *memory,
@@ -83,17 +111,8 @@ void Uninitialized::memoryAllocated(const Memory *memory, size_t address,
                                     size_t size, cl_mem_flags flags,
                                     const uint8_t *initData)
 {
-  size_t buffer = memory->extractBuffer(address);
-  if (memory->getAddressSpace() == AddrSpaceGlobal)
-  {
-    m_globalState[buffer] = new bool[size]();
-  }
-  else
-  {
-    if (!m_localState.state)
-      m_localState.state = new map<const Memory*,StateMap>;
-    (*m_localState.state)[memory][buffer] = new bool[size]();
-  }
+  // New buffers are uninitialized unless they have data, and their shadow
+  // is only created once it is first used
   if (initData)
     setState(memory, address, size);
 }
@@ -112,30 +131,6 @@ void Uninitialized::memoryAtomicStore(const Memory *memory,
   setState(memory, address, size);
 }
 
-void Uninitialized::memoryDeallocated(const Memory *memory, size_t address)
-{
-  size_t buffer = memory->extractBuffer(address);
-  if (memory->getAddressSpace() == AddrSpaceGlobal)
-  {
-    delete[] m_globalState[buffer];
-    m_globalState.erase(buffer);
-  }
-  else
-  {
-    delete[] m_localState.state->at(memory)[buffer];
-    m_localState.state->at(memory).erase(buffer);
-    if (!m_localState.state->at(memory).size())
-    {
-      m_localState.state->erase(memory);
-      if (!m_localState.state->size())
-      {
-        delete m_localState.state;
-        m_localState.state = NULL;
-      }
-    }
-  }
-}
-
 void Uninitialized::memoryLoad(const Memory *memory, const WorkItem *workItem,
                               size_t address, size_t size)
 {
@@ -175,23 +170,11 @@ void Uninitialized::checkState(const Memory *memory,
   if (!memory->isAddressValid(address, size))
     return;
 
-  size_t buffer = memory->extractBuffer(address);
   size_t offset = memory->extractOffset(address);
-
-  const bool *state;
-  if (memory->getAddressSpace() == AddrSpaceGlobal)
-    state = m_globalState.at(buffer) + offset;
-  else
-    state = m_localState.state->at(memory).at(buffer) + offset;
-
-  for (size_t offset = 0; offset < size; offset++)
-  {
-    if (!state[offset])
-    {
-      logError(memory->getAddressSpace(), address + offset);
-      break;
-    }
-  }
+  size_t uninitialized;
+  Memory::Shadow *shadow = memory->getShadow(m_shadow, address);
+  if (!shadow->check(offset, size, 1, uninitialized))
+    logError(memory->getAddressSpace(), address + (uninitialized - offset));
 }
 
 void Uninitialized::logError(unsigned int addrSpace, size_t address) const
@@ -212,14 +195,6 @@ void Uninitialized::setState(const Memory *memory, size_t address, size_t size)
   if (!memory->isAddressValid(address, size))
     return;
 
-  size_t buffer = memory->extractBuffer(address);
   size_t offset = memory->extractOffset(address);
-
-  bool *state;
-  if (memory->getAddressSpace() == AddrSpaceGlobal)
-    state = m_globalState.at(buffer) + offset;
-  else
-    state = m_localState.state->at(memory).at(buffer) + offset;
-
-  fill(state, state+size, true);
+  memory->getShadow(m_shadow, address)->fill(offset, size, 1);
 }
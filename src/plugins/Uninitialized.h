@@ -14,6 +14,7 @@ namespace oclgrind
   {
   public:
     Uninitialized(const Context *context);
+    virtual ~Uninitialized();
 
     virtual void hostMemoryStore(const Memory *memory,
                                  size_t address, size_t size,
@@ -32,7 +33,6 @@ namespace oclgrind
                                    const WorkItem *workItem,
                                    AtomicOp op,
                                    size_t address, size_t size) override;
-    virtual void memoryDeallocated(const Memory *memory, size_t address);
     virtual void memoryLoad(const Memory *memory, const WorkItem *workItem,
                             size_t address, size_t size) override;
     virtual void memoryLoad(const Memory *memory, const WorkGroup *workGroup,
@@ -47,15 +47,12 @@ namespace oclgrind
                              size_t address, size_t size,
                              const uint8_t *storeData) override;
 
-  private:
-    typedef std::map<size_t, bool*> StateMap;
-    StateMap m_globalState;
+    virtual bool handlesEvent(EventType event) const override;
+    virtual bool handlesOpcode(unsigned opcode) const override;
 
-    struct LocalState
-    {
-      std::map<const Memory*,StateMap> *state;
-    };
-    static THREAD_LOCAL LocalState m_localState;
+  private:
+    // Shadow memory with one bit for each byte, set once it is initialized
+    unsigned m_shadow;
 
     void checkState(const Memory *memory, size_t address, size_t size) const;
     void setState(const Memory *memory, size_t address, size_t size);
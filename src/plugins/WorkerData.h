@@ -0,0 +1,71 @@
+// WorkerData.h (Oclgrind)
+// Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include "core/common.h"
+
+#include <mutex>
+
+#include "core/KernelInvocation.h"
+
+namespace oclgrind
+{
+  // Plugin data for each running kernel invocation, with a separate copy
+  // for each of the invocation's workers
+  // Workers update their own copy without synchronisation, and the copies
+  // are handed back to the plugin to merge once the kernel has finished.
+  // A thread's current copy is shared by all instances of WorkerData<T>,
+  // so T should be private to the plugin that uses it.
+  template<typename T>
+  class WorkerData
+  {
+  public:
+    // Create copies of initial for each of an invocation's workers
+    void begin(const KernelInvocation *kernelInvocation, const T& initial)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_data[kernelInvocation].assign(kernelInvocation->getNumWorkers(),
+                                      initial);
+    }
+
+    // Select the current worker's copy on this thread
+    // Called when each work-group begins, before the worker uses get()
+    void bind()
+    {
+      const KernelInvocation *kernelInvocation =
+        KernelInvocation::getCurrent();
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_current = &m_data.at(kernelInvocation)[
+        kernelInvocation->getCurrentWorker()];
+    }
+
+    // Remove an invocation, returning the copy from each worker
+    std::vector<T> end(const KernelInvocation *kernelInvocation)
+    {
+      std::vector<T> data;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      data.swap(m_data.at(kernelInvocation));
+      m_data.erase(kernelInvocation);
+      return data;
+    }
+
+    // Get the current worker's copy
+    T& get() const
+    {
+      return *m_current;
+    }
+
+  private:
+    std::map<const KernelInvocation*,std::vector<T>> m_data;
+    std::mutex m_mutex;
+    static THREAD_LOCAL T *m_current;
+  };
+
+  template<typename T> THREAD_LOCAL T *WorkerData<T>::m_current = NULL;
+}
@@ -40,6 +40,9 @@ void asyncEnqueue(cl_command_queue queue,
     clRetainEvent(waitList[i]);
   }
 
+  // Release any commands that have already finished
+  asyncQueueUpdate(queue);
+
   // Enqueue command
   Event *event = queue->queue->enqueue(cmd);
 
@@ -113,16 +116,6 @@ void asyncQueueRelease(Queue::Command *cmd)
   cl_event event = eventMap[cmd];
   eventMap.erase(cmd);
 
-  // Perform callbacks
-  list< pair<void (CL_CALLBACK *)(cl_event, cl_int, void *),
-             void*> >::iterator callItr;
-  for (callItr = event->callbacks.begin();
-       callItr != event->callbacks.end();
-       callItr++)
-  {
-    callItr->first(event, event->event->state, callItr->second);
-  }
-
   // Release events
   list<cl_event>::iterator waitItr;
   for (waitItr = waitListMap[cmd].begin();
@@ -134,3 +127,14 @@ void asyncQueueRelease(Queue::Command *cmd)
   waitListMap.erase(cmd);
   clReleaseEvent(event);
 }
+
+void asyncQueueUpdate(cl_command_queue queue)
+{
+  // Release commands that the queue has finished executing
+  Queue::Command *cmd;
+  while ((cmd = queue->queue->getCompletedCommand()))
+  {
+    asyncQueueRelease(cmd);
+    delete cmd;
+  }
+}
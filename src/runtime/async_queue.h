@@ -19,3 +19,4 @@ extern void asyncEnqueue(cl_command_queue queue,
 extern void asyncQueueRetain(oclgrind::Queue::Command *cmd, cl_mem mem);
 extern void asyncQueueRetain(oclgrind::Queue::Command *cmd, cl_kernel);
 extern void asyncQueueRelease(oclgrind::Queue::Command *cmd);
+extern void asyncQueueUpdate(cl_command_queue queue);
@@ -113,6 +113,7 @@
 #define clCreateEventFromGLsyncKHR _clCreateEventFromGLsyncKHR
 #endif // OCLGRIND_ICD
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <stack>
@@ -215,8 +216,7 @@ struct _cl_event
   cl_command_queue queue;
   cl_command_type type;
   oclgrind::Event *event;
-  std::list< std::pair<void (CL_CALLBACK*)(cl_event, cl_int, void*), void*> > callbacks;
-  unsigned int refCount;
+  std::atomic<unsigned int> refCount;
 };
 
 struct _cl_sampler
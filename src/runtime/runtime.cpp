@@ -51,6 +51,8 @@ using namespace std;
   cl_khr_global_int32_extended_atomics \
   cl_khr_local_int32_base_atomics      \
   cl_khr_local_int32_extended_atomics  \
+  cl_khr_int64_base_atomics            \
+  cl_khr_int64_extended_atomics        \
   cl_khr_byte_addressable_store        \
   cl_khr_fp64"
 
@@ -558,7 +560,8 @@ clGetDeviceInfo
     break;
   case CL_DEVICE_QUEUE_PROPERTIES:
     result_size = sizeof(cl_command_queue_properties);
-    result_data.clcmdqprop = CL_QUEUE_PROFILING_ENABLE;
+    result_data.clcmdqprop =
+      CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE;
     break;
   case CL_DEVICE_NAME:
     result_size = sizeof(DEVICE_NAME);
@@ -965,17 +968,12 @@ clCreateCommandQueue
     SetErrorArg(context, CL_INVALID_DEVICE, device);
     return NULL;
   }
-  if (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
-  {
-    SetErrorInfo(context, CL_INVALID_QUEUE_PROPERTIES,
-                 "Out-of-order command queues not supported");
-    return NULL;
-  }
-
   // Create command-queue object
   cl_command_queue queue;
   queue = new _cl_command_queue;
-  queue->queue = new oclgrind::Queue(context->context);
+  queue->queue =
+    new oclgrind::Queue(context->context,
+                        properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
   queue->dispatch = m_dispatchTable;
   queue->properties = properties;
   queue->context = context;
@@ -3119,15 +3117,6 @@ clGetKernelWorkGroupInfo
 
 /* Event Object APIs  */
 
-namespace
-{
-  // Utility to check if an event has completed (or terminated)
-  inline bool isComplete(cl_event event)
-  {
-    return (event->event->state == CL_COMPLETE || event->event->state < 0);
-  }
-}
-
 CL_API_ENTRY cl_int CL_API_CALL
 clWaitForEvents
 (
@@ -3145,39 +3134,18 @@ clWaitForEvents
     ReturnErrorInfo(NULL, CL_INVALID_VALUE, "event_list cannot be NULL");
   }
 
-  // Loop until all events complete
-  bool complete = false;
-  while (!complete)
+  // Wait for each event to complete
+  for (unsigned i = 0; i < num_events; i++)
   {
-    complete = true;
-    for (unsigned i = 0; i < num_events; i++)
+    if (event_list[i]->queue)
     {
-      // Skip event if already complete
-      if (isComplete(event_list[i]))
-      {
-        continue;
-      }
-
-      // If it's not a user event, update the queue
-      if (event_list[i]->queue)
-      {
-        oclgrind::Queue::Command *cmd = event_list[i]->queue->queue->update();
-        if (cmd)
-        {
-          asyncQueueRelease(cmd);
-          delete cmd;
-        }
-
-        // If it's still not complete, update flag
-        if (!isComplete(event_list[i]))
-        {
-          complete = false;
-        }
-      }
-      else
-      {
-        complete = false;
-      }
+      event_list[i]->queue->queue->wait(event_list[i]->event);
+      asyncQueueUpdate(event_list[i]->queue);
+    }
+    else
+    {
+      // User events are completed by another host thread
+      event_list[i]->event->wait();
     }
   }
 
@@ -3360,14 +3328,7 @@ clSetUserEventStatus
                     "Event status already set");
   }
 
-  event->event->state = execution_status;
-
-  // Perform callbacks
-  list< pair<void (CL_CALLBACK *)(cl_event, cl_int, void *), void*> >::iterator itr;
-  for (itr = event->callbacks.begin(); itr != event->callbacks.end(); itr++)
-  {
-    itr->first(event, execution_status, itr->second);
-  }
+  event->event->setState(execution_status);
 
   return CL_SUCCESS;
 }
@@ -3398,7 +3359,14 @@ clSetEventCallback
                    command_exec_callback_type);
   }
 
-  event->callbacks.push_back(make_pair(pfn_notify, user_data));
+  // Callbacks run on whichever thread updates the event's state, so keep
+  // the event alive until the callback has been called
+  clRetainEvent(event);
+  event->event->addCallback(command_exec_callback_type,
+    [event,pfn_notify,user_data](int state){
+      pfn_notify(event, state, user_data);
+      clReleaseEvent(event);
+    });
 
   return CL_SUCCESS;
 }
@@ -3495,16 +3463,8 @@ clFinish
     ReturnErrorArg(NULL, CL_INVALID_COMMAND_QUEUE, command_queue);
   }
 
-  while (!command_queue->queue->isEmpty())
-  {
-    // TODO: Move this update to async thread?
-    oclgrind::Queue::Command *cmd = command_queue->queue->update();
-    if (cmd)
-    {
-      asyncQueueRelease(cmd);
-      delete cmd;
-    }
-  }
+  command_queue->queue->finish();
+  asyncQueueUpdate(command_queue);
 
   return CL_SUCCESS;
 }
@@ -0,0 +1,7 @@
+kernel void bank_conflict(global int *output, local int *scratch)
+{
+  int i = get_local_id(0);
+  scratch[i*2] = i;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  output[i] = scratch[i*2];
+}
@@ -0,0 +1,5 @@
+kernel void unit_stride(global int *input, global int *output)
+{
+  int i = get_global_id(0);
+  output[i] = input[i];
+}
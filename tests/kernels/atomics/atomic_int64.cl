@@ -0,0 +1,50 @@
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#pragma OPENCL EXTENSION cl_khr_int64_extended_atomics : enable
+
+kernel void atomic_int64(global long *data, global ulong *udata,
+                         global long *exchange, global long *old)
+{
+  local long scratch[2];
+  long i = get_global_id(0);
+
+  // Signed operations with operands that don't fit in 32 bits
+  atom_add(data, 0x100000000);
+  atom_sub(data+1, 0x100000001);
+  atom_min(data+2, -0x100000000 * (i+1));
+  atom_max(data+3, 0x100000000 * (i+1));
+  atom_inc(data+4);
+  atom_dec(data+5);
+  atom_and(data+6, ~(0x100000000 << i));
+  atom_or(data+7, 0x100000000 << i);
+  atom_xor(data+8, 0x300000000 << i);
+
+  // Unsigned operations that would differ if treated as signed
+  atom_min(udata, 0x8000000000000000 + i);
+  atom_max(udata+1, 0x8000000000000000 + i);
+  atom_sub(udata+2, 0x100000000);
+  atom_xor(udata+3, 0x100000000UL << i);
+
+  // Compare the full 64 bits, then wrap around on success
+  ulong u = atom_cmpxchg(udata+4+i, (ulong)i, 0UL);
+  atom_cmpxchg(udata+4+i, u, u + 0x100000000);
+
+  long a = atom_cmpxchg(exchange+i, i, -1);
+  long b = atom_cmpxchg(exchange+i, a, a + 0x100000000);
+  old[i] = atom_xchg(exchange+i, -b);
+
+  // Local memory atomics
+  if (get_local_id(0) == 0)
+  {
+    scratch[0] = 0x100000000;
+    scratch[1] = 0x100000000;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  atom_add(scratch, 0x100000000 + i);
+  atom_min(scratch+1, -0x100000000 * i);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (get_local_id(0) == 0)
+  {
+    data[9] = scratch[0];
+    data[10] = scratch[1];
+  }
+}
@@ -0,0 +1,8 @@
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+
+kernel void atomic_int64_unaligned(global long *data)
+{
+  global char *char_ptr = (global char*)data + 4;
+  global long *address  = (global long*)char_ptr;
+  atom_add(address, 0x100000001);
+}
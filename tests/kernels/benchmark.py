@@ -0,0 +1,146 @@
+# benchmark.py (Oclgrind)
+# Copyright (c) 2013-2015, James Price and Simon McIntosh-Smith,
+# University of Bristol. All rights reserved.
+#
+# This program is provided under a three-clause BSD license. For full
+# license terms please see the LICENSE file distributed with this
+# source code.
+
+# Measures interpreter throughput (instructions per second) across the
+# kernel test corpus. Only kernel execution is timed, using the --timing
+# option of oclgrind-kernel, so program build time is not included.
+#
+# Results can be saved with -o and passed back in as the baseline for a
+# later run, so that each change can be compared against the same
+# numbers. The baseline can also be a second oclgrind-kernel executable
+# (e.g. from an older build); the speedup column is relative to it.
+
+import os
+import re
+import subprocess
+import sys
+import time
+
+REPEATS = 3
+
+# Check arguments
+args = sys.argv[1:]
+output = None
+if len(args) > 1 and args[0] == '-o':
+  output = args[1]
+  args = args[2:]
+if len(args) < 1 or len(args) > 2:
+  print('Usage: python benchmark.py [-o RESULTS] EXE [BASELINE]')
+  print('')
+  print('BASELINE is another oclgrind-kernel executable, or a results')
+  print('file previously written with -o.')
+  sys.exit(1)
+
+exe = os.path.realpath(args[0])
+baseline = os.path.realpath(args[1]) if len(args) > 1 else None
+test_root = os.path.dirname(os.path.realpath(__file__))
+tests = open(test_root + os.path.sep + 'TESTS').read().split()
+
+# Run single-threaded, without checking plugins
+env = dict(os.environ)
+env['OCLGRIND_NUM_THREADS'] = '1'
+devnull = open(os.devnull, 'w')
+
+def count_instructions(exe, test_dir, sim):
+  # Sum the per-opcode counts reported by the instruction counter
+  proc = subprocess.Popen([exe, '--inst-counts', sim], cwd=test_dir,
+                          stdout=subprocess.PIPE, stderr=devnull, env=env)
+  output = proc.communicate()[0].decode('utf-8', 'replace')
+  total = 0
+  for line in output.splitlines():
+    match = re.match(r'^\s*([0-9,.\' ]+) - ', line)
+    if match:
+      total += int(re.sub(r'[^0-9]', '', match.group(1)))
+  return total
+
+warned = set()
+def time_kernel(exe, test_dir, sim):
+  # Return the fastest of several runs
+  best = None
+  for i in range(REPEATS):
+    start = time.time()
+    proc = subprocess.Popen([exe, '--timing', sim], cwd=test_dir,
+                            stdout=devnull, stderr=subprocess.PIPE, env=env)
+    errors = proc.communicate()[1].decode('utf-8', 'replace')
+    elapsed = time.time() - start
+
+    # Builds without --timing can only be timed from outside, which
+    # includes building the program
+    match = re.search(r'^Kernel execution time: (\S+) s$', errors, re.M)
+    if match:
+      elapsed = float(match.group(1))
+    elif not exe in warned:
+      warned.add(exe)
+      sys.stderr.write('Warning: ' + exe + ' does not support --timing, '
+                       'so its times include building the program\n')
+
+    if best is None or elapsed < best:
+      best = elapsed
+  return max(best, 1e-9)
+
+def load_results(filename):
+  results = {}
+  for line in open(filename):
+    fields = line.split()
+    if len(fields) == 3:
+      results[fields[0]] = (int(fields[1]), float(fields[2]))
+  return results
+
+baseline_results = None
+if baseline and not os.access(baseline, os.X_OK):
+  baseline_results = load_results(baseline)
+
+header = '%-48s %12s %14s' % ('Test', 'Instructions', 'Inst/s')
+if baseline:
+  header += ' %14s %8s' % ('Baseline', 'Speedup')
+print(header)
+
+results = []
+total_instructions = 0
+total_time = 0.0
+total_baseline = 0.0
+for test in tests:
+  sim = test + '.sim'
+  test_dir = os.path.dirname(test_root + os.path.sep + sim)
+  sim = os.path.basename(sim)
+
+  instructions = count_instructions(exe, test_dir, sim)
+  if not instructions:
+    continue
+
+  elapsed = time_kernel(exe, test_dir, sim)
+  results.append((test, instructions, elapsed))
+
+  line = '%-48s %12d %14.0f' % (test, instructions, instructions / elapsed)
+  if baseline:
+    if baseline_results is None:
+      baseline_time = time_kernel(baseline, test_dir, sim)
+    elif test in baseline_results:
+      baseline_time = baseline_results[test][1]
+    else:
+      print(line)
+      continue
+    total_baseline += baseline_time
+    line += ' %14.0f %7.2fx' % (instructions / baseline_time,
+                                baseline_time / elapsed)
+  total_instructions += instructions
+  total_time += elapsed
+  print(line)
+
+line = '%-48s %12d %14.0f' % ('TOTAL', total_instructions,
+                              total_instructions / total_time)
+if baseline:
+  line += ' %14.0f %7.2fx' % (total_instructions / total_baseline,
+                              total_baseline / total_time)
+print('')
+print(line)
+
+if output:
+  with open(output, 'w') as f:
+    for result in results:
+      f.write('%s %d %.9f\n' % result)
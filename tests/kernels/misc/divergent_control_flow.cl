@@ -0,0 +1,40 @@
+int collatz(int n)
+{
+  int steps = 0;
+  while (n > 1)
+  {
+    n = (n % 2) ? 3*n + 1 : n/2;
+    steps++;
+  }
+  return steps;
+}
+
+kernel void divergent_control_flow(global int *output, local int *scratch)
+{
+  int lid = get_local_id(0);
+  int value = collatz(lid + 1);
+
+  switch (lid % 3)
+  {
+  case 0:
+    value += 100;
+    break;
+  case 1:
+    value -= 100;
+    break;
+  default:
+    break;
+  }
+
+  if (lid & 1)
+  {
+    for (int i = 0; i < lid; i++)
+    {
+      value += i;
+    }
+  }
+
+  scratch[lid] = value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  output[lid] = scratch[get_local_size(0) - 1 - lid];
+}
@@ -0,0 +1,24 @@
+int scale(int x, int y)
+{
+  return x*y + 3;
+}
+
+kernel void lockstep_arithmetic(global int *output, global int *vectors)
+{
+  int i = get_global_id(0);
+
+  // Varying operands combined with constants and with each other
+  int a = i*7 + 3;
+  int b = (a << 2) ^ i;
+  output[i] = b + (a > 10);
+
+  // Vector arithmetic across lanes
+  int4 v = (int4)(i, i+1, i+2, i+3);
+  vstore4(v*3 + v, i, vectors);
+
+  // Calls from divergent call sites return to different places
+  if (i & 1)
+    output[i+8] = scale(a, 2);
+  else
+    output[i+8] = scale(b, 5);
+}
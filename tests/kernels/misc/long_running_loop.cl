@@ -0,0 +1,11 @@
+kernel void long_running_loop(global uint16 *output, int iterations)
+{
+  uint16 a = (uint16)(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  uint16 b = 0;
+  for (int i = 0; i < iterations; i++)
+  {
+    a = a*1664525 + 1013904223;
+    b ^= a;
+  }
+  *output = (a ^ b) >> 8;
+}
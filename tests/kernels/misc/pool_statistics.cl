@@ -0,0 +1,5 @@
+kernel void pool_statistics(global int *output)
+{
+  size_t i = get_global_id(0);
+  output[i] = i;
+}
@@ -0,0 +1,10 @@
+kernel void profile_builtins(global int *data, global int *counter,
+                             local int *scratch)
+{
+  event_t event = async_work_group_copy(scratch, data, 16, 0);
+  wait_group_events(1, &event);
+
+  int i = get_local_id(0);
+  vstore4(vload4(i, scratch) + 1, i, data);
+  atomic_inc(counter);
+}
@@ -0,0 +1,22 @@
+kernel void uniform_values(global int *output, int scale, local int *scratch)
+{
+  int lid = get_local_id(0);
+  int group = get_group_id(0);
+  int size = get_local_size(0);
+  int base = group*size*scale + get_num_groups(0);
+
+  // Uniform values computed by only some of the work-items
+  int value = lid;
+  if (lid & 1)
+  {
+    value += base*2 + scale;
+  }
+  else
+  {
+    value -= base;
+  }
+
+  scratch[lid] = value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  output[group*size + lid] = scratch[size - 1 - lid] + base;
+}
@@ -12,6 +12,26 @@ import re
 import subprocess
 import sys
 
+# Tests that check that memory use stays bounded while a kernel runs,
+# with the limit on the address space of the process in megabytes
+MEMORY_LIMITS = {
+  'misc/long_running_loop': 1024,
+}
+
+# Options for tests of features that are not enabled by default
+TEST_OPTIONS = {
+  'access_patterns/bank_conflict': ['--access-patterns'],
+  'access_patterns/strided':       ['--access-patterns'],
+  'access_patterns/unit_stride':   ['--access-patterns'],
+  'misc/pool_statistics':          ['--pool-stats', '--num-threads', '2'],
+}
+
+# Tests that also check the totals in the profile written by --profile,
+# for the events that don't depend on how the kernel was compiled
+PROFILE_TESTS = [
+  'misc/profile_builtins',
+]
+
 # Check arguments
 if len(sys.argv) != 3:
   print 'Usage: python run_kernel_test.py EXE SIMFILE'
@@ -29,6 +49,31 @@ test_name   = os.path.splitext(test_file)[0]
 test_ref    = test_dir + os.path.sep + test_name + '.ref'
 current_dir = os.getcwd()
 
+test_path    = test_dir.split(os.path.sep)[-1] + '/' + test_name
+memory_limit = MEMORY_LIMITS.get(test_path)
+profile      = test_path in PROFILE_TESTS
+if memory_limit:
+  # Each worker thread reserves address space for its own heap
+  os.environ["OCLGRIND_NUM_THREADS"] = "1"
+
+def limit_memory():
+  import resource
+  limit = memory_limit*1024*1024
+  resource.setrlimit(resource.RLIMIT_AS, (limit, limit))
+
+def profile_totals(filename):
+  # Private memory traffic and instruction counts depend on optimisations
+  events = []
+  totals = []
+  for line in open(filename).read().splitlines():
+    if line.startswith('events:'):
+      events = line.split()[1:]
+    elif line.startswith('summary:'):
+      totals = line.split()[1:]
+  return ''.join(['Profile ' + event + ': ' + total + '\n'
+                  for event, total in zip(events, totals)
+                  if event != 'Ir' and not event.startswith('Priv')])
+
 def fail(ret=1):
   print 'FAILED'
   sys.exit(ret)
@@ -49,12 +94,21 @@ def run(output_suffix):
       raise
 
   # Run oclgrind-kernel
+  args = [test_exe, '--data-races', '--uninitialized']
+  args += TEST_OPTIONS.get(test_path, [])
+  test_profile = os.path.realpath(os.path.splitext(test_out)[0] + '.profile')
+  if profile:
+    args += ['--profile', test_profile]
   out = open(test_out, 'w')
   os.chdir(test_dir)
-  retval = subprocess.call([test_exe,
-                            '--data-races', '--uninitialized', test_file],
-                           stdout=out, stderr=out)
+  retval = subprocess.call(args + [test_file],
+                           stdout=out, stderr=out,
+                           preexec_fn=limit_memory if memory_limit else None)
   out.close()
+  if profile and retval == 0:
+    out = open(test_out, 'a')
+    out.write(profile_totals(test_profile))
+    out.close()
   if retval != 0:
     print 'oclgrind-kernel returned non-zero value (' + str(retval) + ')'
     fail(retval)
@@ -114,5 +168,23 @@ os.environ["OCLGRIND_BUILD_OPTIONS"] = "-cl-opt-disable"
 run('_noopt')
 print 'PASSED'
 
+print
+print 'Running test with JIT compilation'
+del os.environ["OCLGRIND_BUILD_OPTIONS"]
+os.environ["OCLGRIND_JIT"] = "1"
+run('_jit')
+print 'PASSED'
+del os.environ["OCLGRIND_JIT"]
+
+# Lockstep execution can change the order in which errors are reported, so
+# only compare its output for tests that are expected to be error-free
+ref = open(test_ref).read().splitlines()
+if not [line for line in ref if line.startswith('ERROR')]:
+  print
+  print 'Running test with lockstep execution'
+  os.environ["OCLGRIND_LOCKSTEP"] = "1"
+  run('_lockstep')
+  print 'PASSED'
+
 # Test passed
 sys.exit(0)